@@ -14,13 +14,30 @@ ANYTHING_NAMESPACE_BEGIN
 
 #define MAX_PATH_LEN 4096
 
+// Not an action of the kernel module, the events of device major:minor are lost,
+// 0:0 means the events of all devices are lost
+#define ACT_EVENTS_LOST 200
+
+// The attributes of the inode when the event happened, sent by the kernel module
+// for the created and the renamed files, mode is 0 if there are none.
+// A created file is still empty then, the daemon stats it instead
+struct file_attrs {
+    uint64_t    ino;
+    uint32_t    mode;
+    int64_t     size;
+    int64_t     mtime;  // seconds since epoch
+};
+
+// The path takes only its own room, the events are allocated from fs_event_arena,
+// which sizes them from offsetof(fs_event, src)
 struct fs_event {
     uint8_t     act;
     uint32_t    cookie;
     uint16_t    major;
-    uint8_t     minor;
-    char        src[MAX_PATH_LEN];
-    char        dst[MAX_PATH_LEN];
+    uint32_t    minor;
+    file_attrs  attrs;
+    uint64_t    time;   // CLOCK_MONOTONIC ns when the kernel module captured the event, 0 if unknown
+    char        src[1]; // runs past the struct, shorter than MAX_PATH_LEN
 };
 
 ANYTHING_NAMESPACE_END
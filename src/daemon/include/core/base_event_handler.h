@@ -12,22 +12,28 @@
 #include "common/anything_fwd.hpp"
 #include "common/fs_event.h"
 #include "core/file_index_manager.h"
+#include "core/latency_stats.h"
 #include "core/thread_pool.h"
 #include "core/config.h"
 
 ANYTHING_NAMESPACE_BEGIN
 
 enum class index_job_type : char {
-    add, remove, update, scan, recursive_update, init_scan
+    add, remove, update, scan, recursive_update, init_scan, rescan, modify
 };
 
 struct index_job {
     std::string src;
     std::optional<std::string> dst;
     index_job_type type;
-
-    index_job(std::string src, index_job_type type, std::optional<std::string> dst = std::nullopt)
-        : src(std::move(src)), dst(std::move(dst)), type(type) {}
+    // The attributes of the added, renamed or modified file, from the event
+    std::optional<file_attrs> attrs;
+    // The capture time of the event of the job, 0 if the job is not from an event
+    uint64_t time;
+
+    index_job(std::string src, index_job_type type, std::optional<std::string> dst = std::nullopt,
+              std::optional<file_attrs> attrs = std::nullopt, uint64_t time = 0)
+        : src(std::move(src)), dst(std::move(dst)), type(type), attrs(attrs), time(time) {}
 };
 
 ANYTHING_NAMESPACE_END
@@ -57,18 +63,28 @@ protected:
 
     std::string get_index_directory() const;
 
-    void add_index_delay(std::string path);
-    void remove_index_delay(std::string path);
-    void update_index_delay(std::string src, std::string dst);
-    void scan_index_delay(std::string path);
-    void recursive_update_index_delay(std::string src, std::string dst);
+    // time is the capture time of the event of the job, for the latency stats
+    void add_index_delay(std::string path, std::optional<anything::file_attrs> attrs = std::nullopt, uint64_t time = 0);
+    void remove_index_delay(std::string path, uint64_t time = 0);
+    void update_index_delay(std::string src, std::string dst, std::optional<anything::file_attrs> attrs = std::nullopt,
+                            uint64_t time = 0);
+    void modify_index_delay(std::string path, std::optional<anything::file_attrs> attrs = std::nullopt, uint64_t time = 0);
+    void scan_index_delay(std::string path, uint64_t time = 0);
+    void recursive_update_index_delay(std::string src, std::string dst, uint64_t time = 0);
     void init_scan_index_delay(std::string path);
+    void rescan_index_delay(std::string path, uint64_t time = 0);
+
+    anything::latency_stats latency_;
 
 private:
     void eat_jobs(std::vector<anything::index_job>& jobs, std::size_t number);
     void eat_job(const anything::index_job& job);
 
-    void jobs_push(std::string src, anything::index_job_type type, std::optional<std::string> dst = std::nullopt);
+    void jobs_push(std::string src, anything::index_job_type type, std::optional<std::string> dst = std::nullopt,
+                   std::optional<anything::file_attrs> attrs = std::nullopt, uint64_t time = 0);
+
+    // Record the commit latency of the jobs updated since the last commit
+    void record_commit_latency();
 
     void timer_worker(int64_t interval);
 
@@ -100,6 +116,10 @@ private:
     gint event_process_thread_count_;
 
     std::atomic<bool> stop_scan_directory_;
+
+    // The capture times of the jobs updated since the last commit, see record_commit_latency()
+    std::vector<uint64_t> uncommitted_times_;
+    std::mutex uncommitted_mtx_;
 };
 
 #endif // ANYTHING_BASE_EVENT_HANDLER_H_
@@ -21,6 +21,8 @@ struct event_handler_config {
     std::map<std::string, std::string> file_type_mapping_original;
     int commit_volatile_index_timeout;
     int commit_persistent_index_timeout;
+    // The threads filtering the events, the events are sharded by their device and top folder
+    int filter_threads;
 };
 
 void print_event_handler_config(const event_handler_config &config);
@@ -51,6 +53,7 @@ private:
     std::string log_level_;
     int commit_volatile_index_timeout_;
     int commit_persistent_index_timeout_;
+    int filter_threads_;
 
     void* dbus_connection_;
     std::string resource_path_;
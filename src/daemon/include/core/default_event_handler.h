@@ -6,10 +6,19 @@
 #ifndef ANYTHING_EVENT_HANDLER_H_
 #define ANYTHING_EVENT_HANDLER_H_
 
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <glib.h>
 #include "core/base_event_handler.h"
+#include "core/event_ring.h"
 #include "core/mount_info.h"
 
 ANYTHING_NAMESPACE_BEGIN
@@ -26,6 +35,10 @@ struct fs_event_with_full_path {
     dev_t       device_id;
     std::string src;
     std::string dst;
+    // The attributes of the file at src, or at dst of a rename
+    std::optional<file_attrs> attrs;
+    // The capture time of the event, see fs_event
+    uint64_t    time = 0;
 };
 
 class default_event_handler : public base_event_handler {
@@ -47,19 +60,86 @@ public:
 
     bool convert_fs_event(fs_event *event, fs_event_with_full_path *event_with_full_path);
 
+    // Called after the listener stopped, the caller takes over the producer side of the queue
     void terminate_filter();
 
+    // Rescan the indexing paths on the device whose events are lost, 0:0 for all devices
+    void rescan_device(uint16_t major, uint32_t minor);
+
+    // Push the indexing paths and the blocked paths down to the kernel module
+    void install_kernel_path_filters();
+    void clear_kernel_path_filters();
+
+    // Rescan the new place of the recently rescanned folders under a moved folder
+    void rescan_moved_subtrees(const std::string& src, const std::string& dst);
+
     static void* event_filter_thread_func(void* data);
 
 private:
+    // The queue is full, the device of the event is rescanned instead
+    void drop_event(fs_event* event);
+    // Rescan the devices of the dropped events, in the filter thread
+    void rescan_dropped_devices();
+
+    // The events of a path always go to the same shard, so they are filtered in order.
+    // The events that touch several shards, or all of them, are filtered by the filter
+    // thread itself once the shards involved are drained.
+    struct filter_shard {
+        explicit filter_shard(std::size_t size) : events(size) {}
+
+        event_ring events;
+        std::thread thread;
+        // The events given to the shard, by the filter thread only
+        uint32_t sent = 0;
+        // The events filtered by the shard
+        std::atomic<uint32_t> done{ 0 };
+    };
+
+    std::size_t shard_of(const fs_event* event) const;
+    void dispatch_event(fs_event* event);
+    void push_to_shard(filter_shard& shard, fs_event* event);
+    void drain_shard(filter_shard& shard);
+    void drain_shards();
+    void stop_shards(fs_event* terminate);
+    static void shard_thread_func(default_event_handler* handler, filter_shard* shard);
+
+    // The shards may pair the renames and scan the subtrees concurrently
+    std::mutex rename_mtx_;
     std::unordered_map<uint32_t, std::string> rename_from_;
+    // The folders of the recent ACT_SUBTREE_CHANGED events
+    static constexpr std::size_t max_subtree_scans = 16;
+    std::mutex subtree_mtx_;
+    std::deque<std::string> subtree_scans_;
     std::shared_ptr<event_handler_config> config_;
     std::vector<indexing_item> indexing_items_;
     std::vector<std::string> event_path_blocked_list_;
 
-    GAsyncQueue* event_queue_;
+    // The events from the listener thread to the filter thread, the ones that do not fit are dropped,
+    // a burst is bounded by the rescans instead of the memory
+    static constexpr std::size_t event_queue_size = 64 * 1024;
+    static constexpr std::size_t filter_batch = 256;
+    event_ring event_queue_{ event_queue_size };
     GThread* event_filter_thread_;
 
+    // The devices of the dropped events, 0 for all devices
+    std::mutex dropped_mtx_;
+    std::unordered_set<dev_t> dropped_devices_;
+    bool dropped_mount_ = false;
+    std::atomic<bool> dropped_{ false };
+    // The marker is queued once there is room after a drop, by the listener thread only
+    fs_event dropped_marker_{};
+    bool dropped_marker_pending_ = false;
+
+    // None if the filter thread filters all the events
+    static constexpr std::size_t filter_shard_size = 4096;
+    std::vector<std::unique_ptr<filter_shard>> filter_shards_;
+    // The shards of the rename sources not paired yet, by cookie, by the filter thread only.
+    // A source moved out of the indexed paths is never paired, the oldest cookies are
+    // forgotten, their late halves are filtered in the shard of the destination
+    static constexpr std::size_t max_rename_shards = 1024;
+    std::unordered_map<uint32_t, std::size_t> rename_shards_;
+    std::deque<uint32_t> rename_cookies_;
+
     MountInfo *mount_info_;
 };
 
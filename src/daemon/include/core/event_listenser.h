@@ -8,14 +8,25 @@
 
 #include <atomic>
 #include <functional>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
+#include <sys/socket.h>
+#include <linux/netlink.h>
 #include <netlink/attr.h>
 #include <netlink/handlers.h>
 
 #include "common/anything_fwd.hpp"
 #include "common/fs_event.h"
 #include "common/vfs_genl.h"
+// Shared with the kernel module, the records end with a flexible path
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#include "common/vfs_ring.h"
+#pragma GCC diagnostic pop
+#include "core/fs_event_arena.h"
 
 ANYTHING_NAMESPACE_BEGIN
 
@@ -38,12 +49,32 @@ public:
 private:
     bool connect(nl_sock_ptr& sk) const;
     void disconnect(nl_sock_ptr& sk) const;
-    bool set_callback(nl_sock_ptr& sk, nl_recvmsg_msg_cb_t func);
     int get_fd(nl_sock_ptr& sk) const;
 
+    // The path of the event is dir, or dir/name if name is not empty
+    fs_event* make_fs_event(uint8_t act, uint32_t cookie, uint16_t major, uint32_t minor,
+                            std::string_view dir, std::string_view name = {},
+                            const file_attrs& attrs = {}, uint64_t time = 0);
+
+    // The handler releases the event to fs_event_arena
     void forward_event_to_handler(fs_event *event) const;
 
-    static int event_handler(nl_msg_ptr msg, void* arg);
+    // The events of a device carry consecutive seqs, holes and lost markers are forwarded
+    // as ACT_EVENTS_LOST events so that only the affected devices are rescanned.
+    // Return false if the seq is seen already
+    bool check_device_seq(uint16_t major, uint32_t minor, uint64_t seq);
+    void handle_lost_marker(uint16_t major, uint32_t minor, uint64_t seq);
+    void forward_lost_event(uint16_t major, uint32_t minor);
+
+    // Shared memory rings of the kernel module, genl is used when they are unavailable
+    bool open_ring();
+    void close_ring();
+    bool read_ring();
+
+    // Read the queued datagrams of the socket in batches and parse them in place,
+    // return false if the socket dropped messages
+    bool receive_messages();
+    void handle_message(nlmsghdr* nlh);
 
 private:
     nl_sock_ptr mcsk_;
@@ -52,6 +83,31 @@ private:
     int timeout_;
     std::function<void(fs_event*)> handler_;
     std::thread listening_thread_;
+    fs_event_arena arena_;
+
+    // The reusable buffer of the datagrams of one receive
+    std::vector<char> recv_buffer_;
+    std::vector<iovec> recv_iovecs_;
+    std::vector<mmsghdr> recv_headers_;
+    std::vector<sockaddr_nl> recv_addrs_;
+
+    // The last seq of each device, the kernel module supports seqs once one is received
+    std::unordered_map<dev_t, uint64_t> device_seqs_;
+    bool seq_supported_;
+
+    int ring_fd_;
+    void* ring_area_;
+    std::size_t ring_area_size_;
+    std::vector<uint64_t> ring_lost_;
+    std::vector<uint64_t> ring_tails_;
+    std::vector<uint64_t> ring_heads_;
+    // A record with its position in its ring
+    struct ring_record {
+        const vfs_ring_record* record;
+        uint64_t position;
+        uint32_t ring;
+    };
+    std::vector<ring_record> ring_records_;
 };
 
 ANYTHING_NAMESPACE_END
@@ -0,0 +1,52 @@
+// SPDX-FileCopyrightText: 2026 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef ANYTHING_EVENT_RING_H_
+#define ANYTHING_EVENT_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "common/anything_fwd.hpp"
+#include "common/fs_event.h"
+
+ANYTHING_NAMESPACE_BEGIN
+
+// A bounded queue of events from one producer thread to one consumer thread.
+// Neither side takes a lock, the consumer sleeps on the tail when the ring is
+// empty and the producer wakes it only if it does sleep.
+class event_ring {
+public:
+    // The capacity is rounded up to a power of two
+    explicit event_ring(std::size_t capacity);
+
+    event_ring(const event_ring&) = delete;
+    event_ring& operator=(const event_ring&) = delete;
+
+    // Producer, false if the ring is full, the event is not taken then
+    bool push(fs_event* event);
+
+    // Consumer, wait for the events and take up to max of them, in order
+    std::size_t pop(fs_event** events, std::size_t max);
+
+    // The events queued, exact only on the consumer side
+    std::size_t size() const;
+    std::size_t capacity() const { return mask_ + 1; }
+
+private:
+    // The counters wrap, their difference is the size as the capacity is a power of two
+    alignas(64) std::atomic<uint32_t> head_{ 0 };
+    alignas(64) std::atomic<uint32_t> tail_{ 0 };
+    // The consumer is about to sleep or sleeps on the tail
+    alignas(64) std::atomic<bool> waiting_{ false };
+
+    uint32_t mask_;
+    std::unique_ptr<fs_event*[]> slots_;
+};
+
+ANYTHING_NAMESPACE_END
+
+#endif // ANYTHING_EVENT_RING_H_
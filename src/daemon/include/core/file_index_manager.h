@@ -8,10 +8,13 @@
 
 #include <atomic>
 #include <mutex>
+#include <optional>
+#include <unordered_map>
 
 #include <lucene++/LuceneHeaders.h>
 
 #include "common/anything_fwd.hpp"
+#include "common/fs_event.h"
 #include "core/pinyin_processor.h"
 
 ANYTHING_NAMESPACE_BEGIN
@@ -32,7 +35,8 @@ public:
 
     /// @brief Add a path to the index.
     /// @param path The full path to be added.
-    bool add_index(const std::string& path);
+    /// @param attrs The attributes of the file if known, the file is not stat'ed then.
+    bool add_index(const std::string& path, const std::optional<file_attrs>& attrs = std::nullopt);
 
     /// @brief Remove the path from the index.
     /// @param path The full path to be removed.
@@ -41,7 +45,14 @@ public:
     /// @brief Removes the old path and inserts the new path into the index.
     /// @param old_path The existing path to be removed from the index.
     /// @param new_path The new path to be added to the index.
-    bool update_index(const std::string& old_path, const std::string& new_path);
+    /// @param attrs The attributes of the file if known, the file is not stat'ed then.
+    bool update_index(const std::string& old_path, const std::string& new_path,
+                      const std::optional<file_attrs>& attrs = std::nullopt);
+
+    /// @brief Refresh the size and the modify time of an indexed path, a path that is not indexed is left out.
+    /// @param path The full path of the written file.
+    /// @param attrs The attributes of the file if known, the file is not stat'ed then.
+    bool modify_index(const std::string& path, const std::optional<file_attrs>& attrs = std::nullopt);
 
     /// Commit all changes to the index
     bool commit(index_status status);
@@ -79,6 +90,13 @@ private:
     /// Refresh the index reader if there are changes
     void try_refresh_reader(bool nrt = false);
 
+    /// Record that the path is indexed or removed by the writer, for written_document_exists()
+    void note_written_path(const std::string& path, bool indexed);
+
+    /// Check if the path is indexed, without reopening the near real-time reader for every write:
+    /// the paths written since it was opened are looked up first, then the reader.
+    bool written_document_exists(const std::string& path);
+
     /**
      * Perform the actual search based on the file path.
      * @param exact_match If true, performs an exact match search. Otherwise, performs a fuzzy search 
@@ -110,6 +128,11 @@ private:
     Lucene::IndexReaderPtr nrt_reader_;
     std::mutex mtx_;
     std::mutex reader_mtx_;
+    // The paths written since the near real-time reader was opened, true if indexed,
+    // not all of them are kept if it overflows
+    std::unordered_map<std::string, bool> written_paths_;
+    bool written_paths_overflow_ = false;
+    std::mutex written_mtx_;
     pinyin_processor pinyin_processor_;
     std::atomic<bool> search_cancelled_{false};
     const std::map<std::string, std::string> file_type_mapping_;
@@ -0,0 +1,48 @@
+// SPDX-FileCopyrightText: 2026 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef ANYTHING_FS_EVENT_ARENA_H_
+#define ANYTHING_FS_EVENT_ARENA_H_
+
+#include <cstddef>
+
+#include "common/anything_fwd.hpp"
+#include "common/fs_event.h"
+
+ANYTHING_NAMESPACE_BEGIN
+
+// The events are carved one after another from pooled chunks, each takes only the
+// room of its path. The receiving thread allocates, any thread releases, in any
+// order. A chunk goes back to the pool once all its events are released and the
+// arena has moved on to another chunk.
+class fs_event_arena {
+public:
+    // The chunks are aligned to their size, the chunk of an event is found from its address
+    static constexpr std::size_t chunk_size = 256 * 1024;
+
+    fs_event_arena() = default;
+    ~fs_event_arena();
+
+    fs_event_arena(const fs_event_arena&) = delete;
+    fs_event_arena& operator=(const fs_event_arena&) = delete;
+
+    // An event with room for a path of path_len bytes and its terminator,
+    // only one thread allocates from an arena
+    fs_event* alloc(std::size_t path_len);
+
+    // Release an event of any arena, from any thread
+    static void release(fs_event* event);
+
+private:
+    struct chunk;
+
+    static void unref(chunk* chunk);
+
+    chunk* current_ = nullptr;
+    std::size_t used_ = 0;
+};
+
+ANYTHING_NAMESPACE_END
+
+#endif // ANYTHING_FS_EVENT_ARENA_H_
@@ -0,0 +1,56 @@
+// SPDX-FileCopyrightText: 2026 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef ANYTHING_LATENCY_STATS_H_
+#define ANYTHING_LATENCY_STATS_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "common/anything_fwd.hpp"
+
+ANYTHING_NAMESPACE_BEGIN
+
+// The stages an event goes through in the daemon, in order
+enum class latency_stage : char {
+    receive,    // taken from the kernel module
+    filter,     // passed the filters, the path is resolved
+    enqueue,    // its index job is queued
+    update,     // the index is updated by the job
+    commit,     // the update is committed, it shows up in the search
+    count
+};
+
+// Histograms of the time from the kernel module capturing an event to each stage,
+// bucket i counts the latencies in [2^i, 2^(i+1)) us, bucket 0 also counts < 1 us
+class latency_stats {
+public:
+    static constexpr std::size_t buckets = 24;
+
+    // The clock of the capture time of the events, CLOCK_MONOTONIC in ns
+    static uint64_t now();
+
+    // Record the latency of an event captured at time, 0 means the time is unknown
+    void record(latency_stage stage, uint64_t time, uint64_t now = latency_stats::now());
+
+    // Record the events found queued for the filter thread, once per batch it takes,
+    // with the same buckets as the latencies
+    void record_queue(std::size_t occupancy);
+    // An event is dropped as the queue is full
+    void record_dropped() { dropped_.fetch_add(1, std::memory_order_relaxed); }
+
+    // Save the histograms as json, a file next to status.json
+    bool save(const std::string& path) const;
+
+private:
+    std::array<std::array<std::atomic<uint64_t>, buckets>, static_cast<std::size_t>(latency_stage::count)> histograms_{};
+    std::array<std::atomic<uint64_t>, buckets> queue_{};
+    std::atomic<uint64_t> dropped_{ 0 };
+};
+
+ANYTHING_NAMESPACE_END
+
+#endif // ANYTHING_LATENCY_STATS_H_
@@ -114,24 +114,29 @@ std::string base_event_handler::get_index_directory() const {
     return index_manager_.index_directory();
 }
 
-void base_event_handler::add_index_delay(std::string path) {
-    jobs_push(std::move(path), anything::index_job_type::add);
+void base_event_handler::add_index_delay(std::string path, std::optional<anything::file_attrs> attrs, uint64_t time) {
+    jobs_push(std::move(path), anything::index_job_type::add, std::nullopt, attrs, time);
 }
 
-void base_event_handler::remove_index_delay(std::string path) {
-    jobs_push(std::move(path), anything::index_job_type::remove);
+void base_event_handler::remove_index_delay(std::string path, uint64_t time) {
+    jobs_push(std::move(path), anything::index_job_type::remove, std::nullopt, std::nullopt, time);
 }
 
-void base_event_handler::update_index_delay(std::string src, std::string dst) {
-    jobs_push(std::move(src), anything::index_job_type::update, std::move(dst));
+void base_event_handler::update_index_delay(std::string src, std::string dst, std::optional<anything::file_attrs> attrs,
+                                            uint64_t time) {
+    jobs_push(std::move(src), anything::index_job_type::update, std::move(dst), attrs, time);
 }
 
-void base_event_handler::scan_index_delay(std::string path) {
-    jobs_push(std::move(path), anything::index_job_type::scan);
+void base_event_handler::modify_index_delay(std::string path, std::optional<anything::file_attrs> attrs, uint64_t time) {
+    jobs_push(std::move(path), anything::index_job_type::modify, std::nullopt, attrs, time);
 }
 
-void base_event_handler::recursive_update_index_delay(std::string src, std::string dst) {
-    jobs_push(std::move(src), anything::index_job_type::recursive_update, std::move(dst));
+void base_event_handler::scan_index_delay(std::string path, uint64_t time) {
+    jobs_push(std::move(path), anything::index_job_type::scan, std::nullopt, std::nullopt, time);
+}
+
+void base_event_handler::recursive_update_index_delay(std::string src, std::string dst, uint64_t time) {
+    jobs_push(std::move(src), anything::index_job_type::recursive_update, std::move(dst), std::nullopt, time);
 }
 
 void base_event_handler::init_scan_index_delay(std::string path) {
@@ -139,6 +144,10 @@ void base_event_handler::init_scan_index_delay(std::string path) {
     jobs_push(std::move(path), anything::index_job_type::init_scan);
 }
 
+void base_event_handler::rescan_index_delay(std::string path, uint64_t time) {
+    jobs_push(std::move(path), anything::index_job_type::rescan, std::nullopt, std::nullopt, time);
+}
+
 void base_event_handler::eat_jobs(std::vector<anything::index_job>& jobs, std::size_t number) {
     std::vector<anything::index_job> processing_jobs;
     processing_jobs.insert(
@@ -160,16 +169,19 @@ void base_event_handler::eat_job(const anything::index_job& job) {
 
     switch (job.type) {
         case anything::index_job_type::add:
-            ret = index_manager_.add_index(job.src);
+            ret = index_manager_.add_index(job.src, job.attrs);
             break;
         case anything::index_job_type::remove:
             ret = index_manager_.remove_index(job.src);
             break;
         case anything::index_job_type::update:
             if (job.dst) {
-                ret = index_manager_.update_index(job.src, *job.dst);
+                ret = index_manager_.update_index(job.src, *job.dst, job.attrs);
             }
             break;
+        case anything::index_job_type::modify:
+            ret = index_manager_.modify_index(job.src, job.attrs);
+            break;
         case anything::index_job_type::scan:
             ret = scan_directory(job.src, [this](const std::string& path) {
                 return index_manager_.add_index(path);
@@ -218,6 +230,35 @@ void base_event_handler::eat_job(const anything::index_job& job) {
                 ret = true;
             }
             break;
+        case anything::index_job_type::rescan:
+            {
+                // Remove the indexes of the files that are gone, then index the files that are there
+                auto indexed_items = index_manager_.traverse_directory(job.src, true, ret);
+                if (!ret)
+                    break;
+
+                std::error_code ec;
+                for (auto const& path : indexed_items) {
+                    if (!std::filesystem::exists(path, ec)) {
+                        ret = index_manager_.remove_index(path);
+                        if (!ret)
+                            break;
+                    }
+                }
+                if (!ret)
+                    break;
+
+                // The folder may be gone by now, the indexes under it are removed above
+                if (!std::filesystem::is_directory(job.src, ec))
+                    break;
+
+                // The indexed files may be replaced within the summary, add_index() refreshes their
+                // documents too. The size and the modify time are not stored, so they can not be compared
+                ret = scan_directory(job.src, [this](const std::string& path) {
+                    return index_manager_.add_index(path);
+                });
+            }
+            break;
         default:
             spdlog::error("Invalid job type: {}", static_cast<int>(job.type));
             break;
@@ -226,15 +267,39 @@ void base_event_handler::eat_job(const anything::index_job& job) {
     if (!ret) {
         spdlog::info("Failed to process job");
         set_index_invalid_and_restart();
+    } else if (job.time) {
+        latency_.record(anything::latency_stage::update, job.time);
+        // The updates are waiting for the commit, drop the times of a burst that is too long
+        constexpr std::size_t max_uncommitted_times = 65536;
+        std::lock_guard<std::mutex> lock(uncommitted_mtx_);
+        if (uncommitted_times_.size() < max_uncommitted_times)
+            uncommitted_times_.push_back(job.time);
+    }
+}
+
+void base_event_handler::record_commit_latency() {
+    std::vector<uint64_t> times;
+    {
+        std::lock_guard<std::mutex> lock(uncommitted_mtx_);
+        times.swap(uncommitted_times_);
     }
+    if (times.empty())
+        return;
+
+    uint64_t now = anything::latency_stats::now();
+    for (auto time : times)
+        latency_.record(anything::latency_stage::commit, time, now);
+    latency_.save(config_->volatile_index_dir + "/latency.json");
 }
 
 void base_event_handler::jobs_push(std::string src,
-    anything::index_job_type type, std::optional<std::string> dst) {
+    anything::index_job_type type, std::optional<std::string> dst, std::optional<anything::file_attrs> attrs,
+    uint64_t time) {
 
+    latency_.record(anything::latency_stage::enqueue, time);
     std::lock_guard<std::mutex> lock(jobs_mtx_);
     index_dirty_ = true;
-    jobs_.emplace_back(std::move(src), type, std::move(dst));
+    jobs_.emplace_back(std::move(src), type, std::move(dst), attrs, time);
     if (jobs_.size() >= batch_size_) {
         eat_jobs(jobs_, batch_size_);
     }
@@ -270,6 +335,8 @@ void base_event_handler::timer_worker(int64_t interval) {
                 if (!index_manager_.commit(index_status_)) {
                     spdlog::info("Failed to commit index");
                     set_index_invalid_and_restart();
+                } else {
+                    record_commit_latency();
                 }
                 commit_volatile_index_timeout_ = config_->commit_volatile_index_timeout;
                 index_dirty_ = false;
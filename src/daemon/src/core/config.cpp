@@ -18,6 +18,9 @@
 #define COMMIT_PERSISTENT_INDEX_TIMEOUT_DEFAULT 600
 #define COMMIT_PERSISTENT_INDEX_TIMEOUT_MIN 60
 #define COMMIT_PERSISTENT_INDEX_TIMEOUT_MAX 3600
+#define FILTER_THREADS_DEFAULT 1
+#define FILTER_THREADS_MIN 1
+#define FILTER_THREADS_MAX 64
 
 void print_event_handler_config(const event_handler_config &config) {
     spdlog::info("Persistent index dir: {}", config.persistent_index_dir);
@@ -36,6 +39,7 @@ void print_event_handler_config(const event_handler_config &config) {
     }
     spdlog::info("Commit volatile index timeout: {}", config.commit_volatile_index_timeout);
     spdlog::info("Commit persistent index timeout: {}", config.commit_persistent_index_timeout);
+    spdlog::info("Filter threads: {}", config.filter_threads);
 }
 
 // 获取dconfig资源路径
@@ -265,6 +269,10 @@ Config::Config()
         commit_persistent_index_timeout_ > COMMIT_PERSISTENT_INDEX_TIMEOUT_MAX) {
         commit_persistent_index_timeout_ = COMMIT_PERSISTENT_INDEX_TIMEOUT_DEFAULT;
     }
+    filter_threads_ = get_config_int64((GDBusConnection*)dbus_connection_, resource_path_, "filter_threads");
+    if (filter_threads_ < FILTER_THREADS_MIN || filter_threads_ > FILTER_THREADS_MAX) {
+        filter_threads_ = FILTER_THREADS_DEFAULT;
+    }
 
     // Replace $HOME with actual home directory path
     for (auto& path : blacklist_paths_) {
@@ -328,6 +336,7 @@ std::shared_ptr<event_handler_config> Config::make_event_handler_config()
     }
     config->commit_volatile_index_timeout = commit_volatile_index_timeout_;
     config->commit_persistent_index_timeout = commit_persistent_index_timeout_;
+    config->filter_threads = filter_threads_;
 
     return config;
 }
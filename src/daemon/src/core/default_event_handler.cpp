@@ -6,20 +6,28 @@
 #include "core/default_event_handler.h"
 
 #include <cstdlib> // std::getenv
+#include <string_view>
+#include <thread>
 #include <glib.h>
 #include <gmodule.h>
 #include <sys/sysmacros.h>
+#include <sys/stat.h>
 
 #include "utils/log.h"
 #include "utils/string_helper.h"
 #include "vfs_change_consts.h"
 #include "core/config.h"
+#include "core/fs_event_arena.h"
 #include "utils/tools.h"
 #include "utils/string_helper.h"
 
 ANYTHING_NAMESPACE_BEGIN
 
 #define ACT_TERMINATE 100
+// Queued behind the events that were queued when an event was dropped
+#define ACT_DROPPED_MARKER 101
+
+#define VFS_PATH_FILTERS_FILE "/sys/kernel/vfs_monitor/vfs_path_filters"
 
 // 检查 event_path 与 indexing_items_ 中的 event_path 是否冲突
 bool is_event_path_conflict_with_indexing_items(const std::string& event_path,
@@ -67,7 +75,14 @@ std::string get_event_path(const std::string& origin_path, const std::vector<ind
 // /data 和非 data 需要保持一致，最好有一种方式能够获取当前的状态
 default_event_handler::default_event_handler(std::shared_ptr<event_handler_config> config)
     : base_event_handler(config), config_(config) {
-    event_queue_ = g_async_queue_new();
+    dropped_marker_.act = ACT_DROPPED_MARKER;
+    if (config_->filter_threads > 1) {
+        for (int i = 0; i < config_->filter_threads; ++i) {
+            auto shard = std::make_unique<filter_shard>(filter_shard_size);
+            shard->thread = std::thread(shard_thread_func, this, shard.get());
+            filter_shards_.push_back(std::move(shard));
+        }
+    }
     event_filter_thread_ = g_thread_new("event_filter", event_filter_thread_func, this);
 
     // init indexing_items_
@@ -129,9 +144,12 @@ default_event_handler::default_event_handler(std::shared_ptr<event_handler_confi
     // remove the last "\n"
     dump[strlen(dump) - 1] = '\0';
     spdlog::info("{}", dump);
+
+    install_kernel_path_filters();
 }
 
 default_event_handler::~default_event_handler() {
+    clear_kernel_path_filters();
     mount_info_free(mount_info_);
 }
 
@@ -157,7 +175,63 @@ bool default_event_handler::is_event_path_blocked(const std::string& path, index
 }
 
 void default_event_handler::handle(fs_event *event) {
-    g_async_queue_push(event_queue_, event);
+    latency_.record(anything::latency_stage::receive, event->time);
+    // The rescan of the dropped events waits for the events queued before them
+    if (dropped_marker_pending_ && event_queue_.push(&dropped_marker_))
+        dropped_marker_pending_ = false;
+    if (!event_queue_.push(event))
+        drop_event(event);
+}
+
+void default_event_handler::drop_event(fs_event* event) {
+    latency_.record_dropped();
+    bool dropped;
+    {
+        std::lock_guard<std::mutex> lock(dropped_mtx_);
+        if (event->act == ACT_MOUNT || event->act == ACT_UNMOUNT) {
+            // The mount points may have changed, refresh them and rescan everything
+            dropped_mount_ = true;
+            dropped_devices_.insert(0);
+        } else {
+            dropped_devices_.insert(makedev(event->major, event->minor));
+        }
+        dropped = dropped_.exchange(true, std::memory_order_acq_rel);
+    }
+    dropped_marker_pending_ = true;
+    fs_event_arena::release(event);
+
+    // Once per burst
+    if (!dropped)
+        spdlog::warn("The event queue is full, the events are dropped and their devices will be rescanned");
+}
+
+void default_event_handler::rescan_dropped_devices() {
+    if (!dropped_.load(std::memory_order_relaxed))
+        return;
+
+    // The events queued before the drops are dispatched, wait until they are filtered
+    drain_shards();
+
+    std::unordered_set<dev_t> devices;
+    bool mount_changed;
+    {
+        std::lock_guard<std::mutex> lock(dropped_mtx_);
+        devices.swap(dropped_devices_);
+        mount_changed = dropped_mount_;
+        dropped_mount_ = false;
+        dropped_.store(false, std::memory_order_relaxed);
+    }
+
+    if (mount_changed) {
+        mount_info_update(mount_info_);
+        install_kernel_path_filters();
+    }
+    if (devices.count(0)) {
+        rescan_device(0, 0);
+        return;
+    }
+    for (dev_t device : devices)
+        rescan_device(major(device), minor(device));
 }
 
 void default_event_handler::start_handle_init_scan(const std::string &path) {
@@ -183,11 +257,22 @@ bool default_event_handler::convert_fs_event(fs_event *event, fs_event_with_full
     if (event->act == ACT_MOUNT || event->act == ACT_UNMOUNT) {
         spdlog::debug("{}: {}", (event->act == ACT_MOUNT ? "Mount a device" : "Unmount a device"), event->src);
         mount_info_update(mount_info_);
+        // The device numbers of the paths may change
+        install_kernel_path_filters();
         return true;
     }
 
+    if (event->act == ACT_EVENTS_LOST) {
+        rescan_device(event->major, event->minor);
+        return true;
+    }
+
+    if (event->attrs.mode != 0)
+        event_with_full_path->attrs = event->attrs;
+    event_with_full_path->time = event->time;
+
     std::string root;
-    if (event->act < ACT_MOUNT) {
+    if (event->act < ACT_MOUNT || event->act == ACT_SUBTREE_CHANGED || event->act == ACT_MODIFY_FILE) {
         event_with_full_path->device_id = makedev(event->major, event->minor);
 
         const char *mount_point = mount_info_get_device_mount_point(mount_info_, event_with_full_path->device_id);
@@ -208,6 +293,8 @@ bool default_event_handler::convert_fs_event(fs_event *event, fs_event_with_full
     case ACT_NEW_FOLDER:
     case ACT_DEL_FILE:
     case ACT_DEL_FOLDER:
+    case ACT_SUBTREE_CHANGED:
+    case ACT_MODIFY_FILE:
         {
             event_with_full_path->act = event->act;
             event_with_full_path->src = event->src;
@@ -216,15 +303,22 @@ bool default_event_handler::convert_fs_event(fs_event *event, fs_event_with_full
         break;
     case ACT_RENAME_FROM_FILE:
     case ACT_RENAME_FROM_FOLDER:
-        rename_from_.emplace(event->cookie, event->src);
+        {
+            std::lock_guard<std::mutex> lock(rename_mtx_);
+            rename_from_.emplace(event->cookie, event->src);
+        }
         return true;
     case ACT_RENAME_TO_FILE:
     case ACT_RENAME_TO_FOLDER:
-        if (auto search = rename_from_.find(event->cookie);
-            search != rename_from_.end()) {
-            event_with_full_path->act = event->act == ACT_RENAME_TO_FILE ? ACT_RENAME_FILE : ACT_RENAME_FOLDER;
-            event_with_full_path->dst = event->src;
-            event_with_full_path->src = rename_from_[event->cookie];
+        {
+            std::lock_guard<std::mutex> lock(rename_mtx_);
+            if (auto search = rename_from_.find(event->cookie);
+                search != rename_from_.end()) {
+                event_with_full_path->act = event->act == ACT_RENAME_TO_FILE ? ACT_RENAME_FILE : ACT_RENAME_FOLDER;
+                event_with_full_path->dst = event->src;
+                event_with_full_path->src = std::move(search->second);
+                rename_from_.erase(search);
+            }
         }
         break;
     case ACT_RENAME_FILE:
@@ -242,10 +336,6 @@ bool default_event_handler::convert_fs_event(fs_event *event, fs_event_with_full
             event_with_full_path->dst = root + event_with_full_path->dst;
     }
 
-    if (event->act == ACT_RENAME_FILE || event->act == ACT_RENAME_FOLDER) {
-        rename_from_.erase(event->cookie);
-    }
-
     return false;
 }
 
@@ -278,7 +368,9 @@ void default_event_handler::filter_event(fs_event *fs_event) {
         return;
     }
 
-    spdlog::debug("Received event: {} {} {}", act_names[event.act], event.src, event.dst);
+    spdlog::debug("Received event: {} {} {}",
+        event.act < std::size(act_names) ? act_names[event.act] :
+            (event.act == ACT_MODIFY_FILE ? "file_modified" : "subtree_changed"), event.src, event.dst);
 
     // Preparations are done, starting to process the event.
 
@@ -294,14 +386,22 @@ void default_event_handler::filter_event(fs_event *fs_event) {
         return;
     }
 
+    latency_.record(anything::latency_stage::filter, event.time);
+
     if (event.act == ACT_NEW_FILE || event.act == ACT_NEW_SYMLINK ||
         event.act == ACT_NEW_LINK || event.act == ACT_NEW_FOLDER) {
         // Do not check for the existence of files; we trust the kernel module.
+        // The attributes are taken as the file is created, before it is written, and the
+        // modify events that would correct them are optional, so the file is stat'ed later
+        convert_event_path_to_origin_path(event.src, *src_indexing_item);
+        add_index_delay(std::move(event.src), std::nullopt, event.time);
+    } else if (event.act == ACT_DEL_FILE) {
         convert_event_path_to_origin_path(event.src, *src_indexing_item);
-        add_index_delay(std::move(event.src));
-    } else if (event.act == ACT_DEL_FILE || event.act == ACT_DEL_FOLDER) {
+        remove_index_delay(std::move(event.src), event.time);
+    } else if (event.act == ACT_DEL_FOLDER) {
+        // Remove the indexes under the folder too, the kernel module drops the deletes under it
         convert_event_path_to_origin_path(event.src, *src_indexing_item);
-        remove_index_delay(std::move(event.src));
+        recursive_update_index_delay(std::move(event.src), "", event.time);
     } else if (event.act == ACT_RENAME_FILE) {
         bool isSrcBlocked = is_event_path_blocked(event.src, src_indexing_item);
         bool isDstBlocked = is_event_path_blocked(event.dst, dst_indexing_item);
@@ -310,14 +410,14 @@ void default_event_handler::filter_event(fs_event *fs_event) {
             return;
         } else if (isSrcBlocked) {
             convert_event_path_to_origin_path(event.dst, *dst_indexing_item);
-            add_index_delay(std::move(event.dst));
+            add_index_delay(std::move(event.dst), event.attrs, event.time);
         } else if (isDstBlocked) {
             convert_event_path_to_origin_path(event.src, *src_indexing_item);
-            remove_index_delay(std::move(event.src));
+            remove_index_delay(std::move(event.src), event.time);
         } else {
             convert_event_path_to_origin_path(event.src, *src_indexing_item);
             convert_event_path_to_origin_path(event.dst, *dst_indexing_item);
-            update_index_delay(std::move(event.src), std::move(event.dst));
+            update_index_delay(std::move(event.src), std::move(event.dst), event.attrs, event.time);
         }
     } else if (event.act == ACT_RENAME_FOLDER) {
         // Rename all files/folders in this folder(including this folder)
@@ -330,7 +430,7 @@ void default_event_handler::filter_event(fs_event *fs_event) {
 
         if (isSrcBlocked) {
             convert_event_path_to_origin_path(event.dst, *dst_indexing_item);
-            add_index_delay(event.dst);
+            add_index_delay(event.dst, event.attrs, event.time);
             scan_index_delay(std::move(event.dst));
             return;
         }
@@ -341,32 +441,294 @@ void default_event_handler::filter_event(fs_event *fs_event) {
         } else {
             event.dst.clear();
         }
-        recursive_update_index_delay(std::move(event.src), std::move(event.dst));
+        recursive_update_index_delay(event.src, event.dst, event.time);
+        rescan_moved_subtrees(event.src, event.dst);
+    } else if (event.act == ACT_SUBTREE_CHANGED) {
+        // The kernel module collapsed a burst of creates under the folder into this event
+        convert_event_path_to_origin_path(event.src, *src_indexing_item);
+        {
+            std::lock_guard<std::mutex> lock(subtree_mtx_);
+            subtree_scans_.push_back(event.src);
+            if (subtree_scans_.size() > max_subtree_scans)
+                subtree_scans_.pop_front();
+        }
+        rescan_index_delay(std::move(event.src), event.time);
+    } else if (event.act == ACT_MODIFY_FILE) {
+        // Only the size and the modify time change, the kernel module coalesces the writes of a file
+        convert_event_path_to_origin_path(event.src, *src_indexing_item);
+        modify_index_delay(std::move(event.src), event.attrs, event.time);
+    }
+}
+
+void default_event_handler::rescan_moved_subtrees(const std::string& src, const std::string& dst) {
+    // The rescan reads the folder when the job runs, the folder may be moved by then,
+    // so the files created in it are looked for at the new place too, after the move
+    std::lock_guard<std::mutex> lock(subtree_mtx_);
+    for (auto it = subtree_scans_.begin(); it != subtree_scans_.end();) {
+        if (*it == src || string_helper::starts_with(*it, src + "/")) {
+            if (!dst.empty()) {
+                spdlog::debug("Rescan {} moved from {}", dst + it->substr(src.size()), *it);
+                rescan_index_delay(dst + it->substr(src.size()));
+            }
+            it = subtree_scans_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Convert the full path to the path in its device, which is the path carried by the events
+static bool get_device_path(MountInfo *mount_info, const std::string& path, dev_t& device_id, std::string& device_path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+
+    const char *mount_point = mount_info_get_device_mount_point(mount_info, st.st_dev);
+    if (!mount_point)
+        return false;
+
+    std::string root = mount_point;
+    if (root == "/")
+        root.clear();
+    if (!string_helper::starts_with(path, root))
+        return false;
+
+    device_id = st.st_dev;
+    device_path = path.substr(root.length());
+    return !device_path.empty();
+}
+
+// One command per line, see vfs_path_filters_store() of the kernel module
+static bool write_path_filter(const std::string& commands) {
+    FILE *fp = fopen(VFS_PATH_FILTERS_FILE, "w");
+    if (!fp)
+        return false;
+
+    bool ok = fputs(commands.c_str(), fp) >= 0;
+    ok = fclose(fp) == 0 && ok;
+    return ok;
+}
+
+void default_event_handler::install_kernel_path_filters() {
+    // All the filters are replaced by one write, the kernel module swaps them in at once
+    std::string commands = "e\n";
+    dev_t device_id;
+    std::string device_path;
+    auto append_command = [&commands, &device_id, &device_path](char act) {
+        commands += act + std::to_string(major(device_id)) + ":" + std::to_string(minor(device_id)) + " " + device_path + "\n";
+    };
+
+    for (const auto& item : indexing_items_) {
+        if (get_device_path(mount_info_, item.event_path, device_id, device_path))
+            append_command('i');
+    }
+
+    for (const auto& path : event_path_blocked_list_) {
+        // Only absolute paths are prefixes, the others are path components
+        if (string_helper::starts_with(path, "/") && get_device_path(mount_info_, path, device_id, device_path))
+            append_command('x');
+    }
+
+    // A write is at most a page, the filters are an optimization, do without them
+    constexpr std::size_t max_write_size = 4096;
+    if (commands.size() >= max_write_size) {
+        spdlog::warn("Kernel path filters are not installed: {} bytes do not fit in a write", commands.size());
+        commands = "e";
+    }
+
+    // The attribute is writable by root only, and the filters may be too many,
+    // the old filters are cleared then
+    if (!write_path_filter(commands)) {
+        spdlog::info("Kernel path filters are not installed: {}", strerror(errno));
+        write_path_filter("e");
+    }
+}
+
+void default_event_handler::clear_kernel_path_filters() {
+    write_path_filter("e");
+}
+
+void default_event_handler::rescan_device(uint16_t major, uint32_t minor) {
+    bool all_devices = major == 0 && minor == 0;
+    std::string root;
+    if (!all_devices) {
+        const char *mount_point = mount_info_get_device_mount_point(mount_info_, makedev(major, minor));
+        if (!mount_point) {
+            spdlog::debug("Unknown device of the lost events: {}:{}", major, +minor);
+            return;
+        }
+        root = mount_point;
+        if (!string_helper::ends_with(root, "/"))
+            root += "/";
+    }
+
+    for (const auto& item : indexing_items_) {
+        // The init scan of the path is not done yet, it will find the changes
+        if (!item.enable)
+            continue;
+
+        std::string path;
+        if (all_devices || string_helper::starts_with(item.event_path, root))
+            path = item.event_path;
+        else if (string_helper::starts_with(root, item.event_path))
+            path = root;
+        else
+            continue;
+
+        convert_event_path_to_origin_path(path, item);
+        if (path != "/")
+            path.pop_back();
+        spdlog::info("Rescan {} for the lost events", path);
+        rescan_index_delay(std::move(path));
     }
 }
 
 void default_event_handler::terminate_filter() {
-    fs_event* event = g_slice_new(fs_event);
-    event->act = ACT_TERMINATE;
-    g_async_queue_push(event_queue_, event);
+    // The filter thread is joined before the sentinel goes out of scope
+    fs_event terminate{};
+    terminate.act = ACT_TERMINATE;
+    while (!event_queue_.push(&terminate))
+        std::this_thread::yield();
     g_thread_join(event_filter_thread_);
     spdlog::info("Event filter thread terminated");
-    g_async_queue_unref(event_queue_);
 }
 
 void* default_event_handler::event_filter_thread_func(void* data) {
     auto handler = static_cast<default_event_handler*>(data);
+    fs_event* events[filter_batch];
     while (true) {
-        fs_event* event = (fs_event*)g_async_queue_pop(handler->event_queue_);
-        if (event->act == ACT_TERMINATE) {
-            g_slice_free(fs_event, event);
-            break;
+        std::size_t number = handler->event_queue_.pop(events, filter_batch);
+        handler->latency_.record_queue(number + handler->event_queue_.size());
+
+        for (std::size_t i = 0; i < number; ++i) {
+            // Nothing is queued after the sentinel
+            if (events[i]->act == ACT_TERMINATE) {
+                handler->stop_shards(events[i]);
+                return NULL;
+            }
+            if (events[i]->act == ACT_DROPPED_MARKER) {
+                handler->rescan_dropped_devices();
+                continue;
+            }
+            handler->dispatch_event(events[i]);
         }
-        handler->filter_event(event);
-        g_slice_free(fs_event, event);
+        // The queue is empty, the marker may not come as long as no event does, but the
+        // events queued before the drops are all taken. The drops are checked first
+        if (handler->dropped_.load(std::memory_order_acquire) && handler->event_queue_.size() == 0)
+            handler->rescan_dropped_devices();
+    }
+}
+
+std::size_t default_event_handler::shard_of(const fs_event* event) const {
+    // The path on the device up to the top folder, a file stays in the shard of the
+    // folders above it unless the top folder itself is renamed
+    std::string_view path(event->src);
+    std::string_view top = path.substr(0, path.find('/', 1));
+    std::size_t hash = std::hash<std::string_view>{}(top);
+    hash ^= ((static_cast<std::size_t>(event->major) << 20) | event->minor) * 0x9e3779b97f4a7c15ULL;
+    return hash % filter_shards_.size();
+}
+
+void default_event_handler::dispatch_event(fs_event* event) {
+    if (filter_shards_.empty()) {
+        filter_event(event);
+        fs_event_arena::release(event);
+        return;
     }
 
-    return NULL;
+    switch (event->act) {
+    case ACT_RENAME_FROM_FILE:
+    case ACT_RENAME_FROM_FOLDER:
+        {
+            std::size_t shard = shard_of(event);
+            rename_shards_[event->cookie] = shard;
+            rename_cookies_.push_back(event->cookie);
+            if (rename_cookies_.size() > max_rename_shards) {
+                rename_shards_.erase(rename_cookies_.front());
+                rename_cookies_.pop_front();
+            }
+            push_to_shard(*filter_shards_[shard], event);
+        }
+        return;
+    case ACT_RENAME_TO_FILE:
+    case ACT_RENAME_TO_FOLDER:
+        {
+            std::size_t shard = shard_of(event);
+            auto search = rename_shards_.find(event->cookie);
+            if (search == rename_shards_.end() || search->second == shard) {
+                if (search != rename_shards_.end())
+                    rename_shards_.erase(search);
+                push_to_shard(*filter_shards_[shard], event);
+                return;
+            }
+
+            // The rename moves the path to another shard, it comes after the events
+            // of both paths, and before the later ones
+            drain_shard(*filter_shards_[search->second]);
+            drain_shard(*filter_shards_[shard]);
+            rename_shards_.erase(search);
+        }
+        break;
+    case ACT_MOUNT:
+    case ACT_UNMOUNT:
+    case ACT_EVENTS_LOST:
+        // The mount points change or the devices are rescanned
+        drain_shards();
+        break;
+    default:
+        push_to_shard(*filter_shards_[shard_of(event)], event);
+        return;
+    }
+
+    filter_event(event);
+    fs_event_arena::release(event);
+}
+
+void default_event_handler::push_to_shard(filter_shard& shard, fs_event* event) {
+    while (!shard.events.push(event)) {
+        // The shard is busy, it moves done on once it filtered a batch
+        uint32_t done = shard.done.load(std::memory_order_acquire);
+        if (shard.events.push(event))
+            break;
+        shard.done.wait(done, std::memory_order_acquire);
+    }
+    ++shard.sent;
+}
+
+void default_event_handler::drain_shard(filter_shard& shard) {
+    uint32_t done;
+    while ((done = shard.done.load(std::memory_order_acquire)) != shard.sent)
+        shard.done.wait(done, std::memory_order_acquire);
+}
+
+void default_event_handler::drain_shards() {
+    for (auto& shard : filter_shards_)
+        drain_shard(*shard);
+}
+
+// The sentinel is shared by the shards, it is on the stack of terminate_filter(), which
+// joins the filter thread after this joins every shard thread
+void default_event_handler::stop_shards(fs_event* terminate) {
+    for (auto& shard : filter_shards_) {
+        push_to_shard(*shard, terminate);
+        shard->thread.join();
+    }
+    filter_shards_.clear();
+}
+
+void default_event_handler::shard_thread_func(default_event_handler* handler, filter_shard* shard) {
+    fs_event* events[filter_batch];
+    while (true) {
+        std::size_t number = shard->events.pop(events, filter_batch);
+        for (std::size_t i = 0; i < number; ++i) {
+            if (events[i]->act == ACT_TERMINATE)
+                return;
+            handler->filter_event(events[i]);
+            fs_event_arena::release(events[i]);
+        }
+        shard->done.fetch_add(static_cast<uint32_t>(number), std::memory_order_release);
+        shard->done.notify_all();
+    }
 }
 
 ANYTHING_NAMESPACE_END
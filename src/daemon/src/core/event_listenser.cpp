@@ -7,8 +7,15 @@
 
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+#include <fcntl.h>
 #include <unistd.h> // close()
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
 #include <memory> // unique_ptr
 #include <unordered_map>
 #include <sstream>
@@ -31,7 +38,13 @@
 ANYTHING_NAMESPACE_BEGIN
 
 constexpr int epoll_size = 10;
+// The datagrams read by one receive, and the room of each, a batch msg of the kernel
+// module is at most NLMSG_GOODSIZE
+constexpr std::size_t recv_batch = 64;
+constexpr std::size_t recv_slot_size = 16 * 1024;
 static nla_policy vfs_policy[VFSMONITOR_A_MAX + 1];
+// The events a msg sent again may go back by, more than the overflow queue of the kernel module holds
+constexpr uint64_t max_seq_replay = 1 << 20;
 
 bool set_max_socket_receive_buffer_size(nl_sock_ptr& sk) {
     // Get max socket receive buffer size
@@ -56,9 +69,23 @@ bool set_max_socket_receive_buffer_size(nl_sock_ptr& sk) {
     return true;
 }
 
+// Make the kernel module see the messages this socket can not take, it sends them again
+bool set_broadcast_error(nl_sock_ptr& sk) {
+    int on = 1;
+    if (setsockopt(nl_socket_get_fd(sk), SOL_NETLINK, NETLINK_BROADCAST_ERROR, &on, sizeof(on)) < 0) {
+        spdlog::error("Failed to set NETLINK_BROADCAST_ERROR: {}", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
 event_listenser::event_listenser()
     : connected_{ connect(mcsk_) },
-      timeout_{ -1 } {
+      timeout_{ -1 },
+      seq_supported_{ false },
+      ring_fd_{ -1 },
+      ring_area_{ nullptr },
+      ring_area_size_{ 0 } {
     auto clean_and_exit = [this] {
         disconnect(mcsk_);
         exit(APP_QUIT_CODE);
@@ -70,28 +97,38 @@ event_listenser::event_listenser()
     }
 
     set_max_socket_receive_buffer_size(mcsk_);
+    set_broadcast_error(mcsk_);
 
     // Disable sequence checks for asynchronous multicast messages
     nl_socket_disable_seq_check(mcsk_);
     nl_socket_disable_auto_ack(mcsk_);
 
-    // Resolve the multicast group
-    int mcgrp = genl_ctrl_resolve_grp(mcsk_, VFSMONITOR_FAMILY_NAME, VFSMONITOR_MCG_DENTRY_NAME);
-    if (mcgrp < 0) {
-		spdlog::error("Error: failed to resolve generic netlink multicast group");
-		clean_and_exit();
-	}
+    if (open_ring()) {
+        spdlog::info("Receive events from the ring buffer of the kernel module");
+    } else {
+        // Resolve the multicast group
+        int mcgrp = genl_ctrl_resolve_grp(mcsk_, VFSMONITOR_FAMILY_NAME, VFSMONITOR_MCG_DENTRY_NAME);
+        if (mcgrp < 0) {
+            spdlog::error("Error: failed to resolve generic netlink multicast group");
+            clean_and_exit();
+        }
 
-    // Joint the multicast group
-    int ret = nl_socket_add_membership(mcsk_, mcgrp);
-    if (ret < 0) {
-        spdlog::error("Error: failed to join multicast group");
-        clean_and_exit();
-    }
+        // Joint the multicast group
+        int ret = nl_socket_add_membership(mcsk_, mcgrp);
+        if (ret < 0) {
+            spdlog::error("Error: failed to join multicast group");
+            clean_and_exit();
+        }
 
-    if (!set_callback(mcsk_, event_listenser::event_handler)) {
-        spdlog::error("Error: failed to set callback");
-        clean_and_exit();
+        recv_buffer_.resize(recv_batch * recv_slot_size);
+        recv_iovecs_.resize(recv_batch);
+        recv_headers_.resize(recv_batch);
+        recv_addrs_.resize(recv_batch);
+        for (std::size_t i = 0; i < recv_batch; ++i) {
+            recv_iovecs_[i] = { recv_buffer_.data() + i * recv_slot_size, recv_slot_size };
+            recv_headers_[i].msg_hdr.msg_iov = &recv_iovecs_[i];
+            recv_headers_[i].msg_hdr.msg_iovlen = 1;
+        }
     }
 
     stop_fd_ = eventfd(0, EFD_NONBLOCK);
@@ -104,12 +141,24 @@ event_listenser::event_listenser()
     vfs_policy[VFSMONITOR_A_ACT].type = NLA_U8;
     vfs_policy[VFSMONITOR_A_COOKIE].type = NLA_U32;
     vfs_policy[VFSMONITOR_A_MAJOR].type = NLA_U16;
-    vfs_policy[VFSMONITOR_A_MINOR].type = NLA_U8;
+    vfs_policy[VFSMONITOR_A_MINOR].type = NLA_U32;
     vfs_policy[VFSMONITOR_A_PATH].type = NLA_NUL_STRING;
     vfs_policy[VFSMONITOR_A_PATH].maxlen = 4096;
+    vfs_policy[VFSMONITOR_A_EVENT].type = NLA_NESTED;
+    vfs_policy[VFSMONITOR_A_SEQ].type = NLA_U64;
+    vfs_policy[VFSMONITOR_A_INO].type = NLA_U64;
+    vfs_policy[VFSMONITOR_A_MODE].type = NLA_U32;
+    vfs_policy[VFSMONITOR_A_SIZE].type = NLA_U64;
+    vfs_policy[VFSMONITOR_A_MTIME].type = NLA_U64;
+    vfs_policy[VFSMONITOR_A_DIR].type = NLA_NESTED;
+    vfs_policy[VFSMONITOR_A_DIR_ID].type = NLA_U16;
+    vfs_policy[VFSMONITOR_A_NAME].type = NLA_NUL_STRING;
+    vfs_policy[VFSMONITOR_A_NAME].maxlen = 256;
+    vfs_policy[VFSMONITOR_A_TIME].type = NLA_U64;
 }
 
 event_listenser::~event_listenser() {
+    close_ring();
     disconnect(mcsk_);
     close(stop_fd_);
 }
@@ -122,7 +171,8 @@ void event_listenser::start_listening() {
         return;
     }
 
-    int mcsk_fd = get_fd(mcsk_);
+    // The events come from either the rings or the genl socket
+    int mcsk_fd = ring_fd_ != -1 ? ring_fd_ : get_fd(mcsk_);
     epoll_event* ep_events = new epoll_event[epoll_size];
     epoll_event event[2];
     event[0].events = EPOLLIN;
@@ -145,12 +195,22 @@ void event_listenser::start_listening() {
 
         for (int i = 0; i < event_cnt; ++i) {
             if (ep_events[i].data.fd == mcsk_fd) {
-                int ret = nl_recvmsgs_default(mcsk_);
-                if (ret < 0) {
-                    spdlog::error("Failed to receive netlink messages: {}", ret);
-                    spdlog::info("Found events lost, restart");
-                    set_app_restart(true);
-                    qApp->quit();
+                if (ring_fd_ != -1) {
+                    if (!read_ring()) {
+                        spdlog::info("Found invalid records, restart");
+                        set_app_restart(true);
+                        qApp->quit();
+                    }
+                    continue;
+                }
+                if (!receive_messages()) {
+                    // The kernel module reports the devices whose events are lost,
+                    // the older ones do not, so nothing but a restart can recover
+                    if (!seq_supported_) {
+                        spdlog::info("Found events lost, restart");
+                        set_app_restart(true);
+                        qApp->quit();
+                    }
                 }
             } else if (ep_events[i].data.fd == stop_fd_) {
                 uint64_t u;
@@ -195,66 +255,401 @@ void event_listenser::disconnect(nl_sock_ptr& sk) const {
     nl_socket_free(sk);
 }
 
-bool event_listenser::set_callback(nl_sock_ptr& sk, nl_recvmsg_msg_cb_t func) {
-    return nl_socket_modify_cb(sk, NL_CB_VALID, NL_CB_CUSTOM, func, this) == 0;
-}
-
 int event_listenser::get_fd(nl_sock_ptr& sk) const {
     return nl_socket_get_fd(sk);
 }
 
 void event_listenser::forward_event_to_handler(fs_event *event) const {
+    if (!event)
+        return;
     if (handler_) {
         std::invoke(handler_, event);
+    } else {
+        fs_event_arena::release(event);
     }
 }
 
-fs_event* make_fs_event(uint8_t act,
-                        uint32_t cookie,
-                        uint16_t major,
-                        uint8_t minor,
-                        const char* src,
-                        const char* dst) {
-    fs_event* event = g_slice_new(fs_event);
+bool event_listenser::check_device_seq(uint16_t major, uint32_t minor, uint64_t seq) {
+    // 0 means the kernel module could not number the event
+    if (seq == 0)
+        return true;
+
+    seq_supported_ = true;
+    uint64_t& last = device_seqs_[makedev(major, minor)];
+    if (last != 0 && seq > last + 1) {
+        spdlog::warn("{} events lost on device {}:{}", seq - last - 1, major, +minor);
+        forward_lost_event(major, minor);
+    }
+    if (seq > last) {
+        last = seq;
+        return true;
+    }
+    // A seq far behind is not a msg sent again, the kernel module restarted the seqs
+    if (last - seq > max_seq_replay) {
+        last = seq;
+        return true;
+    }
+    return false;
+}
+
+void event_listenser::handle_lost_marker(uint16_t major, uint32_t minor, uint64_t seq) {
+    seq_supported_ = true;
+    if (major == 0 && minor == 0) {
+        spdlog::warn("Events lost on all devices");
+        forward_lost_event(major, minor);
+        return;
+    }
+
+    // An event after the lost ones has already revealed the hole
+    uint64_t& last = device_seqs_[makedev(major, minor)];
+    if (seq != 0 && seq <= last)
+        return;
+
+    spdlog::warn("Events lost on device {}:{}", major, +minor);
+    forward_lost_event(major, minor);
+    if (seq > last)
+        last = seq;
+}
+
+fs_event* event_listenser::make_fs_event(uint8_t act,
+                                         uint32_t cookie,
+                                         uint16_t major,
+                                         uint32_t minor,
+                                         std::string_view dir,
+                                         std::string_view name,
+                                         const file_attrs& attrs,
+                                         uint64_t time) {
+    // The path is built right in the event, it is truncated as a path can not be that long
+    std::size_t dir_len = std::min(dir.size(), std::size_t{ MAX_PATH_LEN - 1 });
+    std::size_t name_len = name.empty() ? 0 : std::min(name.size() + 1, MAX_PATH_LEN - 1 - dir_len);
+    fs_event* event = arena_.alloc(dir_len + name_len);
+    if (!event)
+        return nullptr;
+
     event->act = act;
     event->cookie = cookie;
     event->major = major;
     event->minor = minor;
-    strncpy(event->src, src, MAX_PATH_LEN);
-    event->src[MAX_PATH_LEN - 1] = '\0';
-    strncpy(event->dst, dst, MAX_PATH_LEN);
-    event->dst[MAX_PATH_LEN - 1] = '\0';
+    event->attrs = attrs;
+    event->time = time;
+    memcpy(event->src, dir.data(), dir_len);
+    if (name_len) {
+        event->src[dir_len] = '/';
+        memcpy(event->src + dir_len + 1, name.data(), name_len - 1);
+    }
+    event->src[dir_len + name_len] = '\0';
     return event;
 }
 
-int event_listenser::event_handler(nl_msg_ptr msg, void* arg) {
-    nlattr* tb[VFSMONITOR_A_MAX + 1];
-    int err = genlmsg_parse(nlmsg_hdr(msg), 0, tb, VFSMONITOR_A_MAX, vfs_policy);
-    if (err < 0) {
-        spdlog::error("Unable to parse the message: {}", strerror(-err));
-        return NL_SKIP;
-    }
-
-    if (!tb[VFSMONITOR_A_PATH]) {
-        spdlog::error("Attributes missing from the message");
-        return NL_SKIP;
-    }
-
+// The dirs defined in a batch message, the events of the compact path encoding refer to them
+using batch_dirs = std::array<std::string_view, VFSMONITOR_BATCH_DIRS>;
+
+// The attributes of an event, the path is either the whole path or the name in a dir of the message
+struct event_attrs {
+    nla_u8 act;
+    nla_u32 cookie;
+    nla_u16 major;
+    nla_u32 minor;
+    std::string_view dir;
+    std::string_view name;
+    file_attrs attrs;
+    uint64_t time;
+    uint64_t seq;
+};
+
+static bool parse_event_attrs(nlattr** tb, const batch_dirs* dirs, event_attrs& event) {
     nla_parser parser(tb);
     auto act    = parser.get_value<nla_u8>(VFSMONITOR_A_ACT);
     auto cookie = parser.get_value<nla_u32>(VFSMONITOR_A_COOKIE);
     auto major  = parser.get_value<nla_u16>(VFSMONITOR_A_MAJOR);
-    auto minor  = parser.get_value<nla_u8>(VFSMONITOR_A_MINOR);
+    auto minor  = parser.get_value<nla_u32>(VFSMONITOR_A_MINOR);
     auto src    = parser.get_value<nla_string>(VFSMONITOR_A_PATH);
+
+    // The path is the name in a dir of the message, it is joined right in the event
+    event.dir = {};
+    event.name = {};
+    if (src) {
+        event.dir = *src;
+    } else {
+        auto dir_id = parser.get_value<nla_u16>(VFSMONITOR_A_DIR_ID);
+        auto name   = parser.get_value<nla_string>(VFSMONITOR_A_NAME);
+        if (dirs && dir_id && name && *dir_id < dirs->size() && (*dirs)[*dir_id].data()) {
+            event.dir = (*dirs)[*dir_id];
+            event.name = *name;
+            src = *name;
+        }
+    }
+
     if (!act || !cookie || !major || !minor || !src) {
         spdlog::error("Attributes missing from the message");
-        return NL_SKIP;
+        return false;
+    }
+    event.act = *act;
+    event.cookie = *cookie;
+    event.major = *major;
+    event.minor = *minor;
+
+    // The inode attributes are optional, they come all or none
+    event.attrs = {};
+    auto mode = parser.get_value<nla_u32>(VFSMONITOR_A_MODE);
+    if (mode) {
+        event.attrs.mode  = *mode;
+        event.attrs.ino   = parser.get_value<nla_u64>(VFSMONITOR_A_INO).value_or(0);
+        event.attrs.size  = static_cast<int64_t>(parser.get_value<nla_u64>(VFSMONITOR_A_SIZE).value_or(0));
+        event.attrs.mtime = static_cast<int64_t>(parser.get_value<nla_u64>(VFSMONITOR_A_MTIME).value_or(0));
+    }
+    event.time = parser.get_value<nla_u64>(VFSMONITOR_A_TIME).value_or(0);
+    event.seq = parser.get_value<nla_u64>(VFSMONITOR_A_SEQ).value_or(0);
+    return true;
+}
+
+void event_listenser::forward_lost_event(uint16_t major, uint32_t minor) {
+    forward_event_to_handler(make_fs_event(ACT_EVENTS_LOST, 0, major, minor, {}));
+}
+
+bool event_listenser::receive_messages() {
+    int fd = get_fd(mcsk_);
+
+    while (true) {
+        for (std::size_t i = 0; i < recv_batch; ++i) {
+            recv_headers_[i].msg_hdr.msg_name = &recv_addrs_[i];
+            recv_headers_[i].msg_hdr.msg_namelen = sizeof(sockaddr_nl);
+        }
+
+        int count = recvmmsg(fd, recv_headers_.data(), recv_batch, MSG_DONTWAIT, nullptr);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            spdlog::error("Failed to receive netlink messages: {}", strerror(errno));
+            return false;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            const msghdr& hdr = recv_headers_[i].msg_hdr;
+            // Only the kernel sends the events
+            if (recv_addrs_[i].nl_pid != 0)
+                continue;
+            if (hdr.msg_flags & MSG_TRUNC) {
+                spdlog::error("Truncated netlink message, length: {}", recv_headers_[i].msg_len);
+                continue;
+            }
+
+            int remaining = static_cast<int>(recv_headers_[i].msg_len);
+            auto* nlh = static_cast<nlmsghdr*>(hdr.msg_iov->iov_base);
+            for (; nlmsg_ok(nlh, remaining); nlh = nlmsg_next(nlh, &remaining)) {
+                if (nlh->nlmsg_type >= NLMSG_MIN_TYPE)
+                    handle_message(nlh);
+            }
+        }
+
+        // The socket is drained
+        if (static_cast<std::size_t>(count) < recv_batch)
+            return true;
     }
+}
+
+void event_listenser::handle_message(nlmsghdr* nlh) {
+    nlattr* tb[VFSMONITOR_A_MAX + 1];
+    event_attrs attrs;
+
+    if (!genlmsg_valid_hdr(nlh, 0))
+        return;
+    auto* gnlh = static_cast<genlmsghdr*>(nlmsg_data(nlh));
+
+    if (gnlh->cmd == VFSMONITOR_C_NOTIFY_BATCH) {
+        // The events of a batch are nested attributes, in the order they happened,
+        // the dirs they refer to are defined ahead of them
+        batch_dirs dirs{};
+        nlattr* pos;
+        int rem;
+        nla_for_each_attr(pos, genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0), rem) {
+            if (nla_type(pos) != VFSMONITOR_A_EVENT && nla_type(pos) != VFSMONITOR_A_DIR)
+                continue;
+
+            int err = nla_parse_nested(tb, VFSMONITOR_A_MAX, pos, vfs_policy);
+            if (err < 0) {
+                spdlog::error("Unable to parse the batched event: {}", strerror(-err));
+                continue;
+            }
+
+            if (nla_type(pos) == VFSMONITOR_A_DIR) {
+                nla_parser parser(tb);
+                auto dir_id = parser.get_value<nla_u16>(VFSMONITOR_A_DIR_ID);
+                auto dir    = parser.get_value<nla_string>(VFSMONITOR_A_PATH);
+                if (dir_id && dir && *dir_id < dirs.size())
+                    dirs[*dir_id] = *dir;
+                continue;
+            }
+
+            // A msg another listener could not take is sent again, its events are seen already
+            if (parse_event_attrs(tb, &dirs, attrs) && check_device_seq(attrs.major, attrs.minor, attrs.seq)) {
+                forward_event_to_handler(make_fs_event(attrs.act, attrs.cookie, attrs.major, attrs.minor,
+                    attrs.dir, attrs.name, attrs.attrs, attrs.time));
+            }
+        }
+        return;
+    }
+
+    int err = genlmsg_parse(nlh, 0, tb, VFSMONITOR_A_MAX, vfs_policy);
+    if (err < 0) {
+        spdlog::error("Unable to parse the message: {}", strerror(-err));
+        return;
+    }
+
+    if (gnlh->cmd == VFSMONITOR_C_NOTIFY_LOST) {
+        nla_parser parser(tb);
+        auto major = parser.get_value<nla_u16>(VFSMONITOR_A_MAJOR);
+        auto minor = parser.get_value<nla_u32>(VFSMONITOR_A_MINOR);
+        if (!major || !minor) {
+            spdlog::error("Attributes missing from the message");
+            return;
+        }
+        handle_lost_marker(*major, *minor, parser.get_value<nla_u64>(VFSMONITOR_A_SEQ).value_or(0));
+        return;
+    }
+
+    if (parse_event_attrs(tb, nullptr, attrs) && check_device_seq(attrs.major, attrs.minor, attrs.seq)) {
+        forward_event_to_handler(make_fs_event(attrs.act, attrs.cookie, attrs.major, attrs.minor,
+            attrs.dir, attrs.name, attrs.attrs, attrs.time));
+    }
+}
+
+bool event_listenser::open_ring() {
+    ring_fd_ = open("/dev/" VFS_RING_DEVICE_NAME, O_RDWR | O_CLOEXEC);
+    if (ring_fd_ == -1) {
+        spdlog::info("Ring buffer is unavailable: {}", strerror(errno));
+        return false;
+    }
+
+    // Map the info page first to learn the size of the whole area
+    long page_size = sysconf(_SC_PAGESIZE);
+    void* info_page = mmap(nullptr, page_size, PROT_READ, MAP_SHARED, ring_fd_, 0);
+    if (info_page == MAP_FAILED) {
+        spdlog::error("Failed to map the ring info: {}", strerror(errno));
+        close_ring();
+        return false;
+    }
+    vfs_ring_info info = *static_cast<vfs_ring_info*>(info_page);
+    munmap(info_page, page_size);
+
+    if (info.version != VFS_RING_VERSION || info.ring_count == 0 ||
+        info.data_size == 0 || (info.data_size & (info.data_size - 1)) != 0) {
+        spdlog::error("Unsupported ring buffer, version: {}", info.version);
+        close_ring();
+        return false;
+    }
+
+    ring_area_ = mmap(nullptr, info.area_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd_, 0);
+    if (ring_area_ == MAP_FAILED) {
+        spdlog::error("Failed to map the ring buffer: {}", strerror(errno));
+        ring_area_ = nullptr;
+        close_ring();
+        return false;
+    }
+    ring_area_size_ = info.area_size;
+    ring_lost_.assign(info.ring_count, 0);
+    ring_tails_.assign(info.ring_count, 0);
+    ring_heads_.assign(info.ring_count, 0);
+
+    return true;
+}
+
+void event_listenser::close_ring() {
+    if (ring_area_) {
+        munmap(ring_area_, ring_area_size_);
+        ring_area_ = nullptr;
+    }
+    if (ring_fd_ != -1) {
+        close(ring_fd_);
+        ring_fd_ = -1;
+    }
+}
+
+// Read the published records of all rings in seq order, return false if a record is invalid.
+//
+// The rings are read one after another, a record of a device may be published in one ring
+// after that ring is read and before a later record of the device is published in another.
+// The kernel module publishes the events of a device in order, so the heads are taken twice:
+// the records up to the last seq below the first heads have all their earlier records below
+// the second heads. The records after that seq are left for the next read.
+bool event_listenser::read_ring() {
+    auto* area = static_cast<char*>(ring_area_);
+    const auto& info = *reinterpret_cast<const vfs_ring_info*>(area);
+    auto ring_header = [&](uint32_t i) {
+        return reinterpret_cast<vfs_ring_header*>(area + info.ring_offset + std::size_t(i) * info.ring_stride);
+    };
+    bool invalid = false;
+    uint64_t last_seq = 0;
+
+    for (uint32_t i = 0; i < info.ring_count; ++i)
+        ring_heads_[i] = std::atomic_ref<__u64>(ring_header(i)->head).load(std::memory_order_acquire);
+
+    ring_records_.clear();
+    for (uint32_t i = 0; i < info.ring_count; ++i) {
+        auto* header = ring_header(i);
+        const char* data = reinterpret_cast<const char*>(header) + info.data_offset;
+        uint64_t head = std::atomic_ref<__u64>(header->head).load(std::memory_order_acquire);
+        uint64_t tail = header->tail;
+
+        uint64_t ring_lost = std::atomic_ref<__u64>(header->lost).load(std::memory_order_relaxed);
+        // The lost records tell which devices to rescan
+        if (ring_lost != ring_lost_[i]) {
+            spdlog::warn("{} events lost in ring {}", ring_lost - ring_lost_[i], i);
+            ring_lost_[i] = ring_lost;
+        }
+
+        while (tail < head) {
+            uint32_t offset = tail & (info.data_size - 1);
+            uint32_t contiguous = info.data_size - offset;
+            // Too short to hold a record, the kernel wraps without a pad record
+            if (contiguous < sizeof(vfs_ring_record)) {
+                tail += contiguous;
+                continue;
+            }
+            auto* record = reinterpret_cast<const vfs_ring_record*>(data + offset);
+            if (record->len < sizeof(vfs_ring_record) || record->len > contiguous || record->len % VFS_RING_ALIGN) {
+                spdlog::error("Invalid record in ring {}, length: {}", i, record->len);
+                tail = head;
+                invalid = true;
+                break;
+            }
+            if (record->action != VFS_RING_ACT_PAD &&
+                memchr(record->path, '\0', record->len - sizeof(vfs_ring_record))) {
+                ring_records_.push_back({ record, tail, i });
+                if (tail + record->len <= ring_heads_[i] && record->seq > last_seq)
+                    last_seq = record->seq;
+            }
+            tail += record->len;
+        }
+        ring_tails_[i] = tail;
+    }
+
+    // Records of different rings are ordered by their global seq
+    std::sort(ring_records_.begin(), ring_records_.end(),
+        [](const ring_record& a, const ring_record& b) { return a.record->seq < b.record->seq; });
+    for (const auto& [record, position, ring] : ring_records_) {
+        // The seqs of a ring grow, the rest of the ring is read again
+        if (record->seq > last_seq) {
+            ring_tails_[ring] = std::min(ring_tails_[ring], position);
+            continue;
+        }
+        if (record->action == VFS_RING_ACT_LOST) {
+            handle_lost_marker(record->major, record->minor, record->dev_seq);
+            continue;
+        }
+        check_device_seq(record->major, record->minor, record->dev_seq);
+        file_attrs attrs{ record->ino, record->mode, static_cast<int64_t>(record->size), static_cast<int64_t>(record->mtime) };
+        forward_event_to_handler(make_fs_event(record->action, record->cookie, record->major,
+            record->minor, record->path, {}, attrs, record->time));
+    }
+
+    // Give the space back to the kernel after the records are consumed
+    for (uint32_t i = 0; i < info.ring_count; ++i)
+        std::atomic_ref<__u64>(ring_header(i)->tail).store(ring_tails_[i], std::memory_order_release);
 
-    fs_event* event = make_fs_event(*act, *cookie, *major, *minor, *src, "");
-    auto listenser = static_cast<event_listenser*>(arg);
-    listenser->forward_event_to_handler(event);
-    return NL_OK;
+    return !invalid;
 }
 
 ANYTHING_NAMESPACE_END
\ No newline at end of file
@@ -0,0 +1,59 @@
+// SPDX-FileCopyrightText: 2026 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "core/event_ring.h"
+
+#include <bit>
+
+ANYTHING_NAMESPACE_BEGIN
+
+event_ring::event_ring(std::size_t capacity)
+    : mask_(static_cast<uint32_t>(std::bit_ceil(capacity < 2 ? 2 : capacity) - 1)),
+      slots_(new fs_event*[mask_ + 1]) {
+}
+
+bool event_ring::push(fs_event* event) {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) > mask_)
+        return false;
+
+    slots_[tail & mask_] = event;
+    // Paired with the consumer storing waiting_ then loading the tail,
+    // one of the two sees the store of the other
+    tail_.store(tail + 1, std::memory_order_seq_cst);
+    if (waiting_.load(std::memory_order_seq_cst))
+        tail_.notify_one();
+    return true;
+}
+
+std::size_t event_ring::pop(fs_event** events, std::size_t max) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    uint32_t tail = tail_.load(std::memory_order_acquire);
+    while (tail == head) {
+        waiting_.store(true, std::memory_order_seq_cst);
+        tail = tail_.load(std::memory_order_seq_cst);
+        if (tail == head) {
+            tail_.wait(head, std::memory_order_acquire);
+            tail = tail_.load(std::memory_order_acquire);
+        }
+        waiting_.store(false, std::memory_order_relaxed);
+    }
+
+    std::size_t number = tail - head;
+    if (number > max)
+        number = max;
+    for (std::size_t i = 0; i < number; ++i)
+        events[i] = slots_[(head + i) & mask_];
+    // The slots are copied out, the producer may reuse them right away
+    head_.store(head + static_cast<uint32_t>(number), std::memory_order_release);
+    return number;
+}
+
+std::size_t event_ring::size() const {
+    // The head first, the tail read after it is not behind it
+    uint32_t head = head_.load(std::memory_order_acquire);
+    return tail_.load(std::memory_order_acquire) - head;
+}
+
+ANYTHING_NAMESPACE_END
@@ -53,7 +53,8 @@ void print_file_record(const file_record& record) {
 
 file_record make_file_record(const std::filesystem::path& p,
                              pinyin_processor& pinyin_processor,
-                             const std::map<std::string, std::string> &file_type_mapping) {
+                             const std::map<std::string, std::string> &file_type_mapping,
+                             const std::optional<file_attrs>& attrs = std::nullopt) {
     file_record ret = {
         .file_name       = std::move(p.filename().string()),
         .file_name_pinyin = "",
@@ -73,23 +74,29 @@ file_record make_file_record(const std::filesystem::path& p,
     }
     ret.is_hidden = ret.full_path.find("/.") != std::string::npos;
 
-    struct stat statbuf;
-    if (lstat(ret.full_path.c_str(), &statbuf) != 0) {
-        auto err = errno;
-        // The error is usually that the file does not exist, mainly because the index is not updated in time.
-        spdlog::debug("stat fail: {} {}", ret.full_path, strerror(err));
-        return ret;
-    } else {
-        ret.modify_time = statbuf.st_mtim.tv_sec;
-        ret.file_size = statbuf.st_size;
-
-        if (S_ISDIR(statbuf.st_mode)) {
-            ret.file_type = "dir";
-        } else if (S_ISREG(statbuf.st_mode)) {
-            auto it = file_type_mapping.find(ret.file_ext);
-            if (it != file_type_mapping.end()) {
-                ret.file_type = it->second;
-            }
+    // The kernel module sends the attributes with the event, which saves a path walk
+    file_attrs file_attrs_buf;
+    if (!attrs) {
+        struct stat statbuf;
+        if (lstat(ret.full_path.c_str(), &statbuf) != 0) {
+            auto err = errno;
+            // The error is usually that the file does not exist, mainly because the index is not updated in time.
+            spdlog::debug("stat fail: {} {}", ret.full_path, strerror(err));
+            return ret;
+        }
+        file_attrs_buf = { statbuf.st_ino, statbuf.st_mode, statbuf.st_size, statbuf.st_mtim.tv_sec };
+    }
+    const file_attrs& st = attrs ? *attrs : file_attrs_buf;
+
+    ret.modify_time = st.mtime;
+    ret.file_size = st.size;
+
+    if (S_ISDIR(st.mode)) {
+        ret.file_type = "dir";
+    } else if (S_ISREG(st.mode)) {
+        auto it = file_type_mapping.find(ret.file_ext);
+        if (it != file_type_mapping.end()) {
+            ret.file_type = it->second;
         }
     }
 
@@ -220,12 +227,13 @@ file_index_manager::~file_index_manager() {
     }
 }
 
-bool file_index_manager::add_index(const std::string& path) {
+bool file_index_manager::add_index(const std::string& path, const std::optional<file_attrs>& attrs) {
     bool ret = false;
 
     try {
-        auto doc = create_document(make_file_record(path, pinyin_processor_, file_type_mapping_));
+        auto doc = create_document(make_file_record(path, pinyin_processor_, file_type_mapping_, attrs));
         writer_->updateDocument(newLucene<Term>(FULL_PATH_FIELD, StringUtils::toUnicode(path)), doc);
+        note_written_path(path, true);
         spdlog::debug("Indexed {}", path);
         ret = true;
     } catch (const LuceneException& e) {
@@ -243,6 +251,7 @@ bool file_index_manager::remove_index(const std::string& path) {
     try {
         TermPtr pterm = newLucene<Term>(FULL_PATH_FIELD, StringUtils::toUnicode(path));
         writer_->deleteDocuments(pterm);
+        note_written_path(path, false);
         spdlog::debug("Removed index: {}", path);
         ret = true;
     } catch (const LuceneException& e) {
@@ -254,12 +263,15 @@ bool file_index_manager::remove_index(const std::string& path) {
     return ret;
 }
 
-bool file_index_manager::update_index(const std::string& old_path, const std::string& new_path) {
+bool file_index_manager::update_index(const std::string& old_path, const std::string& new_path,
+                                      const std::optional<file_attrs>& attrs) {
     bool ret = false;
 
     try {
-        auto doc = create_document(make_file_record(new_path, pinyin_processor_, file_type_mapping_));
+        auto doc = create_document(make_file_record(new_path, pinyin_processor_, file_type_mapping_, attrs));
         writer_->updateDocument(newLucene<Term>(FULL_PATH_FIELD, StringUtils::toUnicode(old_path)), doc);
+        note_written_path(old_path, false);
+        note_written_path(new_path, true);
         spdlog::debug("Renamed: {} --> {}", old_path, new_path);
         ret = true;
     } catch (const LuceneException& e) {
@@ -271,6 +283,52 @@ bool file_index_manager::update_index(const std::string& old_path, const std::st
     return ret;
 }
 
+bool file_index_manager::modify_index(const std::string& path, const std::optional<file_attrs>& attrs) {
+    // The event may come after the file is removed or renamed, it must not add the path back
+    bool exists = false;
+    try {
+        exists = written_document_exists(path);
+    } catch (const LuceneException& e) {
+        spdlog::error("Failed to look up {}: {}", path, StringUtils::toUTF8(e.getError()));
+        return false;
+    }
+    if (!exists)
+        return true;
+
+    return add_index(path, attrs);
+}
+
+void file_index_manager::note_written_path(const std::string& path, bool indexed) {
+    // A scan writes far more paths than are worth keeping, the reader is reopened for the next lookup then
+    constexpr std::size_t max_written_paths = 65536;
+    std::lock_guard<std::mutex> lock(written_mtx_);
+    if (written_paths_overflow_)
+        return;
+    if (written_paths_.size() >= max_written_paths) {
+        written_paths_.clear();
+        written_paths_overflow_ = true;
+        return;
+    }
+    written_paths_[path] = indexed;
+}
+
+bool file_index_manager::written_document_exists(const std::string& path) {
+    bool overflow;
+    {
+        std::lock_guard<std::mutex> lock(written_mtx_);
+        auto it = written_paths_.find(path);
+        if (it != written_paths_.end())
+            return it->second;
+        overflow = written_paths_overflow_;
+    }
+    if (overflow)
+        try_refresh_reader(true);
+
+    // Not written since the reader was opened, the reader has it if it is indexed
+    std::lock_guard<std::mutex> lock(reader_mtx_);
+    return nrt_reader_->termDocs(newLucene<Term>(FULL_PATH_FIELD, StringUtils::toUnicode(path)))->next();
+}
+
 bool check_index_corrupted(const std::string& index_directory) {
     try {
         FSDirectoryPtr dir = FSDirectory::open(StringUtils::toUnicode(index_directory));
@@ -468,6 +526,12 @@ void file_index_manager::try_refresh_reader(bool nrt) {
     std::lock_guard<std::mutex> lock(reader_mtx_);
     if (nrt) {
         if (!nrt_reader_->isCurrent()) {
+            // The new reader has every path written before it is opened, see written_document_exists()
+            {
+                std::lock_guard<std::mutex> written_lock(written_mtx_);
+                written_paths_.clear();
+                written_paths_overflow_ = false;
+            }
             IndexReaderPtr new_reader = writer_->getReader();
             if (new_reader != nrt_reader_) {
                 nrt_reader_->close();
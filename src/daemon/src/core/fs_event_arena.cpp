@@ -0,0 +1,111 @@
+// SPDX-FileCopyrightText: 2026 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "core/fs_event_arena.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+ANYTHING_NAMESPACE_BEGIN
+
+struct fs_event_arena::chunk {
+    // The events not released yet, plus one while the arena allocates from the chunk
+    std::atomic<uint32_t> refs;
+};
+
+namespace {
+
+// The events start after the chunk header, aligned as the events
+constexpr std::size_t chunk_header = (sizeof(std::atomic<uint32_t>) + alignof(fs_event) - 1) / alignof(fs_event) * alignof(fs_event);
+
+// The chunks kept for reuse, the others are freed, a burst does not pin its memory
+constexpr std::size_t max_pooled_chunks = 16;
+
+struct chunk_pool {
+    std::mutex mutex;
+    std::vector<void*> chunks;
+
+    ~chunk_pool() {
+        for (void* chunk : chunks)
+            std::free(chunk);
+    }
+};
+
+chunk_pool& get_chunk_pool() {
+    static chunk_pool pool;
+    return pool;
+}
+
+void* take_chunk_memory() {
+    auto& pool = get_chunk_pool();
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if (!pool.chunks.empty()) {
+            void* memory = pool.chunks.back();
+            pool.chunks.pop_back();
+            return memory;
+        }
+    }
+
+    void* memory = std::aligned_alloc(fs_event_arena::chunk_size, fs_event_arena::chunk_size);
+    if (!memory)
+        throw std::bad_alloc();
+    return memory;
+}
+
+void give_chunk_memory(void* memory) {
+    auto& pool = get_chunk_pool();
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if (pool.chunks.size() < max_pooled_chunks) {
+            pool.chunks.push_back(memory);
+            return;
+        }
+    }
+    std::free(memory);
+}
+
+} // namespace
+
+void fs_event_arena::unref(chunk* chunk) {
+    if (chunk->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        chunk->~chunk();
+        give_chunk_memory(chunk);
+    }
+}
+
+fs_event_arena::~fs_event_arena() {
+    if (current_)
+        unref(current_);
+}
+
+fs_event* fs_event_arena::alloc(std::size_t path_len) {
+    std::size_t size = offsetof(fs_event, src) + path_len + 1;
+    size = (size + alignof(fs_event) - 1) / alignof(fs_event) * alignof(fs_event);
+    if (size > chunk_size - chunk_header)
+        return nullptr;
+
+    if (!current_ || used_ + size > chunk_size) {
+        if (current_)
+            unref(current_);
+        current_ = new (take_chunk_memory()) chunk{ 1 };
+        used_ = chunk_header;
+    }
+
+    auto* event = new (reinterpret_cast<char*>(current_) + used_) fs_event;
+    used_ += size;
+    current_->refs.fetch_add(1, std::memory_order_relaxed);
+    return event;
+}
+
+void fs_event_arena::release(fs_event* event) {
+    auto address = reinterpret_cast<std::uintptr_t>(event);
+    unref(reinterpret_cast<chunk*>(address & ~(std::uintptr_t{ chunk_size } - 1)));
+}
+
+ANYTHING_NAMESPACE_END
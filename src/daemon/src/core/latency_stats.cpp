@@ -0,0 +1,71 @@
+// SPDX-FileCopyrightText: 2026 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "core/latency_stats.h"
+
+#include <bit>
+#include <ctime>
+#include <fstream>
+
+#include "utils/log.h"
+
+ANYTHING_NAMESPACE_BEGIN
+
+static const char* const stage_names[] = {"receive", "filter", "enqueue", "update", "commit"};
+static_assert(std::size(stage_names) == static_cast<std::size_t>(latency_stage::count));
+
+static std::size_t bucket_of(uint64_t value) {
+    std::size_t bucket = value ? std::bit_width(value) - 1 : 0;
+    return bucket < latency_stats::buckets ? bucket : latency_stats::buckets - 1;
+}
+
+uint64_t latency_stats::now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void latency_stats::record(latency_stage stage, uint64_t time, uint64_t now) {
+    if (time == 0)
+        return;
+
+    uint64_t us = now > time ? (now - time) / 1000 : 0;
+    histograms_[static_cast<std::size_t>(stage)][bucket_of(us)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void latency_stats::record_queue(std::size_t occupancy) {
+    queue_[bucket_of(occupancy)].fetch_add(1, std::memory_order_relaxed);
+}
+
+bool latency_stats::save(const std::string& path) const {
+    std::string json = "{\n    \"unit\": \"us\",\n    \"buckets\": \"bucket i counts [2^i, 2^(i+1)) us\"";
+    for (std::size_t stage = 0; stage < histograms_.size(); ++stage) {
+        json.append(",\n    \"").append(stage_names[stage]).append("\": [");
+        for (std::size_t i = 0; i < buckets; ++i) {
+            if (i)
+                json.append(", ");
+            json.append(std::to_string(histograms_[stage][i].load(std::memory_order_relaxed)));
+        }
+        json.append("]");
+    }
+    // The events queued for the filter thread, bucket i counts [2^i, 2^(i+1)) events
+    json.append(",\n    \"queue\": [");
+    for (std::size_t i = 0; i < buckets; ++i) {
+        if (i)
+            json.append(", ");
+        json.append(std::to_string(queue_[i].load(std::memory_order_relaxed)));
+    }
+    json.append("],\n    \"dropped\": ").append(std::to_string(dropped_.load(std::memory_order_relaxed)));
+    json.append("\n}\n");
+
+    std::ofstream file(path);
+    file << json;
+    if (!file) {
+        spdlog::error("Failed to save the latency stats to {}", path);
+        return false;
+    }
+    return true;
+}
+
+ANYTHING_NAMESPACE_END
@@ -193,44 +193,63 @@ bool mount_manager::read_vfs_unnamed_device(std::unordered_set<std::string> &dev
     }
 
     std::string line;
-    if (std::getline(file, line)) {
-        // Only includes a whitespace in this line
-        if (line.find_first_not_of(' ') == std::string::npos)
-            return false;
-
-        std::cout << "line(read_vfs_unnamed_device): " << line << "\n";
-        auto minors = string_helper::split(line, ",");
-        for (auto&& minor : minors)
-            devices.insert(std::move(minor));
+    if (!std::getline(file, line)) {
+        // The read fails if the devices are too many to fit in a page
+        std::cerr << "Failed to read file: /sys/kernel/vfs_monitor/vfs_unnamed_devices\n";
+        return false;
     }
 
+    // Only includes a whitespace in this line
+    if (line.find_first_not_of(' ') == std::string::npos)
+        return false;
+
+    std::cout << "line(read_vfs_unnamed_device): " << line << "\n";
+    auto minors = string_helper::split(line, ",");
+    for (auto&& minor : minors)
+        devices.insert(std::move(minor));
+
     std::cout << "devices: " << devices.size() << " 1: " << *devices.begin() << "\n";
     return true;
 }
 
 bool mount_manager::update_vfs_unnamed_device(const std::unordered_set<std::string>& new_devices) {
+    // All the changes are made by one write, the kernel applies them at once
+    std::string cmds;
     std::unordered_set<std::string> old_devices;
-    if (!read_vfs_unnamed_device(old_devices))
-        return false;
+    if (!read_vfs_unnamed_device(old_devices)) {
+        // The old devices are not known, they are all cleared and set again
+        old_devices.clear();
+        cmds = "e";
+    }
+    auto append_cmd = [this, &cmds](char act, const std::string& minor) {
+        // A write is at most a page
+        if (cmds.size() + minor.size() + 2 >= 4096) {
+            if (!write_vfs_unnamed_device(cmds))
+                return false;
+            cmds.clear();
+        }
+        if (!cmds.empty())
+            cmds += ',';
+        cmds += act;
+        cmds += minor;
+        return true;
+    };
 
     // Remove the old devices
-    std::vector<std::string> removed_devices;
-    std::copy_if(old_devices.begin(), old_devices.end(), std::back_inserter(removed_devices),
-        [&new_devices](const std::string& device) { return new_devices.count(device) == 0; });
-    for (const auto& minor : removed_devices) {
-        if (!write_vfs_unnamed_device("r" + minor))
+    for (const auto& minor : old_devices) {
+        if (new_devices.count(minor) == 0 && !append_cmd('r', minor))
             return false;
     }
 
     // Add the new devices
-    std::vector<std::string> added_devices;
-    std::copy_if(new_devices.begin(), new_devices.end(), std::back_inserter(added_devices),
-        [&old_devices](const std::string& device) { return old_devices.count(device) == 0; });
-    for (const auto& minor : added_devices) {
-        if (!write_vfs_unnamed_device("a" + minor))
+    for (const auto& minor : new_devices) {
+        if (old_devices.count(minor) == 0 && !append_cmd('a', minor))
             return false;
     }
 
+    if (!cmds.empty())
+        return write_vfs_unnamed_device(cmds);
+
     return true;
 }
 
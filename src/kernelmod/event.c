@@ -4,67 +4,166 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
 #include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/string.h>
+#include <linux/fs.h>
+#include <linux/version.h>
+#include <linux/ktime.h>
 #include "event.h"
+#include "vfs_stats.h"
 
 
-struct kmem_cache *vfs_event_cachep __read_mostly;
+static const unsigned int vfs_event_class_size[VFS_EVENT_CLASSES] = {256, 1024, PATH_MAX};
+static const char *vfs_event_class_name[VFS_EVENT_CLASSES] = {"vfs_event_256", "vfs_event_1024", "vfs_event_4096"};
+
+static struct kmem_cache *vfs_event_cachep[VFS_EVENT_CLASSES] __read_mostly;
+
+struct vfs_path_scratch {
+    char buf[VFS_EVENT_PATH_LEN];
+};
+
+static struct vfs_path_scratch __percpu *vfs_path_scratch;
 
 int init_vfs_event_cache(void)
 {
-    vfs_event_cachep = KMEM_CACHE(vfs_event, 0);
-    if (unlikely(!vfs_event_cachep))
-        return -ENOMEM;
+    int i;
+
+    for (i = 0; i < VFS_EVENT_CLASSES; ++i) {
+        vfs_event_cachep[i] = kmem_cache_create(vfs_event_class_name[i], vfs_event_class_size[i], 0, 0, NULL);
+        if (unlikely(!vfs_event_cachep[i]))
+            goto fail;
+    }
+
+    vfs_path_scratch = alloc_percpu(struct vfs_path_scratch);
+    if (unlikely(!vfs_path_scratch))
+        goto fail;
 
     return 0;
+
+fail:
+    while (i--)
+        kmem_cache_destroy(vfs_event_cachep[i]);
+    return -ENOMEM;
 }
 
 void cleanup_vfs_event_cache(void)
 {
-    kmem_cache_destroy(vfs_event_cachep);
+    int i;
+
+    free_percpu(vfs_path_scratch);
+    for (i = 0; i < VFS_EVENT_CLASSES; ++i)
+        kmem_cache_destroy(vfs_event_cachep[i]);
 }
 
-struct vfs_event *vfs_event_alloc(void)
+char *vfs_path_scratch_get(void)
 {
-    struct vfs_event *event;
+    return get_cpu_ptr(vfs_path_scratch)->buf;
+}
 
-    event = kmem_cache_alloc(vfs_event_cachep, GFP_KERNEL);
-    if (event != NULL)
-        event->proc_info = NULL;
+void vfs_path_scratch_put(void)
+{
+    put_cpu_ptr(vfs_path_scratch);
+}
 
-    return event;
+/* return the smallest class which can hold size bytes, or -1 */
+static int size_class(size_t size)
+{
+    int i;
+
+    for (i = 0; i < VFS_EVENT_CLASSES; ++i) {
+        if (size <= vfs_event_class_size[i])
+            return i;
+    }
+
+    return -1;
 }
 
-struct vfs_event *vfs_event_alloc_atomic(void)
+static struct vfs_event *do_vfs_event_alloc(const char *path, gfp_t flags)
 {
     struct vfs_event *event;
+    size_t len = strlen(path);
+    int class = size_class(sizeof(struct vfs_event) + len + 1);
+
+    if (unlikely(class < 0))
+        return NULL;
 
-    event = kmem_cache_alloc(vfs_event_cachep, GFP_ATOMIC);
-    if (event != NULL)
-        event->proc_info = NULL;
+    event = kmem_cache_alloc(vfs_event_cachep[class], flags);
+    if (unlikely(!event)) {
+        vfs_stat_inc(alloc_failures);
+        return NULL;
+    }
+
+    event->size_class = class;
+    event->proc_info = NULL;
+    event->mode = 0;
+    event->time = ktime_get_ns();
+    memcpy(event->buf, path, len + 1);
+    event->path = event->buf;
 
     return event;
 }
 
-void vfs_event_free(struct vfs_event *event)
+struct vfs_event *vfs_event_alloc(const char *path)
 {
-    if (event->proc_info != NULL)
-        kmem_cache_free(vfs_event_cachep, event->proc_info);
+    return do_vfs_event_alloc(path, GFP_KERNEL);
+}
 
-    kmem_cache_free(vfs_event_cachep, event);
+struct vfs_event *vfs_event_alloc_atomic(const char *path)
+{
+    return do_vfs_event_alloc(path, GFP_ATOMIC);
 }
 
-#define CONCAT_(A,B) A##B
-#define CONCAT(A,B) CONCAT_(A,B)
-#define STATIC_ASSERT(p, msg) typedef char CONCAT(dummy__,__LINE__) [(p) ? 1 : -1]
+void vfs_event_free(struct vfs_event *event)
+{
+    if (event->proc_info != NULL)
+        kmem_cache_free(vfs_event_cachep[event->proc_info->size_class], event->proc_info);
 
-STATIC_ASSERT(sizeof(struct proc_info) == sizeof(struct vfs_event), "struct size not match");
+    kmem_cache_free(vfs_event_cachep[event->size_class], event);
+}
 
-int vfs_event_alloc_proc_info_atomic(struct vfs_event *event)
+int vfs_event_alloc_proc_info_atomic(struct vfs_event *event, const char *path)
 {
+    struct proc_info *info;
+    size_t len;
+    int class;
+
     if (event == NULL || event->proc_info != NULL)
         return -EINVAL;
 
-    event->proc_info = kmem_cache_alloc(vfs_event_cachep, GFP_ATOMIC);
+    len = strlen(path);
+    class = size_class(sizeof(struct proc_info) + len + 1);
+    if (unlikely(class < 0))
+        return -ENAMETOOLONG;
+
+    info = kmem_cache_alloc(vfs_event_cachep[class], GFP_ATOMIC);
+    if (!info) {
+        vfs_stat_inc(alloc_failures);
+        return -ENOMEM;
+    }
+
+    info->size_class = class;
+    /* set tgid to 0 to indicate that the proc_info is invalid */
+    info->tgid = 0;
+    memcpy(info->buf, path, len + 1);
+    info->path = info->buf;
+    event->proc_info = info;
 
-    return event->proc_info ? 0 : -ENOMEM;
+    return 0;
+}
+
+void vfs_event_set_attrs(struct vfs_event *event, struct inode *inode)
+{
+    if (!inode) {
+        event->mode = 0;
+        return;
+    }
+
+    event->mode = inode->i_mode;
+    event->ino = inode->i_ino;
+    event->size = i_size_read(inode);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+    event->mtime = inode_get_mtime_sec(inode);
+#else
+    event->mtime = inode->i_mtime.tv_sec;
+#endif
 }
@@ -9,46 +9,84 @@
 #include <uapi/linux/limits.h>
 
 
-#define PROCESS_INFO_PART u32 uid; \
-	s32 tgid; \
-	char *path;
-
-struct __process_info_part {
-	PROCESS_INFO_PART
+/*
+ * size classes
+ *
+ * vfs_event and proc_info are allocated from the smallest class that can hold
+ * the path, most paths are short, so most events take a fraction of PATH_MAX.
+ * the path is resolved into a per-cpu scratch buffer first, then copied into
+ * the event of the fitting class.
+ */
+enum vfs_event_size_class {
+	VFS_EVENT_SMALL,	/* 256 bytes */
+	VFS_EVENT_MEDIUM,	/* 1024 bytes */
+	VFS_EVENT_LARGE,	/* PATH_MAX */
+	VFS_EVENT_CLASSES,
 };
 
-#define PROCESS_INFO_PATH_LEN (PATH_MAX - sizeof(struct __process_info_part))
+#define PROCESS_INFO_PART u32 uid; \
+	s32 tgid; \
+	char *path; \
+	unsigned char size_class;
 
 struct proc_info {
 	PROCESS_INFO_PART
-	char buf[PROCESS_INFO_PATH_LEN];
+	char buf[];
 };
 
+#define PROCESS_INFO_PATH_LEN (PATH_MAX - sizeof(struct proc_info))
+
+/*
+ * the attributes of the inode when the event happened, the consumers can index
+ * the file without a stat, mode is 0 if the source could not get the inode
+ *
+ * time is the ktime_get_ns() when the event was captured, the consumers compare
+ * it with CLOCK_MONOTONIC to measure the latency, stamp is for the merge buffer.
+ * a merge rule may rewrite action, seen_action keeps the one the buffer got
+ */
 #define VFS_EVENT_PART struct list_head list; \
     unsigned char action; \
+    unsigned char seen_action; \
+    unsigned char size_class; \
     u32 cookie; \
     dev_t dev; \
+    u64 seq; \
+    u64 stamp; \
     char *path; \
     void *pair; \
-    struct proc_info *proc_info;
-
-struct __vfs_event_part {
-	VFS_EVENT_PART
-};
-
-#define VFS_EVENT_PATH_LEN (PATH_MAX - sizeof(struct __vfs_event_part))
+    struct proc_info *proc_info; \
+    struct hlist_node path_node; \
+    struct hlist_node cookie_node; \
+    u32 path_hash; \
+    umode_t mode; \
+    u64 ino; \
+    s64 size; \
+    s64 mtime; \
+    u64 time;
 
 struct vfs_event {
 	VFS_EVENT_PART
-    char buf[VFS_EVENT_PATH_LEN];
+    char buf[];
 };
 
+#define VFS_EVENT_PATH_LEN (PATH_MAX - sizeof(struct vfs_event))
+
 int init_vfs_event_cache(void);
 void cleanup_vfs_event_cache(void);
-struct vfs_event *vfs_event_alloc(void);
-struct vfs_event *vfs_event_alloc_atomic(void);
+struct vfs_event *vfs_event_alloc(const char *path);
+struct vfs_event *vfs_event_alloc_atomic(const char *path);
 void vfs_event_free(struct vfs_event *event);
-int vfs_event_alloc_proc_info_atomic(struct vfs_event *event);
+int vfs_event_alloc_proc_info_atomic(struct vfs_event *event, const char *path);
+/* take the attributes of inode, inode can be NULL */
+struct inode;
+void vfs_event_set_attrs(struct vfs_event *event, struct inode *inode);
+
+/*
+ * per-cpu scratch buffer of VFS_EVENT_PATH_LEN bytes to resolve a path,
+ * preemption is disabled between get and put, so do not sleep in between
+ */
+char *vfs_path_scratch_get(void);
+void vfs_path_scratch_put(void);
 
 #define mpr_info(fmt, ...) \
     pr_info("vfs_monitor: " fmt, ##__VA_ARGS__)
@@ -8,23 +8,94 @@
 #include <linux/version.h>
 #include <linux/delay.h>
 #include <linux/string.h>
+#include <linux/hash.h>
+#include <linux/jhash.h>
+#include <linux/kdev_t.h>
+#include <linux/ktime.h>
 
 #include "event_merge.h"
 #include "event.h"
 #include "vfs_change_consts.h"
+#include "vfs_stats.h"
 
-static int (*vfs_changed_entry)(struct vfs_event *event);
-static LIST_HEAD(vfs_events);
-static DEFINE_SPINLOCK(sl_vfs_events);
-static int events_number;
+/* the merged events are notified in batch */
+static int (*vfs_changed_entry)(struct list_head *events);
 static int quit;
 
+/*
+ * merge buffer shards
+ *
+ * all merge rules compare events of the same device only, and a rename pair
+ * (ren_fr, ren_to) never crosses devices, so the buffer is sharded by device.
+ * each shard keeps its own list, lock and timer, events of different devices
+ * are recorded without serializing on one lock, while the order of events
+ * of the same device is kept.
+ *
+ * sharding by cpu is not used, it would break the merge of the events of the
+ * same file that come from different cpus, and the order of them.
+ *
+ * besides the list which keeps the order of events, every shard indexes its
+ * events by (dev, path) and by cookie, so the merge candidates and the ren_fr
+ * of a ren_to are found without walking the whole list.
+ * the buckets are kept newest first, the same order the merge used to walk
+ * the list in.
+ */
+#define MERGE_SHARD_BITS        4
+#define MERGE_SHARDS            (1 << MERGE_SHARD_BITS)
+#define MERGE_PATH_HASH_BITS    8
+#define MERGE_COOKIE_HASH_BITS  6
+#define MERGE_BURST_HASH_BITS   6
+#define MERGE_SUMMARY_SLOTS     4
+
+struct merge_shard {
+    spinlock_t lock;
+    struct list_head events;
+    int events_number;
+    struct timer_list timer;
+    unsigned long timeout;      /* the merge window in jiffies, adaptive mode only */
+    int burst;                  /* the events recorded in the current window */
+    struct hlist_head path_hash[1 << MERGE_PATH_HASH_BITS];
+    struct hlist_head cookie_hash[1 << MERGE_COOKIE_HASH_BITS];
+    u16 dir_burst[1 << MERGE_BURST_HASH_BITS];                  /* the creates per folder hash in the window */
+    struct vfs_event *summaries[MERGE_SUMMARY_SLOTS];           /* the summaries that absorb the creates */
+    unsigned long summary_deadlines[MERGE_SUMMARY_SLOTS];       /* the jiffies the summaries stop absorbing at */
+    struct list_head notify_queue;  /* the batches picked, not notified yet */
+    int notifying;                  /* someone notifies the queue */
+};
+
+static struct merge_shard merge_shards[MERGE_SHARDS];
+
+static inline struct merge_shard *get_merge_shard(dev_t dev)
+{
+    return &merge_shards[hash_32(new_encode_dev(dev), MERGE_SHARD_BITS)];
+}
+
+static inline struct hlist_head *path_bucket(struct merge_shard *shard, u32 path_hash)
+{
+    return &shard->path_hash[hash_32(path_hash, MERGE_PATH_HASH_BITS)];
+}
+
+static inline struct hlist_head *cookie_bucket(struct merge_shard *shard, u32 cookie)
+{
+    return &shard->cookie_hash[hash_32(cookie, MERGE_COOKIE_HASH_BITS)];
+}
+
+static inline u32 event_path_hash(struct vfs_event *event)
+{
+    return jhash(event->path, strlen(event->path), new_encode_dev(event->dev));
+}
+
 extern int disable_event_merge;
+extern unsigned int merge_buffer_size;
+extern unsigned int merge_timeout_ms;
+extern unsigned int merge_dump_size;
+extern int adaptive_event_merge;
+extern unsigned int burst_collapse_threshold;
 
 // #define mpr_log(fmt, ...) pr_info("vfs_monitor: " fmt, ##__VA_ARGS__)
 #define mpr_log(fmt, ...) ;
 
-typedef int (*merge_action_fn_t)(struct list_head* entry, struct vfs_event *cur);
+typedef int (*merge_action_fn_t)(struct merge_shard *shard, struct vfs_event *e, struct vfs_event *cur);
 
 /*
  * new ren_to will be paired, or update to new event
@@ -37,14 +108,61 @@ typedef int (*merge_action_fn_t)(struct list_head* entry, struct vfs_event *cur)
 
 #define MERGE_OK    0
 #define MERGE_FAIL  1
+/* the newest event of the path does not merge, do not try the older ones */
+#define MERGE_STOP  2
+
+static inline int is_rename_from(unsigned char action)
+{
+    return ACT_RENAME_FROM_FILE == action || ACT_RENAME_FROM_FOLDER == action;
+}
+
+static inline int is_rename_half(unsigned char action)
+{
+    return action >= ACT_RENAME_FROM_FILE && action <= ACT_RENAME_TO_FOLDER;
+}
+
+static inline void add_event(struct merge_shard *shard, struct vfs_event *event)
+{
+    list_add_tail(&event->list, &shard->events);
+    hlist_add_head(&event->path_node, path_bucket(shard, event->path_hash));
+    /* only ren_fr is looked up by cookie */
+    if (is_rename_from(event->action))
+        hlist_add_head(&event->cookie_node, cookie_bucket(shard, event->cookie));
+    else
+        INIT_HLIST_NODE(&event->cookie_node);
+    ++shard->events_number;
+}
+
+static inline void burst_release_summary(struct merge_shard *shard, struct vfs_event *summary);
 
-#define REMOVE_ENTRY(p, e) {\
-    list_del(p);\
+static inline void unlink_event(struct merge_shard *shard, struct vfs_event *event)
+{
+    if (ACT_SUBTREE_CHANGED == event->action)
+        burst_release_summary(shard, event);
+    list_del(&event->list);
+    hlist_del_init(&event->path_node);
+    if (!hlist_unhashed(&event->cookie_node))
+        hlist_del_init(&event->cookie_node);
+    --shard->events_number;
+}
+
+#define REMOVE_ENTRY(e) {\
+    unlink_event(shard, e);\
+    vfs_stat_action_inc(VFS_STAT_MERGED, e->seen_action);\
     vfs_event_free(e);\
-    --events_number;\
 }
 
-#define cmp_event_path(e1, e2) e1->dev != e2->dev ||  strcmp(e1->path, e2->path)
+/* the partner of a rename pair is gone, the left one becomes a standalone event */
+static inline void unpair_event(struct vfs_event *e, unsigned char action)
+{
+    e->action = action;
+    e->cookie = 0;
+    e->pair = 0;
+    if (!hlist_unhashed(&e->cookie_node))
+        hlist_del_init(&e->cookie_node);
+}
+
+#define cmp_event_path(e1, e2) e1->path_hash != e2->path_hash || e1->dev != e2->dev || strcmp(e1->path, e2->path)
 
 /*
  * merge rules
@@ -54,13 +172,12 @@ typedef int (*merge_action_fn_t)(struct list_head* entry, struct vfs_event *cur)
  *
  * merge success, remove cur, else add to list
  */
-static int merge_new_file(struct list_head* p, struct vfs_event *cur)
+static int merge_new_file(struct merge_shard *shard, struct vfs_event *e, struct vfs_event *cur)
 {
-    struct vfs_event *e = list_entry(p, struct vfs_event, list);
     if (ACT_DEL_FILE == e->action) {
         if (cmp_event_path(e, cur))
             return MERGE_FAIL;
-        REMOVE_ENTRY(p, e);
+        REMOVE_ENTRY(e);
         return MERGE_OK;
     } else if (ACT_RENAME_FROM_FILE == e->action) {
         if (cmp_event_path(e, cur))
@@ -69,11 +186,9 @@ static int merge_new_file(struct list_head* p, struct vfs_event *cur)
          * if ren_fr alread paired, then update ren_to
          * else, it means ren_to still not insert, it will be update when it enter do_event_merge function
          */
-        if (e->pair) {
-            ((struct vfs_event *)e->pair)->action = ACT_NEW_FILE;
-            ((struct vfs_event *)e->pair)->cookie = 0;
-        }
-        REMOVE_ENTRY(p, e);
+        if (e->pair)
+            unpair_event(e->pair, ACT_NEW_FILE);
+        REMOVE_ENTRY(e);
         return MERGE_OK;
     }
     return MERGE_FAIL;
@@ -87,13 +202,12 @@ static int merge_new_file(struct list_head* p, struct vfs_event *cur)
  *
  * merge success, remove cur, else add to list
  */
-static int merge_del_file(struct list_head* p, struct vfs_event *cur)
+static int merge_del_file(struct merge_shard *shard, struct vfs_event *e, struct vfs_event *cur)
 {
-    struct vfs_event *e = list_entry(p, struct vfs_event, list);
     if (e->action < ACT_NEW_FOLDER) {
         if (cmp_event_path(e, cur))
             return MERGE_FAIL;
-        REMOVE_ENTRY(p, e);
+        REMOVE_ENTRY(e);
         return MERGE_OK;
     } else if (ACT_RENAME_TO_FILE == e->action) {
         /*
@@ -107,10 +221,9 @@ static int merge_del_file(struct list_head* p, struct vfs_event *cur)
         if (cmp_event_path(e, cur))
             return MERGE_FAIL;
 
-        ((struct vfs_event *)e->pair)->action = ACT_DEL_FILE;
-        ((struct vfs_event *)e->pair)->cookie = 0;
+        unpair_event(e->pair, ACT_DEL_FILE);
 
-        REMOVE_ENTRY(p, e);
+        REMOVE_ENTRY(e);
         return MERGE_OK;
     }
     return MERGE_FAIL;
@@ -124,9 +237,8 @@ static int merge_del_file(struct list_head* p, struct vfs_event *cur)
  *
  * merge success, remove cur, else add to list
  */
-static int merge_rename_from_file(struct list_head* p, struct vfs_event *cur)
+static int merge_rename_from_file(struct merge_shard *shard, struct vfs_event *e, struct vfs_event *cur)
 {
-    struct vfs_event *e = list_entry(p, struct vfs_event, list);
     if (e->action < ACT_NEW_FOLDER) {
         if (cmp_event_path(e, cur))
             return MERGE_FAIL;
@@ -135,7 +247,7 @@ static int merge_rename_from_file(struct list_head* p, struct vfs_event *cur)
          * at this time, ren_fr should be unpaired
          * ren_to will be update when it enter do_event_merge function
          */
-        REMOVE_ENTRY(p, e);
+        REMOVE_ENTRY(e);
         return MERGE_OK;
     } else if (ACT_RENAME_TO_FILE == e->action) {
         /*
@@ -151,10 +263,9 @@ static int merge_rename_from_file(struct list_head* p, struct vfs_event *cur)
         if (cmp_event_path(e, cur))
             return MERGE_FAIL;
 
-        ((struct vfs_event *)e->pair)->action = ACT_DEL_FILE;
-        ((struct vfs_event *)e->pair)->cookie = 0;
+        unpair_event(e->pair, ACT_DEL_FILE);
 
-        REMOVE_ENTRY(p, e);
+        REMOVE_ENTRY(e);
         return MERGE_OK;
     }
     return MERGE_FAIL;
@@ -167,9 +278,8 @@ static int merge_rename_from_file(struct list_head* p, struct vfs_event *cur)
  *
  * merge success, remove cur, else add to list
  */
-static int merge_rename_to_file(struct list_head* p, struct vfs_event *cur)
+static int merge_rename_to_file(struct merge_shard *shard, struct vfs_event *e, struct vfs_event *cur)
 {
-    struct vfs_event *e = list_entry(p, struct vfs_event, list);
     if (ACT_DEL_FILE == e->action) {
         /*
          * new ren_to will be paired, or update to new event
@@ -182,16 +292,337 @@ static int merge_rename_to_file(struct list_head* p, struct vfs_event *cur)
         if (cmp_event_path(e, cur))
             return MERGE_FAIL;
 
-        ((struct vfs_event *)cur->pair)->action = ACT_DEL_FILE;
-        ((struct vfs_event *)cur->pair)->cookie = 0;
+        unpair_event(cur->pair, ACT_DEL_FILE);
 
-        REMOVE_ENTRY(p, e);
+        REMOVE_ENTRY(e);
         return MERGE_OK;
     }
     return MERGE_FAIL;
 }
 
-static merge_action_fn_t action_merge_fns[] = {merge_new_file, merge_new_file, merge_new_file, 0, merge_del_file, 0, 0, 0, merge_rename_from_file, merge_rename_to_file, 0, 0, 0, 0};
+/*
+ * folder rules
+ *
+ * a folder event stands for the files under it as well, the daemon scans or
+ * updates the whole tree, so the events under the folder are checked too.
+ * they are found by walking the list after the folder event, the folder
+ * events are few, the walk is bounded by the buffer size.
+ */
+
+/* the event is the folder dir or under it */
+static inline int is_event_under(struct vfs_event *e, struct vfs_event *dir)
+{
+    size_t len = strlen(dir->path);
+
+    return e->dev == dir->dev && !strncmp(e->path, dir->path, len) && (e->path[len] == '/' || e->path[len] == 0);
+}
+
+/* the event is under the folder dir, not the folder itself */
+static inline int is_event_below(struct vfs_event *e, struct vfs_event *dir)
+{
+    return is_event_under(e, dir) && e->path[strlen(dir->path)] == '/';
+}
+
+/* any event after from is the folder dir or under it */
+static int has_events_under(struct merge_shard *shard, struct vfs_event *from, struct vfs_event *dir)
+{
+    struct vfs_event *e = from;
+
+    list_for_each_entry_continue(e, &shard->events, list) {
+        if (is_event_under(e, dir))
+            return 1;
+    }
+    return 0;
+}
+
+/* the events under dir can be dropped if no rename crosses the folder */
+static int can_drop_events_under(struct merge_shard *shard, struct vfs_event *dir)
+{
+    struct vfs_event *e = dir;
+
+    list_for_each_entry_continue(e, &shard->events, list) {
+        if (!is_event_under(e, dir) || !is_rename_half(e->action))
+            continue;
+        if (!e->pair || !is_event_under(e->pair, dir))
+            return 0;
+    }
+    return 1;
+}
+
+static void drop_events_under(struct merge_shard *shard, struct vfs_event *dir)
+{
+    struct vfs_event *e = dir, *next;
+
+    list_for_each_entry_safe_continue(e, next, &shard->events, list) {
+        if (!is_event_under(e, dir))
+            continue;
+        /* the partner is under dir too, it is dropped later in the walk */
+        if (e->pair)
+            ((struct vfs_event *)e->pair)->pair = 0;
+        REMOVE_ENTRY(e);
+    }
+}
+
+/*
+ * the folder dir is deleted, the daemon removes the indexes under it as well,
+ * so the events below it are of no use, dir is not in the buffer yet.
+ * a rename that crosses dir, or that moves dir or a parent of it, moves the
+ * indexes of the events before it somewhere else, the events are kept then.
+ */
+static int can_drop_events_below(struct merge_shard *shard, struct vfs_event *dir)
+{
+    struct vfs_event *e;
+
+    list_for_each_entry(e, &shard->events, list) {
+        if (!is_rename_half(e->action))
+            continue;
+        if (is_event_under(dir, e))
+            return 0;
+        if (is_event_below(e, dir) && (!e->pair || !is_event_below(e->pair, dir)))
+            return 0;
+    }
+    return 1;
+}
+
+static void drop_events_below(struct merge_shard *shard, struct vfs_event *dir)
+{
+    struct vfs_event *e, *next;
+
+    list_for_each_entry_safe(e, next, &shard->events, list) {
+        if (!is_event_below(e, dir))
+            continue;
+        /* the partner is below dir too, it is dropped later in the walk */
+        if (e->pair)
+            ((struct vfs_event *)e->pair)->pair = 0;
+        REMOVE_ENTRY(e);
+    }
+}
+
+/*
+ * merge rules
+ *
+ * new_dir(X) + events under X + del_dir(X)        => remove new_dir(X) and the events under X
+ * events below X + del_dir(X)                     => remove the events below X, see can_drop_events_below()
+ *
+ * a folder can be removed only if it is empty, so everything under X was
+ * created after new_dir(X) and is gone with X.
+ *
+ * merge success, remove cur, else add to list
+ */
+static int merge_del_folder(struct merge_shard *shard, struct vfs_event *e, struct vfs_event *cur)
+{
+    if (cmp_event_path(e, cur))
+        return MERGE_FAIL;
+    if (ACT_NEW_FOLDER != e->action || !can_drop_events_under(shard, e))
+        return MERGE_STOP;
+
+    drop_events_under(shard, e);
+    REMOVE_ENTRY(e);
+    return MERGE_OK;
+}
+
+/*
+ * merge rules
+ *
+ * ren_fr_dir(X) + ren_to_dir(Y) + ren_fr_dir(Y) + ren_to_dir(Z)
+ *                                                 => ren_fr_dir(X) + ren_to_dir(Z), remove ren_to_dir(Y)
+ *
+ * ren_fr_dir(X) takes the cookie of ren_fr_dir(Y), so ren_to_dir(Z) pairs
+ * with it, in the kernel or in the daemon if ren_fr_dir(X) is sent before.
+ * the rename takes effect at ren_to_dir(Z), so no event after ren_to_dir(Y)
+ * may be about X or Y, or it would be moved along with the folder.
+ *
+ * merge success, remove cur, else add to list
+ */
+static int merge_rename_from_folder(struct merge_shard *shard, struct vfs_event *e, struct vfs_event *cur)
+{
+    struct vfs_event *from;
+
+    if (cmp_event_path(e, cur))
+        return MERGE_FAIL;
+    if (ACT_RENAME_TO_FOLDER != e->action || !e->pair)
+        return MERGE_STOP;
+    from = e->pair;
+    if (has_events_under(shard, e, e) || has_events_under(shard, e, from))
+        return MERGE_STOP;
+
+    from->pair = 0;
+    from->cookie = cur->cookie;
+    hlist_del_init(&from->cookie_node);
+    hlist_add_head(&from->cookie_node, cookie_bucket(shard, from->cookie));
+
+    REMOVE_ENTRY(e);
+    return MERGE_OK;
+}
+
+static merge_action_fn_t action_merge_fns[] = {merge_new_file, merge_new_file, merge_new_file, 0, merge_del_file, merge_del_folder, 0, 0,
+    merge_rename_from_file, merge_rename_to_file, merge_rename_from_folder, 0, 0, 0, 0, 0};
+
+/*
+ * burst collapsing
+ *
+ * an untar or a checkout creates thousands of files in a few folders, the
+ * daemon would index them one by one. when the creates in one folder within
+ * the window reach burst_collapse_threshold, the creates under the folder are
+ * replaced by one ACT_SUBTREE_CHANGED event of the folder, and the later
+ * creates under it are absorbed while the summary is in the buffer.
+ * the daemon rescans the folder for the summary, it reads the folder after
+ * the creates, so dropping them keeps the index right. deletes and renames
+ * are never absorbed, they are not covered by a scan.
+ *
+ * the creates are counted per folder hash, a count over the threshold is
+ * checked by walking the buffer, a hash collision only costs a walk.
+ * a summary stops absorbing once a path under it, its folder or a parent of
+ * it is deleted or renamed. the daemon applies the delete after the rescan is
+ * queued, a create of the path after the delete has to follow the delete.
+ * a summary also stops absorbing one merge window after the collapse. while
+ * it is the only event of the shard, every absorb re-arms the timer, so a long
+ * burst would hold it back until the burst ends. the creates that follow are
+ * added to the buffer, the timer is not re-armed then and the summary is
+ * notified with the next window.
+ */
+static inline unsigned long merge_timeout(struct merge_shard *shard);
+
+static inline int is_create(unsigned char action)
+{
+    return action <= ACT_NEW_FOLDER;
+}
+
+/* the hash of the parent folder of the event, 0 for the root folder, out of the lock */
+static inline u32 event_dir_hash(struct vfs_event *event)
+{
+    const char *slash = strrchr(event->path, '/');
+
+    if (!slash || slash == event->path)
+        return 0;
+    return jhash(event->path, slash - event->path, new_encode_dev(event->dev)) ? : 1;
+}
+
+static inline u16 *dir_burst_counter(struct merge_shard *shard, u32 dir_hash)
+{
+    return &shard->dir_burst[hash_32(dir_hash, MERGE_BURST_HASH_BITS)];
+}
+
+static inline void burst_release_summary(struct merge_shard *shard, struct vfs_event *summary)
+{
+    int i;
+
+    for (i = 0; i < MERGE_SUMMARY_SLOTS; ++i) {
+        if (shard->summaries[i] == summary)
+            shard->summaries[i] = 0;
+    }
+}
+
+/* a create under a summary is absorbed */
+static int burst_absorb(struct merge_shard *shard, struct vfs_event *event)
+{
+    int i;
+
+    if (!is_create(event->action))
+        return 0;
+
+    for (i = 0; i < MERGE_SUMMARY_SLOTS; ++i) {
+        if (!shard->summaries[i])
+            continue;
+        if (time_after_eq(jiffies, shard->summary_deadlines[i])) {
+            shard->summaries[i] = 0;
+            continue;
+        }
+        if (is_event_below(event, shard->summaries[i]))
+            return 1;
+    }
+    return 0;
+}
+
+static inline int is_removal(unsigned char action)
+{
+    return ACT_DEL_FILE == action || ACT_DEL_FOLDER == action ||
+        ACT_RENAME_FROM_FILE == action || ACT_RENAME_FROM_FOLDER == action;
+}
+
+/* a path under a summary, its folder or a parent of it is deleted or renamed */
+static void burst_close(struct merge_shard *shard, struct vfs_event *event)
+{
+    int i;
+
+    if (!is_removal(event->action))
+        return;
+
+    for (i = 0; i < MERGE_SUMMARY_SLOTS; ++i) {
+        if (shard->summaries[i] &&
+            (is_event_under(shard->summaries[i], event) || is_event_below(event, shard->summaries[i])))
+            shard->summaries[i] = 0;
+    }
+}
+
+/* the creates in the buffer whose parent folder is dir, dir_len bytes of the path of dir */
+static int count_creates_in(struct merge_shard *shard, struct vfs_event *dir, size_t dir_len)
+{
+    struct vfs_event *e;
+    int number = 0;
+
+    list_for_each_entry(e, &shard->events, list) {
+        if (is_create(e->action) && e->dev == dir->dev && !strncmp(e->path, dir->path, dir_len)
+            && e->path[dir_len] == '/' && !strchr(e->path + dir_len + 1, '/'))
+            ++number;
+    }
+    return number;
+}
+
+/*
+ * count the create, once the creates in its folder reach the threshold,
+ * turn it into the summary of the folder, under the lock, before it is added
+ */
+static void burst_collapse(struct merge_shard *shard, struct vfs_event *event, u32 dir_hash)
+{
+    unsigned int threshold = READ_ONCE(burst_collapse_threshold);
+    struct vfs_event *e, *next;
+    u16 *counter;
+    char *slash;
+    int slot, number;
+
+    if (!threshold || !dir_hash || !is_create(event->action))
+        return;
+
+    counter = dir_burst_counter(shard, dir_hash);
+    if (*counter < U16_MAX)
+        ++*counter;
+    /* the event itself is not in the buffer yet */
+    if (*counter < threshold)
+        return;
+
+    for (slot = 0; slot < MERGE_SUMMARY_SLOTS && shard->summaries[slot]; ++slot)
+        ;
+    if (slot == MERGE_SUMMARY_SLOTS)
+        return;
+
+    slash = strrchr(event->path, '/');
+    number = count_creates_in(shard, event, slash - event->path) + 1;
+    /* a hash collision, count the folder from here on */
+    *counter = number;
+    if (number < threshold)
+        return;
+
+    /* the event becomes the summary of its folder */
+    *slash = 0;
+    event->action = ACT_SUBTREE_CHANGED;
+    event->cookie = 0;
+    event->path_hash = event_path_hash(event);
+    /* the attributes are of the file, not of the folder */
+    event->mode = 0;
+    /* not a traced event any more, see vfs_event_alloc_proc_info_atomic() */
+    if (event->proc_info)
+        event->proc_info->tgid = 0;
+
+    list_for_each_entry_safe(e, next, &shard->events, list) {
+        if ((is_create(e->action) || ACT_SUBTREE_CHANGED == e->action) && is_event_below(e, event))
+            REMOVE_ENTRY(e);
+    }
+    shard->summaries[slot] = event;
+    shard->summary_deadlines[slot] = jiffies + merge_timeout(shard);
+    *counter = 0;
+    mpr_log("burst_collapse, %p, %s, %d\n", event, event->path, number);
+}
 
 /*
  * notify policy
@@ -205,68 +636,134 @@ static merge_action_fn_t action_merge_fns[] = {merge_new_file, merge_new_file, m
  *
  * timer trigger, move event to local list which will be notify when level lock
  *
+ * merge candidates are looked up through the shard index, so the cost of a merge
+ * does not grow with the buffer size, the buffer can be large enough for a burst
  */
 
-#define MERGE_BUFFER_SIZE   100
-#define MERGE_TIMEOUT_MS    100     /* compare with other timer, sleep, ... in this module */
-#define MERGE_TIMEOUT       (HZ * MERGE_TIMEOUT_MS / 1000)
-#define DUMP_SIZE           10
+/*
+ * merge window
+ *
+ * the buffer size, the timeout and the dump size are tunable in sysfs.
+ * in adaptive mode every shard moves its window between 1/4 and 8 times of
+ * merge_timeout_ms: a window that recorded a burst is doubled, so more events
+ * of the burst meet in the buffer and merge, a window that recorded a single
+ * event is halved, so a single change is notified sooner.
+ */
+#define MERGE_WINDOW_MIN_SHIFT  2
+#define MERGE_WINDOW_MAX_SHIFT  3
 
-#define MOVE_EVENT(p, e, events_tosend) {\
-    list_del(p);\
-    *events_tosend++ = e; \
-    --events_number; \
+static inline unsigned long merge_base_timeout(void)
+{
+    return max(msecs_to_jiffies(READ_ONCE(merge_timeout_ms)), 1UL);
 }
 
-static void event_timeout_notify_callback(
-#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 15, 0)
-unsigned long data
+static inline unsigned long merge_timeout(struct merge_shard *shard)
+{
+    return READ_ONCE(adaptive_event_merge) ? READ_ONCE(shard->timeout) : merge_base_timeout();
+}
+
+/* at the end of a window, under the shard lock */
+static inline void adapt_merge_timeout(struct merge_shard *shard)
+{
+    unsigned long base = merge_base_timeout();
+    unsigned long lo = max(base >> MERGE_WINDOW_MIN_SHIFT, 1UL);
+    unsigned long hi = base << MERGE_WINDOW_MAX_SHIFT;
+    unsigned long timeout = clamp(shard->timeout, lo, hi);
+    int burst = max(READ_ONCE(merge_buffer_size) / 4, 2U);
+
+    if (shard->burst >= burst)
+        timeout = min(timeout << 1, hi);
+    else if (shard->burst <= 1)
+        timeout = max(timeout >> 1, lo);
+    WRITE_ONCE(shard->timeout, timeout);
+    shard->burst = 0;
+}
+
+#define MOVE_EVENT(e, events_tosend) {\
+    unlink_event(shard, e);\
+    vfs_stat_residence(now - e->stamp);\
+    list_add_tail(&e->list, events_tosend);\
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
+#define merge_timer_delete(t) timer_delete(t)
+#define merge_timer_delete_sync(t) timer_delete_sync(t)
 #else
-struct timer_list *t
+#define merge_timer_delete(t) del_timer(t)
+#define merge_timer_delete_sync(t) del_timer_sync(t)
 #endif
-);
-static DEFINE_TIMER(event_timeout_notify, event_timeout_notify_callback);
 
-static inline void pick_events(struct vfs_event **events_tosend)
+static inline void pick_events(struct merge_shard *shard, struct list_head *events_tosend)
 {
-    struct list_head *p, *next;
-    struct vfs_event *e;
+    struct vfs_event *e, *next;
     int i  = 0;
+    u64 now = ktime_get_ns();
 
     if (unlikely(quit)) {
-        list_for_each_safe(p, next, &vfs_events) {
-            e = list_entry(p, struct vfs_event, list);
-            MOVE_EVENT(p, e, events_tosend)
+        list_for_each_entry_safe(e, next, &shard->events, list) {
+            MOVE_EVENT(e, events_tosend)
         }
     } else {
-        list_for_each_safe(p, next, &vfs_events) {
-            e = list_entry(p, struct vfs_event, list);
+        list_for_each_entry_safe(e, next, &shard->events, list) {
             if (e->action != ACT_RENAME_FROM_FILE || e->pair) {
-                MOVE_EVENT(p, e, events_tosend)
+                MOVE_EVENT(e, events_tosend)
                 /* ren_fr which be moved, will unpaired with ren_to */
-                if (e->action == ACT_RENAME_FROM_FILE)
+                if (is_rename_from(e->action) && e->pair)
                     ((struct vfs_event *)e->pair)->pair = 0;
-                if (++i >= DUMP_SIZE)
+                if (++i >= READ_ONCE(merge_dump_size))
                     break;
             }
         }
     }
 }
 
-static inline void notify_events(struct vfs_event **events_tosend)
+/*
+ * notify order
+ *
+ * the events are picked under the shard lock and notified out of it, so the
+ * timer and do_event_merge on other cpus could notify the batches of a shard
+ * out of order. the batches are queued on the shard as they are picked, the
+ * one that finds nobody notifying the shard notifies the queue until it is
+ * empty, the others leave their batches to it and return without waiting.
+ * the timer that interrupts the notifier on the same cpu only queues its batch.
+ */
+
+/* queue the picked events, under the shard lock, return 1 if the caller notifies the queue */
+static inline int queue_notify(struct merge_shard *shard, struct list_head *events_tosend)
+{
+    if (list_empty(events_tosend))
+        return 0;
+    list_splice_tail_init(events_tosend, &shard->notify_queue);
+    if (shard->notifying)
+        return 0;
+    shard->notifying = 1;
+    return 1;
+}
+
+static void notify_events(struct merge_shard *shard)
 {
-    void *send = *events_tosend;
+    LIST_HEAD(events_tosend);
+    struct vfs_event *e, *next;
+
+    spin_lock_bh(&shard->lock);
+    while (!list_empty(&shard->notify_queue)) {
+        list_splice_init(&shard->notify_queue, &events_tosend);
+        spin_unlock_bh(&shard->lock);
 
-    if (send)
         mpr_log("notify_events\n");
+        /* the events that a transport keeps are taken off the list */
+        vfs_changed_entry(&events_tosend);
+        list_for_each_entry_safe(e, next, &events_tosend, list)
+            vfs_event_free(e);
+        INIT_LIST_HEAD(&events_tosend);
 
-    while (*events_tosend) {
-        vfs_changed_entry(*events_tosend);
-        vfs_event_free(*events_tosend++);
+        spin_lock_bh(&shard->lock);
     }
+    shard->notifying = 0;
+    spin_unlock_bh(&shard->lock);
 
-    if (send && events_number >= 1) {
-        mod_timer(&event_timeout_notify, jiffies + MERGE_TIMEOUT);
+    if (READ_ONCE(shard->events_number) >= 1) {
+        mod_timer(&shard->timer, jiffies + merge_timeout(shard));
         mpr_log("notify_events, mod_timer\n");
     }
 }
@@ -279,35 +776,40 @@ struct timer_list *t
 #endif
 )
 {
-    struct vfs_event *events_tosend[MERGE_BUFFER_SIZE+1] = {0};
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 15, 0)
+    struct merge_shard *shard = (struct merge_shard *)data;
+#else
+    struct merge_shard *shard = container_of(t, struct merge_shard, timer);
+#endif
+    LIST_HEAD(events_tosend);
+    int notify;
 
     mpr_log("event_timeout_notify_callback\n");
 
-    spin_lock(&sl_vfs_events);
-    pick_events(events_tosend);
-    spin_unlock(&sl_vfs_events);
+    spin_lock(&shard->lock);
+    pick_events(shard, &events_tosend);
+    adapt_merge_timeout(shard);
+    memset(shard->dir_burst, 0, sizeof(shard->dir_burst));
+    notify = queue_notify(shard, &events_tosend);
+    spin_unlock(&shard->lock);
 
-    notify_events(events_tosend);
+    if (notify)
+        notify_events(shard);
 }
 
-static inline void check_events(struct vfs_event **events_tosend)
+static inline void check_events(struct merge_shard *shard, struct list_head *events_tosend)
 {
-    if (!events_number) {
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
-        timer_delete(&event_timeout_notify);
+    if (!shard->events_number) {
+        merge_timer_delete(&shard->timer);
         mpr_log("check_events, timer_delete\n");
-#else
-        del_timer(&event_timeout_notify);
-        mpr_log("check_events, del_timer\n");
-#endif
-    } else if (1 == events_number) {
-        mod_timer(&event_timeout_notify, jiffies + MERGE_TIMEOUT);
+    } else if (1 == shard->events_number) {
+        mod_timer(&shard->timer, jiffies + merge_timeout(shard));
         mpr_log("check_events, mod_timer\n");
-    } else if (events_number >= MERGE_BUFFER_SIZE) {
-        pick_events(events_tosend);
+    } else if (shard->events_number >= READ_ONCE(merge_buffer_size)) {
+        pick_events(shard, events_tosend);
         mpr_log("check_events, pick_events\n");
     } else {
-        mpr_log("check_events, events_number is %d\n", events_number);
+        mpr_log("check_events, events_number is %d\n", shard->events_number);
     }
 }
 
@@ -318,74 +820,145 @@ static inline void check_events(struct vfs_event **events_tosend)
  */
 static int do_event_merge(struct vfs_event *event)
 {
-    struct list_head *p, *next;
+    struct hlist_node *next;
     struct vfs_event *e;
     int merge_res = MERGE_FAIL;
-    struct vfs_event *events_tosend[MERGE_BUFFER_SIZE+1] = {0};
+    LIST_HEAD(events_tosend);
+    struct merge_shard *shard = get_merge_shard(event->dev);
+    int notify;
+    u32 dir_hash;
 
     event->pair = 0;
+    /* hash the path out of the lock */
+    event->path_hash = event_path_hash(event);
+    dir_hash = event_dir_hash(event);
+    event->stamp = ktime_get_ns();
+    event->seen_action = event->action;
+    vfs_stat_action_inc(VFS_STAT_SEEN, event->action);
 
     mpr_log("do_event_merge, %p, %u, %u, %s, %u\n", event, event->action, event->dev, event->path, event->cookie);
 
     /* disable timer softirq*/
-    spin_lock_bh(&sl_vfs_events);
-    if (disable_event_merge && events_number == 0) {
-        spin_unlock_bh(&sl_vfs_events);
-        vfs_changed_entry(event);
-        vfs_event_free(event);
+    spin_lock_bh(&shard->lock);
+    if (disable_event_merge && shard->events_number == 0) {
+        list_add_tail(&event->list, &events_tosend);
+        notify = queue_notify(shard, &events_tosend);
+        spin_unlock_bh(&shard->lock);
+        if (notify)
+            notify_events(shard);
         return 0;
     }
-    /* ren_to event pairing */
-    if (ACT_RENAME_TO_FILE == event->action) {
-        list_for_each_entry(e, &vfs_events, list) {
-            if (e->cookie == event->cookie) {
+    ++shard->burst;
+    /* ren_to event pairing, an unpaired folder ren_to is left to the daemon */
+    if (ACT_RENAME_TO_FILE == event->action || ACT_RENAME_TO_FOLDER == event->action) {
+        hlist_for_each_entry(e, cookie_bucket(shard, event->cookie), cookie_node) {
+            if (e->cookie == event->cookie && !e->pair) {
                 e->pair = event;
                 event->pair = e;
                 mpr_log("do_event_merge, ren_to paired, %p\n", event);
                 break;
             }
         }
-        if (!event->pair) {
+        if (!event->pair && ACT_RENAME_TO_FILE == event->action) {
             event->action = ACT_NEW_FILE;
             event->cookie = 0;
             mpr_log("do_event_merge, ren_to -> new, %p\n", event);
         }
     }
-    /* merge event */
-    if (action_merge_fns[event->action]) {
-        list_for_each_prev_safe(p, next, &vfs_events) {
-            merge_res = action_merge_fns[event->action](p, event);
-            if (MERGE_OK == merge_res)
+    /* merge event, only the events of the same path can be merged, or absorb it into a summary */
+    burst_close(shard, event);
+    if (burst_absorb(shard, event)) {
+        merge_res = MERGE_OK;
+    } else if (action_merge_fns[event->action]) {
+        hlist_for_each_entry_safe(e, next, path_bucket(shard, event->path_hash), path_node) {
+            merge_res = action_merge_fns[event->action](shard, e, event);
+            if (MERGE_FAIL != merge_res)
                 break;
         }
     }
+    /* a folder that is not created in the window, as rm -r deletes it */
+    if (MERGE_OK != merge_res && ACT_DEL_FOLDER == event->action && can_drop_events_below(shard, event))
+        drop_events_below(shard, event);
     if (MERGE_OK == merge_res) {
+        vfs_stat_action_inc(VFS_STAT_MERGED, event->seen_action);
         vfs_event_free(event);
         mpr_log("do_event_merge, merged, %p\n", event);
     } else {
-        list_add_tail(&event->list, &vfs_events);
-        ++events_number;
+        burst_collapse(shard, event, dir_hash);
+        add_event(shard, event);
         mpr_log("do_event_merge, added, %p\n", event);
     }
-    check_events(events_tosend);
-    spin_unlock_bh(&sl_vfs_events);
+    check_events(shard, &events_tosend);
+    notify = queue_notify(shard, &events_tosend);
+    spin_unlock_bh(&shard->lock);
+
+    if (notify)
+        notify_events(shard);
+
+    return 0;
+}
+
+int event_merge_pending_number(void)
+{
+    int i, number = 0;
+
+    for (i = 0; i < MERGE_SHARDS; ++i)
+        number += READ_ONCE(merge_shards[i].events_number);
 
-    notify_events(events_tosend);
+    return number;
+}
+
+static int event_merge_notifying(void)
+{
+    int i;
 
+    for (i = 0; i < MERGE_SHARDS; ++i) {
+        if (READ_ONCE(merge_shards[i].notifying))
+            return 1;
+    }
     return 0;
 }
 
 void *get_event_merge_entry(void *vfs_changed_func)
 {
+    struct merge_shard *shard;
+    int i;
+
     vfs_changed_entry = vfs_changed_func;
 
+    for (i = 0; i < MERGE_SHARDS; ++i) {
+        shard = &merge_shards[i];
+        spin_lock_init(&shard->lock);
+        INIT_LIST_HEAD(&shard->events);
+        shard->events_number = 0;
+        shard->timeout = merge_base_timeout();
+        shard->burst = 0;
+        INIT_LIST_HEAD(&shard->notify_queue);
+        shard->notifying = 0;
+        memset(shard->dir_burst, 0, sizeof(shard->dir_burst));
+        memset(shard->summaries, 0, sizeof(shard->summaries));
+        __hash_init(shard->path_hash, ARRAY_SIZE(shard->path_hash));
+        __hash_init(shard->cookie_hash, ARRAY_SIZE(shard->cookie_hash));
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 15, 0)
+        setup_timer(&shard->timer, event_timeout_notify_callback, (unsigned long)shard);
+#else
+        timer_setup(&shard->timer, event_timeout_notify_callback, 0);
+#endif
+    }
+
     return do_event_merge;
 }
 
 void clearup_event_merge(void)
 {
+    int i;
+
     quit = 1;
 
-    while (events_number)
+    /* the batches picked last may still be notified */
+    while (event_merge_pending_number() || event_merge_notifying())
         msleep(50);
+
+    for (i = 0; i < MERGE_SHARDS; ++i)
+        merge_timer_delete_sync(&merge_shards[i].timer);
 }
@@ -8,5 +8,7 @@
 
 void *get_event_merge_entry(void *vfs_changed_func);
 void clearup_event_merge(void);
+/* the number of events in the merge buffer */
+int event_merge_pending_number(void);
 
 #endif /* EVENT_MERGE_H */
\ No newline at end of file
@@ -0,0 +1,231 @@
+// SPDX-FileCopyrightText: 2026 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * genl_stall, a dentry listener that stalls
+ *
+ * it joins the dentry group with a small receive buffer and
+ * NETLINK_BROADCAST_ERROR, as the daemon does, makes files in a new dir and
+ * removes them without reading, then drains the socket. the msgs it can not
+ * take must be sent again by the module, so the seqs of the device of the dir
+ * have no hole and no lost msg comes for it.
+ *
+ *   genl_stall [-n files] [-r rcvbuf] [-s stall_ms] [-q quiet_ms] [dir]
+ *
+ * it needs the module loaded and root, dir is ".", it has to be under an
+ * indexed path if the daemon installed path filters. the exit code is 0 if
+ * nothing is lost, 1 if something is, 77 if the test can not run or the
+ * socket did not overflow.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include <linux/netlink.h>
+#include <netlink/genl/ctrl.h>
+#include <netlink/genl/genl.h>
+
+#include "vfs_genl.h"
+
+#define EXIT_SKIP 77
+
+struct stall_state {
+    unsigned int major;
+    unsigned int minor;
+    uint64_t *seqs;
+    size_t seqs_number;
+    size_t seqs_size;
+    unsigned long events;
+    unsigned long lost;
+};
+
+static void add_seq(struct stall_state *state, uint64_t seq)
+{
+    if (state->seqs_number == state->seqs_size) {
+        state->seqs_size = state->seqs_size ? state->seqs_size * 2 : 4096;
+        state->seqs = realloc(state->seqs, state->seqs_size * sizeof(*state->seqs));
+        if (!state->seqs) {
+            perror("realloc");
+            exit(EXIT_SKIP);
+        }
+    }
+    state->seqs[state->seqs_number++] = seq;
+}
+
+static int of_device(struct stall_state *state, struct nlattr **tb)
+{
+    return tb[VFSMONITOR_A_MAJOR] && tb[VFSMONITOR_A_MINOR] &&
+        nla_get_u16(tb[VFSMONITOR_A_MAJOR]) == state->major &&
+        nla_get_u32(tb[VFSMONITOR_A_MINOR]) == state->minor;
+}
+
+static int handle_msg(struct nl_msg *msg, void *arg)
+{
+    struct stall_state *state = arg;
+    struct nlmsghdr *nlh = nlmsg_hdr(msg);
+    struct genlmsghdr *gnlh = nlmsg_data(nlh);
+    struct nlattr *tb[VFSMONITOR_A_MAX + 1];
+    struct nlattr *pos;
+    int rem;
+
+    if (gnlh->cmd == VFSMONITOR_C_NOTIFY_LOST) {
+        if (genlmsg_parse(nlh, 0, tb, VFSMONITOR_A_MAX, vfsmonitor_genl_policy) < 0)
+            return NL_SKIP;
+        /* 0:0 is all devices */
+        if (of_device(state, tb) ||
+            (nla_get_u16(tb[VFSMONITOR_A_MAJOR]) == 0 && nla_get_u32(tb[VFSMONITOR_A_MINOR]) == 0))
+            state->lost++;
+        return NL_OK;
+    }
+    if (gnlh->cmd != VFSMONITOR_C_NOTIFY_BATCH)
+        return NL_SKIP;
+
+    nla_for_each_attr(pos, genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0), rem) {
+        if (nla_type(pos) != VFSMONITOR_A_EVENT)
+            continue;
+        if (nla_parse_nested(tb, VFSMONITOR_A_MAX, pos, vfsmonitor_genl_policy) < 0)
+            continue;
+        if (!of_device(state, tb) || !tb[VFSMONITOR_A_SEQ])
+            continue;
+        state->events++;
+        if (nla_get_u64(tb[VFSMONITOR_A_SEQ]))
+            add_seq(state, nla_get_u64(tb[VFSMONITOR_A_SEQ]));
+    }
+    return NL_OK;
+}
+
+static int compare_seqs(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void sleep_ms(int ms)
+{
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000 };
+
+    nanosleep(&ts, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+    struct stall_state state = { 0 };
+    int files = 20000, rcvbuf = 16384, stall_ms = 1000, quiet_ms = 2000;
+    const char *parent = ".";
+    char dir[4096], path[4200];
+    unsigned long overflows = 0, duplicates = 0, holes = 0;
+    struct nl_sock *sk;
+    struct stat st;
+    int group, on = 1, opt, i;
+
+    while ((opt = getopt(argc, argv, "n:r:s:q:")) != -1) {
+        switch (opt) {
+        case 'n': files = atoi(optarg); break;
+        case 'r': rcvbuf = atoi(optarg); break;
+        case 's': stall_ms = atoi(optarg); break;
+        case 'q': quiet_ms = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-n files] [-r rcvbuf] [-s stall_ms] [-q quiet_ms] [dir]\n", argv[0]);
+            return EXIT_SKIP;
+        }
+    }
+    if (optind < argc)
+        parent = argv[optind];
+
+    snprintf(dir, sizeof(dir), "%s/genl_stall.XXXXXX", parent);
+    if (!mkdtemp(dir) || stat(dir, &st)) {
+        perror(dir);
+        return EXIT_SKIP;
+    }
+    state.major = major(st.st_dev);
+    state.minor = minor(st.st_dev);
+
+    sk = nl_socket_alloc();
+    if (!sk || genl_connect(sk) < 0) {
+        fprintf(stderr, "can not connect to generic netlink\n");
+        goto skip;
+    }
+    group = genl_ctrl_resolve_grp(sk, VFSMONITOR_FAMILY_NAME, VFSMONITOR_MCG_DENTRY_NAME);
+    if (group < 0) {
+        fprintf(stderr, "the kernel module is not loaded\n");
+        goto skip;
+    }
+    nl_socket_disable_seq_check(sk);
+    nl_socket_modify_cb(sk, NL_CB_VALID, NL_CB_CUSTOM, handle_msg, &state);
+    if (nl_socket_set_buffer_size(sk, rcvbuf, 0) < 0 ||
+        setsockopt(nl_socket_get_fd(sk), SOL_NETLINK, NETLINK_BROADCAST_ERROR, &on, sizeof(on)) < 0 ||
+        nl_socket_add_membership(sk, group) < 0 ||
+        nl_socket_set_nonblocking(sk) < 0) {
+        fprintf(stderr, "can not set up the socket\n");
+        goto skip;
+    }
+
+    /* the stall, nothing is read while the events come */
+    for (i = 0; i < files; ++i) {
+        int fd;
+
+        snprintf(path, sizeof(path), "%s/f%d", dir, i);
+        fd = open(path, O_CREAT | O_WRONLY, 0644);
+        if (fd >= 0)
+            close(fd);
+    }
+    for (i = 0; i < files; ++i) {
+        snprintf(path, sizeof(path), "%s/f%d", dir, i);
+        unlink(path);
+    }
+    rmdir(dir);
+    sleep_ms(stall_ms);
+
+    /* drain, the msgs sent again come by the retry timer */
+    for (;;) {
+        struct pollfd pfd = { nl_socket_get_fd(sk), POLLIN, 0 };
+        int rc = poll(&pfd, 1, quiet_ms);
+
+        if (rc <= 0)
+            break;
+        rc = nl_recvmsgs_default(sk);
+        /* the overrun of the socket is reported by ENOBUFS, as -NLE_NOMEM */
+        if (rc == -NLE_NOMEM)
+            overflows++;
+        else if (rc < 0 && rc != -NLE_AGAIN)
+            fprintf(stderr, "receive: %s\n", nl_geterror(rc));
+    }
+    nl_socket_free(sk);
+
+    qsort(state.seqs, state.seqs_number, sizeof(*state.seqs), compare_seqs);
+    for (size_t j = 1; j < state.seqs_number; ++j) {
+        if (state.seqs[j] == state.seqs[j - 1])
+            duplicates++;
+        else if (state.seqs[j] != state.seqs[j - 1] + 1)
+            holes += state.seqs[j] - state.seqs[j - 1] - 1;
+    }
+
+    printf("device %u:%u, events %lu, overflows %lu, sent again %lu, missing seqs %lu, lost msgs %lu\n",
+           state.major, state.minor, state.events, overflows, duplicates, holes, state.lost);
+    free(state.seqs);
+
+    if (holes || state.lost)
+        return 1;
+    if (!overflows) {
+        fprintf(stderr, "the socket did not overflow, raise -n or lower -r\n");
+        return EXIT_SKIP;
+    }
+    return 0;
+
+skip:
+    rmdir(dir);
+    return EXIT_SKIP;
+}
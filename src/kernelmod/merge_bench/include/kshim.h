@@ -0,0 +1,357 @@
+// SPDX-FileCopyrightText: 2026 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef KSHIM_H
+#define KSHIM_H
+
+/*
+ * the kernel api used by event_merge.c, in userspace
+ *
+ * the linux/ headers of this dir include this file only, so event_merge.c
+ * builds unchanged. the harness is single threaded, the locks do nothing.
+ * the time is virtual, it is moved by kshim_advance(), which runs the timers
+ * that expire on the way, in the order of their expiry.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/types.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef unsigned short umode_t;
+
+#define U16_MAX ((u16)~0U)
+
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#define READ_ONCE(x) (*(const volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, val) (*(volatile __typeof__(x) *)&(x) = (val))
+
+#define min(a, b) ({ __typeof__(a) __a = (a); __typeof__(b) __b = (b); __a < __b ? __a : __b; })
+#define max(a, b) ({ __typeof__(a) __a = (a); __typeof__(b) __b = (b); __a > __b ? __a : __b; })
+#define clamp(val, lo, hi) min(max(val, lo), hi)
+
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+#define pr_info(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+#define pr_err(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+
+/* version */
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + ((c) > 255 ? 255 : (c)))
+#define LINUX_VERSION_CODE KERNEL_VERSION(6, 6, 0)
+
+/* device numbers */
+#define MINORBITS 20
+#define MINORMASK ((1U << MINORBITS) - 1)
+#define MAJOR(dev) ((unsigned int)((dev) >> MINORBITS))
+#define MINOR(dev) ((unsigned int)((dev) & MINORMASK))
+#define MKDEV(ma, mi) (((dev_t)(ma) << MINORBITS) | (mi))
+
+static inline u32 new_encode_dev(dev_t dev)
+{
+    unsigned major = MAJOR(dev);
+    unsigned minor = MINOR(dev);
+
+    return (minor & 0xff) | (major << 8) | ((minor & ~0xff) << 12);
+}
+
+/* lists */
+struct list_head {
+    struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+    list->next = list;
+    list->prev = list;
+}
+
+static inline void list_add_tail(struct list_head *entry, struct list_head *head)
+{
+    entry->prev = head->prev;
+    entry->next = head;
+    head->prev->next = entry;
+    head->prev = entry;
+}
+
+static inline void list_del(struct list_head *entry)
+{
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->next = NULL;
+    entry->prev = NULL;
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+    return head->next == head;
+}
+
+/* move the entries of list to the end of head, list is left empty */
+static inline void list_splice_tail_init(struct list_head *list, struct list_head *head)
+{
+    if (list_empty(list))
+        return;
+    list->next->prev = head->prev;
+    head->prev->next = list->next;
+    list->prev->next = head;
+    head->prev = list->prev;
+    INIT_LIST_HEAD(list);
+}
+
+/* move the entries of list to the start of head, list is left empty */
+static inline void list_splice_init(struct list_head *list, struct list_head *head)
+{
+    if (list_empty(list))
+        return;
+    list->prev->next = head->next;
+    head->next->prev = list->prev;
+    head->next = list->next;
+    list->next->prev = head;
+    INIT_LIST_HEAD(list);
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) list_entry((ptr)->next, type, member)
+#define list_next_entry(pos, member) list_entry((pos)->member.next, __typeof__(*(pos)), member)
+
+#define list_for_each_entry(pos, head, member) \
+    for (pos = list_first_entry(head, __typeof__(*pos), member); &pos->member != (head); \
+         pos = list_next_entry(pos, member))
+
+#define list_for_each_entry_safe(pos, n, head, member) \
+    for (pos = list_first_entry(head, __typeof__(*pos), member), n = list_next_entry(pos, member); \
+         &pos->member != (head); pos = n, n = list_next_entry(n, member))
+
+#define list_for_each_entry_continue(pos, head, member) \
+    for (pos = list_next_entry(pos, member); &pos->member != (head); pos = list_next_entry(pos, member))
+
+#define list_for_each_entry_safe_continue(pos, n, head, member) \
+    for (pos = list_next_entry(pos, member), n = list_next_entry(pos, member); \
+         &pos->member != (head); pos = n, n = list_next_entry(n, member))
+
+struct hlist_head {
+    struct hlist_node *first;
+};
+
+struct hlist_node {
+    struct hlist_node *next, **pprev;
+};
+
+#define INIT_HLIST_HEAD(ptr) ((ptr)->first = NULL)
+
+static inline void INIT_HLIST_NODE(struct hlist_node *node)
+{
+    node->next = NULL;
+    node->pprev = NULL;
+}
+
+static inline int hlist_unhashed(const struct hlist_node *node)
+{
+    return !node->pprev;
+}
+
+static inline void hlist_add_head(struct hlist_node *node, struct hlist_head *head)
+{
+    node->next = head->first;
+    if (head->first)
+        head->first->pprev = &node->next;
+    head->first = node;
+    node->pprev = &head->first;
+}
+
+static inline void hlist_del_init(struct hlist_node *node)
+{
+    if (hlist_unhashed(node))
+        return;
+    *node->pprev = node->next;
+    if (node->next)
+        node->next->pprev = node->pprev;
+    INIT_HLIST_NODE(node);
+}
+
+#define hlist_entry_safe(ptr, type, member) \
+    ({ __typeof__(ptr) ____ptr = (ptr); ____ptr ? container_of(____ptr, type, member) : NULL; })
+
+#define hlist_for_each_entry(pos, head, member) \
+    for (pos = hlist_entry_safe((head)->first, __typeof__(*(pos)), member); pos; \
+         pos = hlist_entry_safe((pos)->member.next, __typeof__(*(pos)), member))
+
+#define hlist_for_each_entry_safe(pos, n, head, member) \
+    for (pos = hlist_entry_safe((head)->first, __typeof__(*pos), member); \
+         pos && ({ n = pos->member.next; 1; }); pos = hlist_entry_safe(n, __typeof__(*pos), member))
+
+static inline void __hash_init(struct hlist_head *ht, unsigned int size)
+{
+    unsigned int i;
+
+    for (i = 0; i < size; ++i)
+        INIT_HLIST_HEAD(&ht[i]);
+}
+
+/* hashes, the same functions as the kernel */
+#define GOLDEN_RATIO_32 0x61C88647
+
+static inline u32 hash_32(u32 val, unsigned int bits)
+{
+    return (val * GOLDEN_RATIO_32) >> (32 - bits);
+}
+
+#define JHASH_INITVAL 0xdeadbeef
+
+static inline u32 rol32(u32 word, unsigned int shift)
+{
+    return (word << (shift & 31)) | (word >> ((-shift) & 31));
+}
+
+#define __jhash_mix(a, b, c) { \
+    a -= c;  a ^= rol32(c, 4);  c += b; \
+    b -= a;  b ^= rol32(a, 6);  a += c; \
+    c -= b;  c ^= rol32(b, 8);  b += a; \
+    a -= c;  a ^= rol32(c, 16); c += b; \
+    b -= a;  b ^= rol32(a, 19); a += c; \
+    c -= b;  c ^= rol32(b, 4);  b += a; \
+}
+
+#define __jhash_final(a, b, c) { \
+    c ^= b; c -= rol32(b, 14); \
+    a ^= c; a -= rol32(c, 11); \
+    b ^= a; b -= rol32(a, 25); \
+    c ^= b; c -= rol32(b, 16); \
+    a ^= c; a -= rol32(c, 4);  \
+    b ^= a; b -= rol32(a, 14); \
+    c ^= b; c -= rol32(b, 24); \
+}
+
+static inline u32 get_unaligned_u32(const u8 *p)
+{
+    u32 v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline u32 jhash(const void *key, u32 length, u32 initval)
+{
+    const u8 *k = key;
+    u32 a, b, c;
+
+    a = b = c = JHASH_INITVAL + length + initval;
+    while (length > 12) {
+        a += get_unaligned_u32(k);
+        b += get_unaligned_u32(k + 4);
+        c += get_unaligned_u32(k + 8);
+        __jhash_mix(a, b, c);
+        length -= 12;
+        k += 12;
+    }
+    switch (length) {
+    case 12: c += (u32)k[11] << 24; /* fall through */
+    case 11: c += (u32)k[10] << 16; /* fall through */
+    case 10: c += (u32)k[9] << 8;   /* fall through */
+    case 9:  c += k[8];             /* fall through */
+    case 8:  b += (u32)k[7] << 24;  /* fall through */
+    case 7:  b += (u32)k[6] << 16;  /* fall through */
+    case 6:  b += (u32)k[5] << 8;   /* fall through */
+    case 5:  b += k[4];             /* fall through */
+    case 4:  a += (u32)k[3] << 24;  /* fall through */
+    case 3:  a += (u32)k[2] << 16;  /* fall through */
+    case 2:  a += (u32)k[1] << 8;   /* fall through */
+    case 1:  a += k[0];
+        __jhash_final(a, b, c);
+        break;
+    case 0:
+        break;
+    }
+
+    return c;
+}
+
+/* locks, single threaded */
+typedef struct {
+    int unused;
+} spinlock_t;
+
+#define spin_lock_init(lock) ((void)(lock))
+#define spin_lock(lock) ((void)(lock))
+#define spin_unlock(lock) ((void)(lock))
+#define spin_lock_bh(lock) ((void)(lock))
+#define spin_unlock_bh(lock) ((void)(lock))
+
+/* per-cpu, one cpu */
+#define DECLARE_PER_CPU(type, name) extern __typeof__(type) name
+#define DEFINE_PER_CPU(type, name) __typeof__(type) name
+#define this_cpu_inc(var) ((var)++)
+
+/* math */
+#define ilog2(n) (63 - __builtin_clzll(n))
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+    return dividend / divisor;
+}
+
+/* virtual time */
+#define NSEC_PER_USEC 1000ULL
+#define NSEC_PER_MSEC 1000000ULL
+#define NSEC_PER_SEC 1000000000ULL
+#define MSEC_PER_SEC 1000UL
+#define HZ 250
+
+/* the virtual time in ns, it starts at 0 */
+u64 kshim_now(void);
+/* move the virtual time to now, run the timers that expire up to now */
+void kshim_advance(u64 now);
+
+#define jiffies ((unsigned long)(kshim_now() / (NSEC_PER_SEC / HZ)))
+#define time_after_eq(a, b) ((long)((a) - (b)) >= 0)
+
+static inline unsigned long msecs_to_jiffies(unsigned int ms)
+{
+    return ((unsigned long)ms * HZ + MSEC_PER_SEC - 1) / MSEC_PER_SEC;
+}
+
+static inline u64 ktime_get_ns(void)
+{
+    return kshim_now();
+}
+
+/* sleeping lets the virtual time pass */
+static inline void msleep(unsigned int ms)
+{
+    kshim_advance(kshim_now() + ms * NSEC_PER_MSEC);
+}
+
+/* timers */
+struct timer_list {
+    void (*function)(struct timer_list *timer);
+    unsigned long expires;
+    int pending;
+};
+
+void timer_setup(struct timer_list *timer, void (*function)(struct timer_list *), unsigned int flags);
+int mod_timer(struct timer_list *timer, unsigned long expires);
+/* timer_delete of <time.h> is a posix timer */
+int kshim_timer_delete(struct timer_list *timer);
+
+#define timer_delete(timer) kshim_timer_delete(timer)
+#define timer_delete_sync(timer) timer_delete(timer)
+#define del_timer(timer) timer_delete(timer)
+#define del_timer_sync(timer) timer_delete(timer)
+
+#endif /* KSHIM_H */
@@ -0,0 +1,82 @@
+// SPDX-FileCopyrightText: 2026 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <kshim.h>
+
+#define KSHIM_MAX_TIMERS 64
+#define NSEC_PER_JIFFY (NSEC_PER_SEC / HZ)
+
+static u64 kshim_time;
+static struct timer_list *kshim_timers[KSHIM_MAX_TIMERS];
+static int kshim_timers_number;
+
+u64 kshim_now(void)
+{
+    return kshim_time;
+}
+
+void timer_setup(struct timer_list *timer, void (*function)(struct timer_list *), unsigned int flags)
+{
+    int i;
+
+    timer->function = function;
+    timer->expires = 0;
+    timer->pending = 0;
+    for (i = 0; i < kshim_timers_number; ++i) {
+        if (kshim_timers[i] == timer)
+            return;
+    }
+    if (kshim_timers_number == KSHIM_MAX_TIMERS) {
+        fprintf(stderr, "kshim: too many timers\n");
+        abort();
+    }
+    kshim_timers[kshim_timers_number++] = timer;
+}
+
+int mod_timer(struct timer_list *timer, unsigned long expires)
+{
+    int pending = timer->pending;
+
+    timer->expires = expires;
+    timer->pending = 1;
+    return pending;
+}
+
+int kshim_timer_delete(struct timer_list *timer)
+{
+    int pending = timer->pending;
+
+    timer->pending = 0;
+    return pending;
+}
+
+/* the pending timer that expires first up to now */
+static struct timer_list *next_expired(u64 now)
+{
+    struct timer_list *next = NULL;
+    int i;
+
+    for (i = 0; i < kshim_timers_number; ++i) {
+        struct timer_list *timer = kshim_timers[i];
+
+        if (!timer->pending || (u64)timer->expires * NSEC_PER_JIFFY > now)
+            continue;
+        if (!next || timer->expires < next->expires)
+            next = timer;
+    }
+    return next;
+}
+
+void kshim_advance(u64 now)
+{
+    struct timer_list *timer;
+
+    /* the timer callbacks see the time they expire at, and may rearm the timers */
+    while ((timer = next_expired(now))) {
+        timer->pending = 0;
+        kshim_time = max(kshim_time, (u64)timer->expires * NSEC_PER_JIFFY);
+        timer->function(timer);
+    }
+    kshim_time = max(kshim_time, now);
+}
@@ -0,0 +1,712 @@
+// SPDX-FileCopyrightText: 2026 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/*
+ * merge_bench, the merge engine in userspace
+ *
+ * event_merge.c is built unchanged against the kernel api in include/, the
+ * events of a trace are fed into it as the sources of the module do, and the
+ * events it notifies are counted as module.c would send them.
+ *
+ *   merge_bench [options] replay <trace|->
+ *   merge_bench [options] synth <rename-chain|storm|untar|mixed|recreate|rmrf> <number>
+ *   merge_bench record > trace
+ *
+ * a trace has one event per line:
+ *
+ *   <ns> <action> <major>:<minor> <cookie> <path>
+ *
+ * ns is the CLOCK_MONOTONIC time of the event, action is one of ACT_* of
+ * vfs_change_consts.h. record reads them from /dev/vfs_monitor, as root, until it is
+ * interrupted, set disable_event_merge to 1 while recording, or the trace
+ * holds the events that have been merged already.
+ *
+ * the time is virtual, it jumps to the time of every event and runs the merge
+ * timers that expire on the way, so a trace of an hour replays in seconds and
+ * the merge windows see the same events as in the kernel.
+ * the cost of an event is measured in real time, from the entry to the return
+ * of the merge, including the timers that expire before it.
+ *
+ * options:
+ *   -b <number>    merge_buffer_size, 256
+ *   -t <ms>        merge_timeout_ms, 100
+ *   -d <number>    merge_dump_size, 10
+ *   -c <number>    burst_collapse_threshold, 64, 0 disables, below -b
+ *   -a             adaptive_event_merge
+ *   -D             disable_event_merge
+ *   -i <ns>        the interval of the synthetic events, 20000
+ *   -o <file>      write the notified events to file, as a trace
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <linux/kdev_t.h>
+
+#include "event_merge.h"
+#include "event.h"
+#include "vfs_change_consts.h"
+#include "vfs_stats.h"
+#include "vfs_ring.h"
+
+/* the tunables of vfs_sysfs.c, with the same defaults */
+int disable_event_merge;
+unsigned int merge_buffer_size = 256;
+unsigned int merge_timeout_ms = 100;
+unsigned int merge_dump_size = 10;
+int adaptive_event_merge;
+unsigned int burst_collapse_threshold = 64;
+
+DEFINE_PER_CPU(struct vfs_stats, vfs_stats);
+
+static const char *action_names[VFS_STAT_ACTIONS] = {
+    "file-created", "link-created", "symlink-created", "dir-created",
+    "file-deleted", "dir-deleted", "file-renamed", "dir-renamed",
+    "file-renamed-from", "file-renamed-to", "dir-renamed-from", "dir-renamed-to",
+    "mounted", "unmounted", "subtree-changed", "file-modified",
+};
+
+static struct {
+    u64 events_in;
+    u64 events_out;
+    u64 out[VFS_STAT_ACTIONS];
+    u64 cost_ns;
+    u64 max_cost_ns;
+    u64 pending_sum;
+    int pending_max;
+} bench;
+
+static int (*merge_entry)(struct vfs_event *event);
+static FILE *output;
+static u64 synth_interval = 20000;
+
+static void recreate_notified(struct vfs_event *event);
+
+static struct vfs_event *do_vfs_event_alloc(const char *path)
+{
+    struct vfs_event *event;
+    size_t len = strlen(path);
+
+    event = malloc(sizeof(struct vfs_event) + len + 1);
+    if (unlikely(!event)) {
+        vfs_stat_inc(alloc_failures);
+        return NULL;
+    }
+
+    event->size_class = VFS_EVENT_SMALL;
+    event->proc_info = NULL;
+    event->mode = 0;
+    event->time = ktime_get_ns();
+    memcpy(event->buf, path, len + 1);
+    event->path = event->buf;
+
+    return event;
+}
+
+struct vfs_event *vfs_event_alloc(const char *path)
+{
+    return do_vfs_event_alloc(path);
+}
+
+struct vfs_event *vfs_event_alloc_atomic(const char *path)
+{
+    return do_vfs_event_alloc(path);
+}
+
+void vfs_event_free(struct vfs_event *event)
+{
+    free(event->proc_info);
+    free(event);
+}
+
+/* the consumer, vfs_notify_events of module.c */
+static int notify_events(struct list_head *events)
+{
+    struct vfs_event *event;
+
+    list_for_each_entry(event, events, list) {
+        ++bench.events_out;
+        if (event->action < VFS_STAT_ACTIONS)
+            ++bench.out[event->action];
+        recreate_notified(event);
+        if (output)
+            fprintf(output, "%llu %u %u:%u %u %s\n", (unsigned long long)event->time, event->action,
+                MAJOR(event->dev), MINOR(event->dev), event->cookie, event->path);
+    }
+    return 0;
+}
+
+static u64 real_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* feed one event at the virtual time ns */
+static int feed_event(u64 ns, unsigned char action, dev_t dev, u32 cookie, const char *path)
+{
+    struct vfs_event *event;
+    u64 start, cost;
+    int pending;
+
+    if (action >= VFS_STAT_ACTIONS || ACT_MOUNT == action || ACT_UNMOUNT == action)
+        return 0;
+
+    start = real_now();
+    kshim_advance(ns);
+    event = vfs_event_alloc(path);
+    if (!event)
+        return -ENOMEM;
+    event->action = action;
+    event->cookie = cookie;
+    event->dev = dev;
+    merge_entry(event);
+    cost = real_now() - start;
+
+    ++bench.events_in;
+    bench.cost_ns += cost;
+    bench.max_cost_ns = max(bench.max_cost_ns, cost);
+    pending = event_merge_pending_number();
+    bench.pending_sum += pending;
+    bench.pending_max = max(bench.pending_max, pending);
+
+    return 0;
+}
+
+static int replay(const char *file)
+{
+    char line[PATH_MAX + 128];
+    FILE *trace = strcmp(file, "-") ? fopen(file, "r") : stdin;
+    unsigned long long ns, base = 0;
+    unsigned int action, major, minor, cookie;
+    int path_at, lineno = 0;
+    char *path;
+
+    if (!trace) {
+        fprintf(stderr, "open %s failed: %s\n", file, strerror(errno));
+        return 1;
+    }
+
+    while (fgets(line, sizeof(line), trace)) {
+        ++lineno;
+        if ('#' == line[0] || '\n' == line[0])
+            continue;
+        if (sscanf(line, "%llu %u %u:%u %u %n", &ns, &action, &major, &minor, &cookie, &path_at) != 5 || !line[path_at]) {
+            fprintf(stderr, "invalid event at line %d\n", lineno);
+            continue;
+        }
+        path = line + path_at;
+        path[strcspn(path, "\n")] = 0;
+        /* the trace starts at the virtual time 0 */
+        if (!base)
+            base = ns;
+        if (feed_event(ns >= base ? ns - base : 0, action, MKDEV(major, minor), cookie, path))
+            break;
+    }
+
+    if (trace != stdin)
+        fclose(trace);
+    return 0;
+}
+
+/*
+ * synthetic traces
+ *
+ * rename-chain: a file is created and renamed 15 times, as an editor or a
+ *               downloader does, the merge leaves the create of the last name
+ * storm:        temporary files are created and deleted in one folder, the
+ *               merge leaves nothing
+ * untar:        files are created in folders of 500, the burst collapse leaves
+ *               a summary per folder
+ * mixed:        the three of them interleaved, on 4 devices
+ * recreate:     files are created in folders of 200, then 50 of them are
+ *               deleted and created again each, all of them exist at the end.
+ *               the notified events are checked, a create after the delete of
+ *               the same file must not be absorbed into the summary of the
+ *               folder, the exit code is 1 if the index would miss a file
+ * rmrf:         folders of 100 files that exist before the trace are deleted
+ *               with rm -r, the merge leaves the delete of each folder
+ */
+#define SYNTH_DEV MKDEV(8, 1)
+#define RENAME_CHAIN 16
+#define UNTAR_FOLDER 500
+#define RECREATE_FILES 200
+#define RECREATE_AGAIN 50
+#define RECREATE_FOLDER (1 + RECREATE_FILES + 2 * RECREATE_AGAIN)
+#define RMRF_FILES 100
+
+struct synth {
+    u64 ns;
+    u32 cookie;
+    unsigned int number;
+};
+
+static int synth_event(struct synth *s, unsigned char action, dev_t dev, u32 cookie, const char *path)
+{
+    s->ns += synth_interval;
+    ++s->number;
+    return feed_event(s->ns, action, dev, cookie, path);
+}
+
+static int synth_rename(struct synth *s, dev_t dev, const char *from, const char *to)
+{
+    int ret;
+
+    ++s->cookie;
+    ret = synth_event(s, ACT_RENAME_FROM_FILE, dev, s->cookie, from);
+    if (!ret)
+        ret = synth_event(s, ACT_RENAME_TO_FILE, dev, s->cookie, to);
+    return ret;
+}
+
+/* one step of every pattern, i is the step */
+static int synth_rename_chain(struct synth *s, dev_t dev, unsigned int i)
+{
+    char from[64], to[64];
+    unsigned int chain = i / RENAME_CHAIN, step = i % RENAME_CHAIN;
+
+    snprintf(to, sizeof(to), "/bench/rename/%u.%u", chain, step);
+    if (!step)
+        return synth_event(s, ACT_NEW_FILE, dev, 0, to);
+    snprintf(from, sizeof(from), "/bench/rename/%u.%u", chain, step - 1);
+    return synth_rename(s, dev, from, to);
+}
+
+static int synth_storm(struct synth *s, dev_t dev, unsigned int i)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), "/bench/storm/tmp%u", i / 2);
+    return synth_event(s, i % 2 ? ACT_DEL_FILE : ACT_NEW_FILE, dev, 0, path);
+}
+
+static int synth_rmrf(struct synth *s, dev_t dev, unsigned int i)
+{
+    char path[64];
+
+    if (i % (RMRF_FILES + 1) == RMRF_FILES) {
+        snprintf(path, sizeof(path), "/bench/rmrf/%u", i / (RMRF_FILES + 1));
+        return synth_event(s, ACT_DEL_FOLDER, dev, 0, path);
+    }
+    snprintf(path, sizeof(path), "/bench/rmrf/%u/file%u", i / (RMRF_FILES + 1), i % (RMRF_FILES + 1));
+    return synth_event(s, ACT_DEL_FILE, dev, 0, path);
+}
+
+static int synth_untar(struct synth *s, dev_t dev, unsigned int i)
+{
+    char path[64];
+
+    if (!(i % (UNTAR_FOLDER + 1))) {
+        snprintf(path, sizeof(path), "/bench/untar/%u", i / (UNTAR_FOLDER + 1));
+        return synth_event(s, ACT_NEW_FOLDER, dev, 0, path);
+    }
+    snprintf(path, sizeof(path), "/bench/untar/%u/file%u", i / (UNTAR_FOLDER + 1), i % (UNTAR_FOLDER + 1));
+    return synth_event(s, ACT_NEW_FILE, dev, 0, path);
+}
+
+/*
+ * the index of the daemon as the notified events build it, a file per byte.
+ * the daemon queues the rescan of a summary before the events after it, the
+ * rescan is taken as adding every file of the folder at that point.
+ */
+static unsigned char *recreate_index;
+static unsigned int recreate_folders;
+static unsigned int recreate_complete;
+
+static int synth_recreate(struct synth *s, dev_t dev, unsigned int i)
+{
+    char path[64];
+    unsigned int folder = i / RECREATE_FOLDER, step = i % RECREATE_FOLDER;
+
+    if (!step) {
+        recreate_index = realloc(recreate_index, (size_t)(folder + 1) * RECREATE_FILES);
+        if (!recreate_index)
+            return -ENOMEM;
+        memset(recreate_index + (size_t)folder * RECREATE_FILES, 0, RECREATE_FILES);
+        recreate_folders = folder + 1;
+        snprintf(path, sizeof(path), "/bench/recreate/%u", folder);
+        return synth_event(s, ACT_NEW_FOLDER, dev, 0, path);
+    }
+    if (step <= RECREATE_FILES) {
+        snprintf(path, sizeof(path), "/bench/recreate/%u/file%u", folder, step - 1);
+        return synth_event(s, ACT_NEW_FILE, dev, 0, path);
+    }
+    step -= RECREATE_FILES + 1;
+    if (step == 2 * RECREATE_AGAIN - 1)
+        recreate_complete = folder + 1;
+    snprintf(path, sizeof(path), "/bench/recreate/%u/file%u", folder, step / 2);
+    return synth_event(s, step % 2 ? ACT_NEW_FILE : ACT_DEL_FILE, dev, 0, path);
+}
+
+static void recreate_notified(struct vfs_event *event)
+{
+    unsigned int folder, file;
+    int len = 0;
+
+    if (!recreate_index)
+        return;
+    if (!strcmp(event->path, "/bench/recreate")) {
+        if (ACT_SUBTREE_CHANGED == event->action)
+            memset(recreate_index, 1, (size_t)recreate_folders * RECREATE_FILES);
+        return;
+    }
+    if (sscanf(event->path, "/bench/recreate/%u%n", &folder, &len) != 1 || folder >= recreate_folders)
+        return;
+    if (!event->path[len]) {
+        if (ACT_SUBTREE_CHANGED == event->action)
+            memset(recreate_index + (size_t)folder * RECREATE_FILES, 1, RECREATE_FILES);
+        return;
+    }
+    if (sscanf(event->path + len, "/file%u", &file) != 1 || file >= RECREATE_FILES)
+        return;
+    if (event->action <= ACT_NEW_FOLDER)
+        recreate_index[(size_t)folder * RECREATE_FILES + file] = 1;
+    else if (ACT_DEL_FILE == event->action)
+        recreate_index[(size_t)folder * RECREATE_FILES + file] = 0;
+}
+
+/* the files the index misses, of the folders fed in full, after the unload */
+static int recreate_check(void)
+{
+    unsigned long missing = 0;
+    size_t j;
+
+    for (j = 0; j < (size_t)recreate_complete * RECREATE_FILES; ++j)
+        missing += !recreate_index[j];
+    printf("recreate: %lu of %u files missing from the index\n", missing, recreate_complete * RECREATE_FILES);
+    free(recreate_index);
+    recreate_index = NULL;
+    return missing ? 1 : 0;
+}
+
+static int synth(const char *pattern, unsigned int number)
+{
+    struct synth s = {0};
+    unsigned int i[3] = {0};
+    unsigned int seed = 1;
+    int ret = 0;
+
+    while (!ret && s.number < number) {
+        if (!strcmp(pattern, "rename-chain")) {
+            ret = synth_rename_chain(&s, SYNTH_DEV, i[0]++);
+        } else if (!strcmp(pattern, "storm")) {
+            ret = synth_storm(&s, SYNTH_DEV, i[0]++);
+        } else if (!strcmp(pattern, "untar")) {
+            ret = synth_untar(&s, SYNTH_DEV, i[0]++);
+        } else if (!strcmp(pattern, "recreate")) {
+            ret = synth_recreate(&s, SYNTH_DEV, i[0]++);
+        } else if (!strcmp(pattern, "rmrf")) {
+            ret = synth_rmrf(&s, SYNTH_DEV, i[0]++);
+        } else if (!strcmp(pattern, "mixed")) {
+            dev_t dev = MKDEV(8, rand_r(&seed) % 4 + 1);
+
+            switch (rand_r(&seed) % 3) {
+            case 0:
+                ret = synth_rename_chain(&s, dev, i[0]++);
+                break;
+            case 1:
+                ret = synth_storm(&s, dev, i[1]++);
+                break;
+            default:
+                ret = synth_untar(&s, dev, i[2]++);
+                break;
+            }
+        } else {
+            fprintf(stderr, "unknown pattern %s\n", pattern);
+            return 1;
+        }
+    }
+    return ret ? 1 : 0;
+}
+
+
+/* the ring reader of the daemon, see event_listenser::read_ring() */
+static volatile sig_atomic_t recording = 1;
+
+static void stop_recording(int sig)
+{
+    recording = 0;
+}
+
+/* a record with its position in its ring */
+struct ring_record {
+    const struct vfs_ring_record *record;
+    u64 position;
+    u32 ring;
+};
+
+static int compare_record_seq(const void *a, const void *b)
+{
+    const struct vfs_ring_record *ra = ((const struct ring_record *)a)->record;
+    const struct vfs_ring_record *rb = ((const struct ring_record *)b)->record;
+
+    return ra->seq < rb->seq ? -1 : ra->seq > rb->seq;
+}
+
+static struct vfs_ring_header *ring_header(char *area, const struct vfs_ring_info *info, u32 ring)
+{
+    return (struct vfs_ring_header *)(area + info->ring_offset + (size_t)ring * info->ring_stride);
+}
+
+/*
+ * collect the published records of ring, return the new tail. last_seq is
+ * raised to the seqs of the records below first_head, as the daemon does
+ */
+static u64 read_ring(char *area, const struct vfs_ring_info *info, u32 ring, u64 first_head,
+    u64 *last_seq, struct ring_record **records, size_t *number, size_t *capacity)
+{
+    struct vfs_ring_header *header = ring_header(area, info, ring);
+    const char *data = (const char *)header + info->data_offset;
+    u64 head = atomic_load_explicit((_Atomic u64 *)&header->head, memory_order_acquire);
+    u64 tail = header->tail;
+
+    while (tail < head) {
+        u32 offset = tail & (info->data_size - 1);
+        u32 contiguous = info->data_size - offset;
+        const struct vfs_ring_record *record = (const void *)(data + offset);
+
+        /* too short to hold a record, the kernel wraps without a pad record */
+        if (contiguous < sizeof(struct vfs_ring_record)) {
+            tail += contiguous;
+            continue;
+        }
+        if (record->len < sizeof(struct vfs_ring_record) || record->len > contiguous || record->len % VFS_RING_ALIGN) {
+            fprintf(stderr, "invalid record in ring %u, length: %u\n", ring, record->len);
+            return head;
+        }
+        if (record->action != VFS_RING_ACT_PAD && memchr(record->path, 0, record->len - sizeof(struct vfs_ring_record))) {
+            if (*number == *capacity) {
+                *capacity = *capacity ? *capacity * 2 : 1024;
+                *records = realloc(*records, *capacity * sizeof(**records));
+                if (!*records)
+                    abort();
+            }
+            (*records)[(*number)++] = (struct ring_record){ record, tail, ring };
+            if (tail + record->len <= first_head && record->seq > *last_seq)
+                *last_seq = record->seq;
+        }
+        tail += record->len;
+    }
+    return tail;
+}
+
+static int record(void)
+{
+    struct ring_record *records = NULL;
+    const struct vfs_ring_record *record;
+    size_t number, capacity = 0, i;
+    long page_size = sysconf(_SC_PAGESIZE);
+    struct vfs_ring_info info;
+    struct pollfd pfd;
+    u64 *tails, *heads, *lost, last_seq;
+    char *area;
+    void *page;
+    u32 ring;
+    int fd;
+
+    fd = open("/dev/" VFS_RING_DEVICE_NAME, O_RDWR | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "open /dev/" VFS_RING_DEVICE_NAME " failed: %s\n", strerror(errno));
+        return 1;
+    }
+    page = mmap(NULL, page_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (page == MAP_FAILED) {
+        fprintf(stderr, "map the ring info failed: %s\n", strerror(errno));
+        close(fd);
+        return 1;
+    }
+    info = *(struct vfs_ring_info *)page;
+    munmap(page, page_size);
+    if (info.version != VFS_RING_VERSION || !info.ring_count || !info.data_size || (info.data_size & (info.data_size - 1))) {
+        fprintf(stderr, "unsupported ring buffer, version: %u\n", info.version);
+        close(fd);
+        return 1;
+    }
+    area = mmap(NULL, info.area_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (area == MAP_FAILED) {
+        fprintf(stderr, "map the ring buffer failed: %s\n", strerror(errno));
+        close(fd);
+        return 1;
+    }
+    tails = calloc(info.ring_count, sizeof(*tails));
+    heads = calloc(info.ring_count, sizeof(*heads));
+    lost = calloc(info.ring_count, sizeof(*lost));
+    if (!tails || !heads || !lost)
+        abort();
+
+    signal(SIGINT, stop_recording);
+    signal(SIGTERM, stop_recording);
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (recording) {
+        if (poll(&pfd, 1, 1000) < 0 && errno != EINTR)
+            break;
+
+        number = 0;
+        last_seq = 0;
+        for (ring = 0; ring < info.ring_count; ++ring)
+            heads[ring] = atomic_load_explicit((_Atomic u64 *)&ring_header(area, &info, ring)->head, memory_order_acquire);
+        for (ring = 0; ring < info.ring_count; ++ring) {
+            struct vfs_ring_header *header = ring_header(area, &info, ring);
+
+            if (header->lost != lost[ring]) {
+                fprintf(stderr, "%llu events lost in ring %u\n", (unsigned long long)(header->lost - lost[ring]), ring);
+                lost[ring] = header->lost;
+            }
+            tails[ring] = read_ring(area, &info, ring, heads[ring], &last_seq, &records, &number, &capacity);
+        }
+
+        /* records of different rings are ordered by their global seq */
+        qsort(records, number, sizeof(*records), compare_record_seq);
+        for (i = 0; i < number; ++i) {
+            record = records[i].record;
+            /* the seqs of a ring grow, the rest of the ring is read again */
+            if (record->seq > last_seq) {
+                if (records[i].position < tails[records[i].ring])
+                    tails[records[i].ring] = records[i].position;
+                continue;
+            }
+            if (VFS_RING_ACT_LOST == record->action) {
+                fprintf(stderr, "events of %u:%u lost\n", record->major, record->minor);
+                continue;
+            }
+            printf("%llu %u %u:%u %u %s\n", (unsigned long long)record->time, record->action,
+                record->major, record->minor, record->cookie, record->path);
+        }
+        fflush(stdout);
+
+        /* give the space back to the kernel after the records are written */
+        for (ring = 0; ring < info.ring_count; ++ring)
+            atomic_store_explicit((_Atomic u64 *)&ring_header(area, &info, ring)->tail, tails[ring], memory_order_release);
+    }
+
+    free(records);
+    free(tails);
+    free(heads);
+    free(lost);
+    munmap(area, info.area_size);
+    close(fd);
+    return 0;
+}
+
+static void report(void)
+{
+    unsigned long total = 0;
+    int i;
+
+    printf("events in:          %llu\n", (unsigned long long)bench.events_in);
+    printf("events out:         %llu\n", (unsigned long long)bench.events_out);
+    printf("merge ratio:        %.2f%%\n",
+        bench.events_in ? 100.0 * (bench.events_in - bench.events_out) / bench.events_in : 0.0);
+    printf("buffer occupancy:   avg %.1f, max %d\n",
+        bench.events_in ? (double)bench.pending_sum / bench.events_in : 0.0, bench.pending_max);
+    printf("cost per event:     avg %.0f ns, max %llu ns\n",
+        bench.events_in ? (double)bench.cost_ns / bench.events_in : 0.0, (unsigned long long)bench.max_cost_ns);
+
+    printf("\n%-20s %12s %12s %12s\n", "action", "seen", "merged", "out");
+    for (i = 0; i < VFS_STAT_ACTIONS; ++i) {
+        if (!vfs_stats.actions[VFS_STAT_SEEN][i] && !vfs_stats.actions[VFS_STAT_MERGED][i] && !bench.out[i])
+            continue;
+        printf("%-20s %12lu %12lu %12llu\n", action_names[i], vfs_stats.actions[VFS_STAT_SEEN][i],
+            vfs_stats.actions[VFS_STAT_MERGED][i], (unsigned long long)bench.out[i]);
+    }
+
+    /* the residence in the buffer, in virtual time */
+    for (i = 0; i < VFS_RESIDENCE_BUCKETS; ++i)
+        total += vfs_stats.residence[i];
+    if (!total)
+        return;
+    printf("\n%-20s %12s\n", "residence (us)", "events");
+    for (i = 0; i < VFS_RESIDENCE_BUCKETS; ++i) {
+        if (vfs_stats.residence[i])
+            printf("[%8lu, %8lu) %12lu\n", i ? 1UL << i : 0, 1UL << (i + 1), vfs_stats.residence[i]);
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-b buffer_size] [-t timeout_ms] [-d dump_size] [-c burst_threshold] [-a] [-D]\n"
+        "       [-i interval_ns] [-o output] <replay <trace|-> | synth <pattern> <number> | record>\n"
+        "patterns: rename-chain, storm, untar, mixed, recreate, rmrf\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *command;
+    int opt, ret;
+
+    while ((opt = getopt(argc, argv, "b:t:d:c:aDi:o:h")) != -1) {
+        switch (opt) {
+        case 'b':
+            merge_buffer_size = clamp(strtoul(optarg, NULL, 0), 1UL, 4096UL);
+            break;
+        case 't':
+            merge_timeout_ms = clamp(strtoul(optarg, NULL, 0), 1UL, 10000UL);
+            break;
+        case 'd':
+            merge_dump_size = clamp(strtoul(optarg, NULL, 0), 1UL, 4096UL);
+            break;
+        case 'c':
+            burst_collapse_threshold = min(strtoul(optarg, NULL, 0), 4096UL);
+            break;
+        case 'a':
+            adaptive_event_merge = 1;
+            break;
+        case 'D':
+            disable_event_merge = 1;
+            break;
+        case 'i':
+            synth_interval = strtoull(optarg, NULL, 0);
+            break;
+        case 'o':
+            output = fopen(optarg, "w");
+            if (!output) {
+                fprintf(stderr, "open %s failed: %s\n", optarg, strerror(errno));
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    /* vfs_sysfs.c rejects a threshold the creates in the buffer never reach */
+    burst_collapse_threshold = min(burst_collapse_threshold, merge_buffer_size - 1);
+
+    command = argv[optind];
+    if (!strcmp(command, "record"))
+        return record();
+
+    merge_entry = get_event_merge_entry(notify_events);
+    if (!strcmp(command, "replay") && optind + 1 < argc) {
+        ret = replay(argv[optind + 1]);
+    } else if (!strcmp(command, "synth") && optind + 2 < argc) {
+        ret = synth(argv[optind + 1], strtoul(argv[optind + 2], NULL, 0));
+    } else {
+        usage(argv[0]);
+        return 1;
+    }
+    /* the rest of the buffer is notified as the module is unloaded */
+    clearup_event_merge();
+
+    if (output)
+        fclose(output);
+    report();
+    if (!ret && recreate_index)
+        ret = recreate_check();
+    return ret;
+}
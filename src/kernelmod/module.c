@@ -11,10 +11,50 @@
 #include "vfs_sysfs.h"
 #include "event.h"
 #include "vfs_kgenl.h"
+#include "vfs_kring.h"
 #include "vfs_fsnotify.h"
 #include "vfs_kretprobes.h"
+#include "vfs_fprobe.h"
 #include "event_merge.h"
 #include "vfs_trace_process.h"
+#include "vfs_dev_seq.h"
+
+/* the events go to the rings of the ring consumers and to the genl listeners */
+static int vfs_notify_events(struct list_head *events)
+{
+    /* both transports carry the same seqs */
+    vfs_dev_seq_assign(events);
+    vfs_ring_notify_vfs_events(events);
+    return vfs_notify_vfs_events(events);
+}
+
+#ifndef CONFIG_FSNOTIFY_BROADCAST
+/* fprobe if the kernel has it, or kretprobes */
+static int use_fprobe;
+
+static int init_vfs_probes(void *vfs_changed_func, char **events_source)
+{
+    int ret = init_vfs_fprobe(vfs_changed_func);
+    if (ret == 0) {
+        use_fprobe = 1;
+        *events_source = "fprobe";
+        return 0;
+    }
+    if (ret != -EOPNOTSUPP)
+        mpr_info("init_vfs_fprobe fail: %d, fall back to kretprobes\n", ret);
+
+    *events_source = "kretprobes";
+    return init_vfs_kretprobes(vfs_changed_func);
+}
+
+static void cleanup_vfs_probes(void)
+{
+    if (use_fprobe)
+        cleanup_vfs_fprobe();
+    else
+        cleanup_vfs_kretprobes();
+}
+#endif
 
 int __init vfs_monitor_init_module(void)
 {
@@ -23,7 +63,7 @@ int __init vfs_monitor_init_module(void)
     char *events_source;
     void *vfs_changed_func;
 
-    notify_solution = "genl";
+    notify_solution = "ring+genl";
 #ifdef CONFIG_FSNOTIFY_BROADCAST
     events_source = "fsnotify_broadcast";
 #else
@@ -38,11 +78,15 @@ int __init vfs_monitor_init_module(void)
     if (ret)
         goto init_vfs_event_cache_quit;
 
-    vfs_changed_func = vfs_notify_vfs_event;
+    vfs_changed_func = vfs_notify_events;
     ret = init_vfs_genl();
     if (ret)
         goto init_vfs_genl_fail;
 
+    ret = init_vfs_ring();
+    if (ret)
+        goto init_vfs_ring_fail;
+
     vfs_changed_func = get_event_merge_entry(vfs_changed_func);
     vfs_changed_func = vfs_get_trace_process_entry(vfs_changed_func);
 #ifdef CONFIG_FSNOTIFY_BROADCAST
@@ -50,7 +94,7 @@ int __init vfs_monitor_init_module(void)
     if (ret)
         goto init_event_source_fail;
 #else
-    ret = init_vfs_kretprobes(vfs_changed_func);
+    ret = init_vfs_probes(vfs_changed_func, &events_source);
     if (ret)
         goto init_event_source_fail;
 #endif
@@ -59,6 +103,10 @@ int __init vfs_monitor_init_module(void)
 	return 0;
 
 init_event_source_fail:
+    cleanup_vfs_trace_process();
+    cleanup_vfs_ring();
+    cleanup_vfs_dev_seq();
+init_vfs_ring_fail:
     cleanup_vfs_genl();
 init_vfs_genl_fail:
     cleanup_vfs_event_cache();
@@ -74,14 +122,17 @@ void __exit vfs_monitor_cleanup_module(void)
 #ifdef CONFIG_FSNOTIFY_BROADCAST
     cleanup_vfs_fsnotify();
 #else
-    cleanup_vfs_kretprobes();
+    cleanup_vfs_probes();
 #endif
 
     /* Wait for no events to come in and send all events in the buffer */
     msleep(150);
 
     clearup_event_merge();
+    cleanup_vfs_trace_process();
+    cleanup_vfs_ring();
     cleanup_vfs_genl();
+    cleanup_vfs_dev_seq();
     cleanup_vfs_event_cache();
     vfs_exit_sysfs();
 
@@ -19,3 +19,7 @@
 #define ACT_RENAME_TO_FOLDER	11
 #define ACT_MOUNT	            12
 #define ACT_UNMOUNT	            13
+/* files are created under the folder in a burst, the events are collapsed into this one */
+#define ACT_SUBTREE_CHANGED	    14
+/* the file is written, the writes within the window are coalesced into this one */
+#define ACT_MODIFY_FILE	        15
@@ -0,0 +1,70 @@
+// SPDX-FileCopyrightText: 2026 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/hashtable.h>
+
+#include "vfs_dev_seq.h"
+#include "event.h"
+
+#define DEV_SEQ_HASH_BITS 5
+
+/* the entries live until the module exits, there are only a few devices */
+struct dev_seq {
+    struct hlist_node node;
+    dev_t dev;
+    u64 seq;
+};
+
+static DEFINE_HASHTABLE(dev_seqs, DEV_SEQ_HASH_BITS);
+static DEFINE_SPINLOCK(dev_seqs_lock);
+
+static struct dev_seq *get_dev_seq(dev_t dev)
+{
+    struct dev_seq *s;
+
+    hash_for_each_possible(dev_seqs, s, node, dev) {
+        if (s->dev == dev)
+            return s;
+    }
+
+    s = kmalloc(sizeof(*s), GFP_ATOMIC);
+    if (!s)
+        return NULL;
+    s->dev = dev;
+    s->seq = 0;
+    hash_add(dev_seqs, &s->node, dev);
+
+    return s;
+}
+
+void vfs_dev_seq_assign(struct list_head *events)
+{
+    struct vfs_event *event;
+    struct dev_seq *s = NULL;
+    unsigned long flags;
+
+    spin_lock_irqsave(&dev_seqs_lock, flags);
+    list_for_each_entry(event, events, list) {
+        /* the events of a list mostly come from one device */
+        if (!s || s->dev != event->dev)
+            s = get_dev_seq(event->dev);
+        event->seq = s ? ++s->seq : 0;
+    }
+    spin_unlock_irqrestore(&dev_seqs_lock, flags);
+}
+
+void cleanup_vfs_dev_seq(void)
+{
+    struct dev_seq *s;
+    struct hlist_node *next;
+    int bkt;
+
+    hash_for_each_safe(dev_seqs, bkt, next, s, node) {
+        hash_del(&s->node);
+        kfree(s);
+    }
+}
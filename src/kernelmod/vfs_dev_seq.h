@@ -0,0 +1,73 @@
+// SPDX-FileCopyrightText: 2026 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef VFS_DEV_SEQ_H
+#define VFS_DEV_SEQ_H
+
+#include <linux/types.h>
+#include <linux/list.h>
+
+/*
+ * per device sequence numbers
+ *
+ * every notified event gets the next seq of its device, starting from 1,
+ * a consumer that finds a hole in the seqs of a device knows that events of
+ * the device are lost, 0 means the event has no seq.
+ */
+void vfs_dev_seq_assign(struct list_head *events);
+void cleanup_vfs_dev_seq(void);
+
+/*
+ * devices whose events are lost by a transport, the transport tells the
+ * consumer with a lost marker when it has room again.
+ * when more than VFS_LOST_DEVS devices lose events, the marker is for all
+ * devices.
+ * the caller serializes the access.
+ */
+#define VFS_LOST_DEVS 8
+
+struct vfs_lost_devs {
+    int count;
+    int overflow;
+    dev_t devs[VFS_LOST_DEVS];
+    u64 seqs[VFS_LOST_DEVS];    /* the seq of the last lost event */
+};
+
+static inline void vfs_lost_devs_add(struct vfs_lost_devs *lost, dev_t dev, u64 seq)
+{
+    int i;
+
+    if (lost->overflow)
+        return;
+
+    for (i = 0; i < lost->count; ++i) {
+        if (lost->devs[i] == dev) {
+            if (seq > lost->seqs[i])
+                lost->seqs[i] = seq;
+            return;
+        }
+    }
+
+    if (lost->count == VFS_LOST_DEVS) {
+        lost->overflow = 1;
+        return;
+    }
+    lost->devs[lost->count] = dev;
+    lost->seqs[lost->count] = seq;
+    ++lost->count;
+}
+
+/* drop the first n devices, the markers of them are sent */
+static inline void vfs_lost_devs_drop(struct vfs_lost_devs *lost, int n)
+{
+    int i;
+
+    for (i = n; i < lost->count; ++i) {
+        lost->devs[i - n] = lost->devs[i];
+        lost->seqs[i - n] = lost->seqs[i];
+    }
+    lost->count -= n;
+}
+
+#endif
@@ -0,0 +1,252 @@
+// SPDX-FileCopyrightText: 2026 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/errno.h>
+
+#include "vfs_fprobe.h"
+
+#ifdef VFS_FPROBE
+
+#include <linux/fprobe.h>
+#include <linux/dcache.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/path.h>
+#include <linux/fs.h>
+
+#include "arg_extractor.h"
+#include "vfs_change_consts.h"
+#include "event.h"
+#include "vfs_probe.h"
+
+/*
+ * fprobe is built on ftrace, an entry costs a call from the patched nop
+ * instead of a breakpoint trap, and the return is hooked only for the calls
+ * whose entry handler returns 0.
+ * there are no tracepoints on these vfs functions, so fprobe is the cheapest
+ * way to hook them without patching the kernel.
+ *
+ * the arguments are taken by their position (starting from 1), as in vfs_kretprobes.c.
+ * fprobe is in the kernels >= 5.18, but it is used on the kernels >= 6.5 only,
+ * see vfs_fprobe.h: the handlers keep the dentry of the entry for the return in
+ * the entry data, and skip the return by the value of the entry handler, both
+ * since 6.5. so only the new vfs api is handled.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+/* fprobe is on fgraph, the handlers get the ftrace regs */
+typedef struct ftrace_regs fprobe_regs_t;
+#define fprobe_arg(regs, n) ftrace_regs_get_argument(regs, (n) - 1)
+#define fprobe_ret(regs) ftrace_regs_get_return_value(regs)
+#else
+typedef struct pt_regs fprobe_regs_t;
+#define fprobe_arg(regs, n) get_arg(regs, n)
+#define fprobe_ret(regs) regs_return_value(regs)
+#endif
+
+#define DECL_FP_HANDLER(name) name(struct fprobe *fp, unsigned long entry_ip, unsigned long ret_ip,\
+    fprobe_regs_t *regs, void *data)
+
+/* the dir name is too large for the entry data, it is allocated by the entry handler */
+static int DECL_FP_HANDLER(on_path_mount_ent)
+{
+    char *buf, *dir_name;
+
+    buf = kmalloc(NAME_MAX, GFP_ATOMIC);
+    if (unlikely(!buf))
+        return 1;
+
+    /* int path_mount(const char *dev_name, struct path *path, ...) */
+    dir_name = d_path((struct path *)fprobe_arg(regs, 2), buf, NAME_MAX);
+    if (IS_ERR(dir_name)) {
+        mpr_info("on_path_mount_ent get mount dir fail\n");
+        kfree(buf);
+        return 1;
+    }
+    memmove(buf, dir_name, strlen(dir_name) + 1);
+    *(char **)data = buf;
+
+    return 0;
+}
+
+static void DECL_FP_HANDLER(on_path_mount_ret)
+{
+    char *dir_name = *(char **)data;
+
+    vfs_probe_mount_ret(dir_name, fprobe_ret(regs));
+    kfree(dir_name);
+}
+
+static int DECL_FP_HANDLER(on_path_umount_ent)
+{
+    char *buf, *dir_name;
+
+    buf = kmalloc(NAME_MAX, GFP_ATOMIC);
+    if (unlikely(!buf))
+        return 1;
+
+#if defined(CONFIG_SW64)
+    buf[0] = '\0';
+#else
+    /* int path_umount(struct path *path, int flags) */
+    dir_name = d_path((struct path *)fprobe_arg(regs, 1), buf, NAME_MAX);
+    if (IS_ERR(dir_name)) {
+        mpr_info("on_path_umount_ent get umount dir fail\n");
+        kfree(buf);
+        return 1;
+    }
+    memmove(buf, dir_name, strlen(dir_name) + 1);
+#endif
+    *(char **)data = buf;
+
+    return 0;
+}
+
+static void DECL_FP_HANDLER(on_path_umount_ret)
+{
+    char *dir_name = *(char **)data;
+
+    vfs_probe_umount_ret(dir_name, fprobe_ret(regs));
+    kfree(dir_name);
+}
+
+#define DECL_CMN_FP(fn, size) static struct fprobe fn##_fp = {\
+        .entry_handler   = on_##fn##_ent,\
+        .exit_handler    = on_##fn##_ret,\
+        .entry_data_size = size,\
+    };
+
+DECL_CMN_FP(path_mount, sizeof(char *));
+DECL_CMN_FP(path_umount, sizeof(char *));
+
+#define _DECL_VFS_FP(fn, act, de_i, ret_fn) static int DECL_FP_HANDLER(on_##fn##_ent)\
+    {\
+        return vfs_probe_dentry_ent((struct vfs_probe_dentry_data *)data, (struct dentry *)fprobe_arg(regs, de_i), act);\
+    }\
+    \
+    static void DECL_FP_HANDLER(on_##fn##_ret)\
+    {\
+        ret_fn;\
+    }\
+    \
+    DECL_CMN_FP(fn, sizeof(struct vfs_probe_dentry_data))
+
+#define DECL_VFS_FP(fn, act, de_i) \
+    _DECL_VFS_FP(fn, act, de_i, vfs_probe_dentry_ret((struct vfs_probe_dentry_data *)data, fprobe_ret(regs), act))
+
+// int vfs_create(struct mnt_idmap *, struct inode *, struct dentry *, umode_t, bool);
+// int vfs_unlink(struct mnt_idmap *, struct inode *, struct dentry *, struct inode **);
+// int vfs_mkdir(struct mnt_idmap *, struct inode *, struct dentry *, umode_t);
+//     struct dentry * since 6.15, see vfs_probe_mkdir_ret()
+// int vfs_rmdir(struct mnt_idmap *, struct inode *, struct dentry *);
+// int vfs_symlink(struct mnt_idmap *, struct inode *, struct dentry *, const char *);
+// int security_inode_create(struct inode *dir, struct dentry *dentry, umode_t mode);
+// int vfs_link(struct dentry *, struct mnt_idmap *, struct inode *, struct dentry *, struct inode **);
+DECL_VFS_FP(vfs_create, ACT_NEW_FILE, 3);
+DECL_VFS_FP(vfs_unlink, ACT_DEL_FILE, 3);
+_DECL_VFS_FP(vfs_mkdir, ACT_NEW_FOLDER, 3, vfs_probe_mkdir_ret((struct vfs_probe_dentry_data *)data, fprobe_ret(regs)));
+DECL_VFS_FP(vfs_rmdir, ACT_DEL_FOLDER, 3);
+DECL_VFS_FP(vfs_symlink, ACT_NEW_SYMLINK, 3);
+DECL_VFS_FP(security_inode_create, ACT_NEW_FILE, 2);
+// select dest(4) dentry, not src(1) dentry
+DECL_VFS_FP(vfs_link, ACT_NEW_LINK, 4);
+
+struct vfs_rename_data {
+    struct vfs_event *fe;
+    struct vfs_event *te;
+};
+
+static int DECL_FP_HANDLER(on_vfs_rename_ent)
+{
+    struct vfs_rename_data *rename_data = (struct vfs_rename_data *)data;
+    /* int vfs_rename(struct renamedata *); */
+    struct renamedata *renamedata = (struct renamedata *)fprobe_arg(regs, 1);
+
+    return vfs_probe_rename_ent(&rename_data->fe, &rename_data->te,
+        renamedata->old_dentry, renamedata->new_dentry);
+}
+
+static void DECL_FP_HANDLER(on_vfs_rename_ret)
+{
+    struct vfs_rename_data *rename_data = (struct vfs_rename_data *)data;
+
+    vfs_probe_rename_ret(&rename_data->fe, &rename_data->te, fprobe_ret(regs));
+}
+
+DECL_CMN_FP(vfs_rename, sizeof(struct vfs_rename_data));
+
+static struct {
+    struct fprobe *fp;
+    const char *symbol;
+} vfs_fps[] = {
+    {&path_mount_fp, "path_mount"}, {&path_umount_fp, "path_umount"},
+    {&vfs_create_fp, "vfs_create"}, {&vfs_unlink_fp, "vfs_unlink"},
+    {&vfs_mkdir_fp, "vfs_mkdir"}, {&vfs_rmdir_fp, "vfs_rmdir"},
+    {&vfs_symlink_fp, "vfs_symlink"}, {&vfs_link_fp, "vfs_link"},
+    {&vfs_rename_fp, "vfs_rename"}, {&security_inode_create_fp, "security_inode_create"},
+};
+
+int init_vfs_fprobe(void *vfs_changed_func)
+{
+    int ret, i;
+
+    vfs_probe_init(vfs_changed_func);
+    for (i = 0; i < ARRAY_SIZE(vfs_fps); ++i) {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 14, 0)
+        /* the return is hooked by rethook, which has a pool of instances like kretprobe */
+        vfs_fps[i].fp->nr_maxactive = vfs_probe_maxactive();
+#endif
+        ret = register_fprobe(vfs_fps[i].fp, vfs_fps[i].symbol, NULL);
+        if (ret) {
+            mpr_info("register_fprobe %s failed, returned %d\n", vfs_fps[i].symbol, ret);
+            goto fail;
+        }
+    }
+    mpr_info("register_fprobe %ld ok\n", ARRAY_SIZE(vfs_fps));
+
+    return 0;
+
+fail:
+    while (i--)
+        unregister_fprobe(vfs_fps[i].fp);
+    return ret;
+}
+
+unsigned long vfs_fprobe_nmissed(void)
+{
+    unsigned long nmissed = 0;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(vfs_fps); ++i)
+        nmissed += vfs_fps[i].fp->nmissed;
+
+    return nmissed;
+}
+
+void cleanup_vfs_fprobe(void)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(vfs_fps); ++i)
+        unregister_fprobe(vfs_fps[i].fp);
+}
+
+#else
+
+int init_vfs_fprobe(void *vfs_changed_func)
+{
+    return -EOPNOTSUPP;
+}
+
+unsigned long vfs_fprobe_nmissed(void)
+{
+    return 0;
+}
+
+void cleanup_vfs_fprobe(void)
+{
+}
+
+#endif
@@ -0,0 +1,20 @@
+// SPDX-FileCopyrightText: 2026 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef VFS_FPROBE_H
+#define VFS_FPROBE_H
+
+#include <linux/version.h>
+
+/* the handlers of fprobe take the entry data and the ret_ip since 6.5 */
+#if defined(CONFIG_FPROBE) && LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+#define VFS_FPROBE
+#endif
+
+/* -EOPNOTSUPP if the kernel has no usable fprobe, the kretprobes are used then */
+int init_vfs_fprobe(void *vfs_changed_func);
+void cleanup_vfs_fprobe(void);
+unsigned long vfs_fprobe_nmissed(void);
+
+#endif
@@ -17,13 +17,19 @@
 #include <linux/fs.h>
 #include <linux/delay.h>
 #include <linux/version.h>
+#include <linux/hash.h>
+#include <linux/workqueue.h>
 
 #include "vfs_change_consts.h"
 #include "event.h"
 #include "vfs_sysfs.h"
+#include "vfs_stats.h"
 
 
-extern char vfs_unnamed_devices[MAX_MINOR+1];
+extern unsigned long vfs_unnamed_devices[BITS_TO_LONGS(MAX_MINOR+1)];
+extern unsigned int trace_event_mask;
+extern unsigned int modify_events;
+extern unsigned int modify_coalesce_ms;
 static int (*vfs_changed_entry)(struct vfs_event *event);
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 2, 0)
@@ -62,19 +68,18 @@ static void on_mount(const unsigned char *dir_name)
     path_put(&path);
 #endif
 
-    if (unlikely(strlen(dir_name) >= sizeof(event->buf))){
+    if (unlikely(strlen(dir_name) >= VFS_EVENT_PATH_LEN)){
         mpr_info("on_mount, mountpoint is too long, %s\n", dir_name);
         return;
     }
 
-    event = vfs_event_alloc();
+    event = vfs_event_alloc(dir_name);
     if (unlikely(!event)) {
         mpr_info("on_mount, vfs_event_alloc fail\n");
+        vfs_stat_action_inc(VFS_STAT_DROPPED, ACT_MOUNT);
         return;
     }
 
-    strcpy(event->buf, dir_name);
-    event->path = event->buf;
     event->action = ACT_MOUNT;
     event->cookie = 0;
     event->dev = dev;
@@ -86,19 +91,18 @@ static void on_unmount(const unsigned char *dir_name)
 {
     struct vfs_event *event;
 
-    if (unlikely(strlen(dir_name) >= sizeof(event->buf))){
+    if (unlikely(strlen(dir_name) >= VFS_EVENT_PATH_LEN)){
         mpr_info("on_unmount, mountpoint is too long, %s\n", dir_name);
         return;
     }
 
-    event = vfs_event_alloc();
+    event = vfs_event_alloc(dir_name);
     if (unlikely(!event)) {
         mpr_info("on_unmount, vfs_event_alloc fail\n");
+        vfs_stat_action_inc(VFS_STAT_DROPPED, ACT_UNMOUNT);
         return;
     }
 
-    strcpy(event->buf, dir_name);
-    event->path = event->buf;
     event->action = ACT_UNMOUNT;
     event->cookie = 0;
     event->dev = 0;
@@ -106,55 +110,351 @@ static void on_unmount(const unsigned char *dir_name)
     vfs_changed_entry(event);
 }
 
-static void on_dentry_op(int action, struct dentry *p_dentry, const unsigned char *file_name, u32 cookie)
+/*
+ * modify events
+ *
+ * fsnotify is called for every write(), so the modify and close-write of a
+ * file are coalesced here, before its path is built. the first one of an
+ * inode in the window takes a slot and builds a pending ACT_MODIFY_FILE event,
+ * the later ones only refresh the attributes of the event, and the pending
+ * events are sent when the window ends. an inode gets at most one event per
+ * window, which carries the size and the mtime of its last write.
+ *
+ * the slots are direct mapped by (dev, ino), an inode that collides sends the
+ * pending event of the other one early. an inode whose path is filtered keeps
+ * its slot without an event, so its path is not built again in the window.
+ * the events are sent by a worker, they carry no process info. the evicted
+ * events are handed to a worker as well, the writer that evicts one did not
+ * make it.
+ */
+#define MODIFY_SHARD_BITS   4
+#define MODIFY_SLOT_BITS    6
+#define MODIFY_EVENT        (FS_MODIFY | FS_CLOSE_WRITE)
+
+struct modify_slot {
+    dev_t dev;
+    unsigned long ino;          /* 0 if the slot is free */
+    struct vfs_event *event;    /* NULL if the event is filtered or not built yet */
+};
+
+struct modify_shard {
+    spinlock_t lock;
+    struct modify_slot slots[1 << MODIFY_SLOT_BITS];
+};
+
+static struct modify_shard modify_shards[1 << MODIFY_SHARD_BITS];
+static struct delayed_work modify_work;
+static int modify_quit;
+static LIST_HEAD(modify_evicted);
+static DEFINE_SPINLOCK(modify_evicted_lock);
+static struct work_struct modify_evict_work;
+
+static inline struct modify_slot *get_modify_slot(struct inode *inode, struct modify_shard **shard)
 {
+    u32 hash = hash_64((u64)inode->i_ino ^ ((u64)new_encode_dev(inode->i_sb->s_dev) << 32),
+                       MODIFY_SHARD_BITS + MODIFY_SLOT_BITS);
+
+    *shard = &modify_shards[hash >> MODIFY_SLOT_BITS];
+    return &(*shard)->slots[hash & ((1 << MODIFY_SLOT_BITS) - 1)];
+}
+
+static inline int is_modify_slot_of(struct modify_slot *slot, struct inode *inode)
+{
+    return slot->ino == inode->i_ino && slot->dev == inode->i_sb->s_dev;
+}
+
+/* give the slot to inode, the pending event of the previous inode is moved to evicted */
+static inline void take_modify_slot(struct modify_slot *slot, struct inode *inode, struct list_head *evicted)
+{
+    if (slot->event)
+        list_add_tail(&slot->event->list, evicted);
+    slot->dev = inode->i_sb->s_dev;
+    slot->ino = inode->i_ino;
+    slot->event = NULL;
+}
+
+/* out of the lock */
+static void send_modify_events(struct list_head *events)
+{
+    struct vfs_event *event, *next;
+
+    list_for_each_entry_safe(event, next, events, list) {
+        list_del(&event->list);
+        vfs_changed_entry(event);
+    }
+}
+
+/* out of the lock, the evicted events are sent by modify_evict_work */
+static void evict_modify_events(struct list_head *evicted)
+{
+    if (list_empty(evicted))
+        return;
+
+    spin_lock(&modify_evicted_lock);
+    list_splice_tail(evicted, &modify_evicted);
+    spin_unlock(&modify_evicted_lock);
+    schedule_work(&modify_evict_work);
+}
+
+static void modify_evict_work_fn(struct work_struct *work)
+{
+    LIST_HEAD(events);
+
+    spin_lock(&modify_evicted_lock);
+    list_splice_init(&modify_evicted, &events);
+    spin_unlock(&modify_evicted_lock);
+
+    send_modify_events(&events);
+}
+
+/*
+ * return 1 if the inode is in the window already, its pending event is refreshed,
+ * or 0 if a slot is taken for it, then its event is built and given to put_modify_event()
+ */
+static int coalesce_modify(struct inode *inode)
+{
+    struct modify_shard *shard;
+    struct modify_slot *slot = get_modify_slot(inode, &shard);
+    LIST_HEAD(evicted);
+    int ret = 1;
+
+    spin_lock(&shard->lock);
+    if (unlikely(modify_quit)) {
+        /* dropped */
+    } else if (is_modify_slot_of(slot, inode)) {
+        if (slot->event)
+            vfs_event_set_attrs(slot->event, inode);
+    } else {
+        take_modify_slot(slot, inode, &evicted);
+        schedule_delayed_work(&modify_work, msecs_to_jiffies(READ_ONCE(modify_coalesce_ms)));
+        ret = 0;
+    }
+    spin_unlock(&shard->lock);
+
+    evict_modify_events(&evicted);
+    return ret;
+}
+
+static void put_modify_event(struct vfs_event *event, struct inode *inode)
+{
+    struct modify_shard *shard;
+    struct modify_slot *slot = get_modify_slot(inode, &shard);
+    LIST_HEAD(evicted);
+
+    spin_lock(&shard->lock);
+    if (unlikely(modify_quit)) {
+        /* dropped */
+    } else if (is_modify_slot_of(slot, inode) && slot->event) {
+        /* an event of the inode is pending already, since the slot was taken */
+        vfs_event_set_attrs(slot->event, inode);
+    } else {
+        /* the slot may be taken by another inode or freed by the worker meanwhile */
+        if (!is_modify_slot_of(slot, inode))
+            take_modify_slot(slot, inode, &evicted);
+        slot->event = event;
+        schedule_delayed_work(&modify_work, msecs_to_jiffies(READ_ONCE(modify_coalesce_ms)));
+        event = NULL;
+    }
+    spin_unlock(&shard->lock);
+
+    if (event)
+        vfs_event_free(event);
+    evict_modify_events(&evicted);
+}
+
+/* the window ends, send the pending events and free all slots */
+static void modify_work_fn(struct work_struct *work)
+{
+    struct modify_shard *shard;
+    LIST_HEAD(events);
+    int i, j;
+
+    for (i = 0; i < ARRAY_SIZE(modify_shards); ++i) {
+        shard = &modify_shards[i];
+        spin_lock(&shard->lock);
+        for (j = 0; j < ARRAY_SIZE(shard->slots); ++j) {
+            if (shard->slots[j].event)
+                list_add_tail(&shard->slots[j].event->list, &events);
+        }
+        memset(shard->slots, 0, sizeof(shard->slots));
+        spin_unlock(&shard->lock);
+    }
+
+    send_modify_events(&events);
+}
+
+static void init_modify_events(void)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(modify_shards); ++i) {
+        spin_lock_init(&modify_shards[i].lock);
+        memset(modify_shards[i].slots, 0, sizeof(modify_shards[i].slots));
+    }
+    INIT_DELAYED_WORK(&modify_work, modify_work_fn);
+    INIT_WORK(&modify_evict_work, modify_evict_work_fn);
+}
+
+static void cleanup_modify_events(void)
+{
+    int i;
+
+    /* once every lock is passed, no slot is taken and the worker is not scheduled again */
+    for (i = 0; i < ARRAY_SIZE(modify_shards); ++i) {
+        spin_lock(&modify_shards[i].lock);
+        modify_quit = 1;
+        spin_unlock(&modify_shards[i].lock);
+    }
+    cancel_delayed_work_sync(&modify_work);
+    modify_work_fn(NULL);
+    cancel_work_sync(&modify_evict_work);
+    modify_evict_work_fn(NULL);
+}
+
+/*
+ * rename filter
+ *
+ * a rename is filtered only when both paths are filtered, as vfs_probe_rename_ent()
+ * does. fsnotify sends the halves one after the other with the same cookie, a
+ * filtered source waits in a slot until its target comes, a source whose target
+ * never comes is sent once another source takes its slot.
+ */
+#define RENAME_SLOT_BITS 4
+
+struct rename_slot {
+    u32 cookie;
     struct vfs_event *event;
-    int file_name_len, dentry_path_size;
-    char *write_pos;
+};
 
-    event = vfs_event_alloc();
-    if (unlikely(!event)) {
-        mpr_info("vfs_event_alloc fail\n");
+static struct rename_slot rename_slots[1 << RENAME_SLOT_BITS];
+static DEFINE_SPINLOCK(rename_slots_lock);
+
+static inline int is_rename_from(int action)
+{
+    return ACT_RENAME_FROM_FILE == action || ACT_RENAME_FROM_FOLDER == action;
+}
+
+static inline int is_rename_half(int action)
+{
+    return action >= ACT_RENAME_FROM_FILE && action <= ACT_RENAME_TO_FOLDER;
+}
+
+static void send_rename_half(struct vfs_event *event, int filtered)
+{
+    struct rename_slot *slot = &rename_slots[hash_32(event->cookie, RENAME_SLOT_BITS)];
+    struct vfs_event *source = NULL, *evicted = NULL;
+
+    spin_lock(&rename_slots_lock);
+    if (is_rename_from(event->action)) {
+        if (filtered) {
+            evicted = slot->event;
+            slot->cookie = event->cookie;
+            slot->event = event;
+            event = NULL;
+        }
+    } else if (slot->event && slot->cookie == event->cookie) {
+        source = slot->event;
+        slot->event = NULL;
+    }
+    spin_unlock(&rename_slots_lock);
+
+    if (evicted)
+        vfs_changed_entry(evicted);
+    if (!event)
         return;
+    /* the source is filtered if it waits, the target is sent if the source is */
+    if (source && filtered) {
+        vfs_event_free(source);
+        vfs_event_free(event);
+        return;
+    }
+    if (source)
+        vfs_changed_entry(source);
+    vfs_changed_entry(event);
+}
+
+/* the sources that wait are sent, their targets are not known */
+static void cleanup_rename_slots(void)
+{
+    struct vfs_event *event;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(rename_slots); ++i) {
+        spin_lock(&rename_slots_lock);
+        event = rename_slots[i].event;
+        rename_slots[i].event = NULL;
+        spin_unlock(&rename_slots_lock);
+        if (event)
+            vfs_changed_entry(event);
     }
+}
+
+/* inode is the inode of the file, it may be NULL */
+static void on_dentry_op(int action, struct dentry *p_dentry, const unsigned char *file_name, u32 cookie,
+    struct inode *inode)
+{
+    struct vfs_event *event;
+    int file_name_len, dentry_path_size, filtered;
+    char *buf, *path, *write_pos;
 
     /*
      * write '\0' at `/` pos first, then update to '/'
      *
      * p_dentry_str + '\0'
      * p_dentry_str + '/' + file_name + '\0'
+     *
+     * the path is built in the scratch buffer, then copied into an event of the fitting size
      */
 
     file_name_len = strlen(file_name);
-    dentry_path_size = sizeof(event->buf) - file_name_len - 1;
+    dentry_path_size = VFS_EVENT_PATH_LEN - file_name_len - 1;
 
-    event->path = dentry_path_raw(p_dentry, event->buf, dentry_path_size);
-    if (IS_ERR(event->path)) {
+    buf = vfs_path_scratch_get();
+    path = dentry_path_raw(p_dentry, buf, dentry_path_size);
+    if (IS_ERR(path)) {
+        vfs_path_scratch_put();
         mpr_info("dentry_path_raw fail\n");
-        goto fail;
+        return;
     }
 
-    write_pos = event->buf + dentry_path_size - 1;
+    write_pos = buf + dentry_path_size - 1;
     /* handle / case */
-    if (0 != *(event->path+1))
+    if (0 != *(path+1))
         *write_pos++ = '/';
     memcpy(write_pos, file_name, file_name_len+1);
 
+    /* the halves of a rename are filtered together, see send_rename_half() */
+    filtered = IS_FILTERED_EVENT(action, p_dentry->d_sb->s_dev, path);
+    if (filtered && !is_rename_half(action)) {
+        vfs_path_scratch_put();
+        return;
+    }
+
+    event = vfs_event_alloc_atomic(path);
+    vfs_path_scratch_put();
+    if (unlikely(!event)) {
+        mpr_info("vfs_event_alloc_atomic fail\n");
+        vfs_stat_action_inc(VFS_STAT_DROPPED, action);
+        return;
+    }
 
     event->action = action;
     event->cookie = cookie;
     event->dev = p_dentry->d_sb->s_dev;
-
-    vfs_changed_entry(event);
-    return;
-
-fail:
-    if (event)
-        vfs_event_free(event);
+    if (ACT_DEL_FILE != action && ACT_DEL_FOLDER != action)
+        vfs_event_set_attrs(event, inode);
+
+    if (ACT_MODIFY_FILE == action)
+        put_modify_event(event, inode);
+    else if (is_rename_half(action))
+        send_rename_half(event, filtered);
+    else
+        vfs_changed_entry(event);
 }
 
 
-static void on_file_op(int action, struct inode *p_inode, const unsigned char *file_name, u32 cookie)
+static void on_file_op(int action, struct inode *p_inode, const unsigned char *file_name, u32 cookie,
+    struct inode *inode)
 {
     struct dentry *dentry;
 
@@ -165,28 +465,48 @@ static void on_file_op(int action, struct inode *p_inode, const unsigned char *f
     spin_unlock(&p_inode->i_lock);
 
     if (dentry) {
-        on_dentry_op(action, dentry, file_name, cookie);
+        on_dentry_op(action, dentry, file_name, cookie, inode);
         dput(dentry);
     }
 }
 
+static void on_modify(struct inode *p_inode, const unsigned char *file_name, struct inode *inode)
+{
+    if (!inode || coalesce_modify(inode))
+        return;
+
+    on_file_op(ACT_MODIFY_FILE, p_inode, file_name, 0, inode);
+}
+
 #define TARGET_EVENT (FS_DELETE | FS_UNMOUNT_DIR | FS_MOUNT_DIR | FS_CREATE | FS_MOVED_FROM | FS_MOVED_TO)
 
-static inline void fsnotify_event_handler(struct inode *to_tell, __u32 mask, const unsigned char *file_name, u32 cookie)
+static inline int is_target_event(__u32 mask)
+{
+    return (mask & TARGET_EVENT) || ((mask & MODIFY_EVENT) && READ_ONCE(modify_events));
+}
+
+static inline void fsnotify_event_handler(struct inode *to_tell, __u32 mask, const unsigned char *file_name, u32 cookie,
+    struct inode *inode)
 {
+    if (!(mask & TARGET_EVENT)) {
+        if (!(mask & FS_ISDIR))
+            on_modify(to_tell, file_name, inode);
+        return;
+    }
+
     switch (mask & TARGET_EVENT)
     {
     case FS_CREATE:
-        on_file_op((mask & FS_ISDIR) ? ACT_NEW_FOLDER : ACT_NEW_FILE, to_tell, file_name, cookie);
+        on_file_op((mask & FS_ISDIR) ? ACT_NEW_FOLDER : ACT_NEW_FILE, to_tell, file_name, cookie, inode);
         break;
     case FS_DELETE:
-        on_file_op((mask & FS_ISDIR) ? ACT_DEL_FOLDER : ACT_DEL_FILE, to_tell, file_name, cookie);
+        on_file_op((mask & FS_ISDIR) ? ACT_DEL_FOLDER : ACT_DEL_FILE, to_tell, file_name, cookie, inode);
         break;
     case FS_MOVED_FROM:
-        on_file_op((mask & FS_ISDIR) ? ACT_RENAME_FROM_FOLDER : ACT_RENAME_FROM_FILE, to_tell, file_name, cookie);
+        on_file_op((mask & FS_ISDIR) ? ACT_RENAME_FROM_FOLDER : ACT_RENAME_FROM_FILE, to_tell, file_name, cookie, inode);
         break;
     case FS_MOVED_TO:
-        on_file_op((mask & FS_ISDIR) ? ACT_RENAME_TO_FOLDER : ACT_RENAME_TO_FILE, to_tell, file_name, cookie);
+        on_file_op((mask & FS_ISDIR) ? ACT_RENAME_TO_FOLDER : ACT_RENAME_TO_FILE, to_tell, file_name, cookie, inode);
         break;
     case FS_MOUNT_DIR:
         on_mount(file_name);
@@ -203,10 +523,11 @@ static void fsnotify_broadcast_listener(struct inode *to_tell, __u32 mask, const
     filename_type *file_name, u32 cookie)
 {
     if (!to_tell || FSNOTIFY_EVENT_INODE != data_is || !filename_str(file_name)
-        || IS_INVALID_DEVICE(to_tell->i_sb->s_dev) || !(mask & TARGET_EVENT))
+        || IS_INVALID_DEVICE(to_tell->i_sb->s_dev) || !is_target_event(mask))
         return;
 
-    fsnotify_event_handler(to_tell, mask, filename_str(file_name), cookie);
+    /* the data is the inode of the file */
+    fsnotify_event_handler(to_tell, mask, filename_str(file_name), cookie, (struct inode *)data);
 }
 
 static void fsnotify_parent_broadcast_listener(const struct path *path,
@@ -215,7 +536,7 @@ static void fsnotify_parent_broadcast_listener(const struct path *path,
     struct dentry *parent = NULL;
     struct name_snapshot name;
 
-    if (IS_INVALID_DEVICE(dentry->d_sb->s_dev) || !(mask & TARGET_EVENT))
+    if (IS_INVALID_DEVICE(dentry->d_sb->s_dev) || !is_target_event(mask))
         return;
 
     if (!p_inode) {
@@ -225,7 +546,7 @@ static void fsnotify_parent_broadcast_listener(const struct path *path,
 
     take_dentry_name_snapshot(&name, dentry);
     if (name_snapshot_str(name))
-        fsnotify_event_handler(p_inode, mask, name_snapshot_str(name), 0);
+        fsnotify_event_handler(p_inode, mask, name_snapshot_str(name), 0, d_inode(dentry));
     release_dentry_name_snapshot(&name);
 
     if (parent)
@@ -237,6 +558,7 @@ int init_vfs_fsnotify(void *vfs_changed_func)
     int ret;
 
     vfs_changed_entry = vfs_changed_func;
+    init_modify_events();
     ret = fsnotify_reg_listener(fsnotify_broadcast_listener, fsnotify_parent_broadcast_listener);
     if (ret)
         mpr_info("fsnotify_reg_listener fail\n");
@@ -252,6 +574,10 @@ void cleanup_vfs_fsnotify(void)
     if (ret)
         mpr_info("fsnotify_unreg_listener fail\n");
 
+    /* the pending modify events are sent before the merge buffer is cleared */
+    cleanup_modify_events();
+    cleanup_rename_slots();
+
     /* wait notify threads quit current module */
     /* sleep later */
 }
@@ -9,25 +9,37 @@
 #include <net/genetlink.h>
 #include <linux/skbuff.h>
 #include <linux/kdev_t.h>
+#include <linux/spinlock.h>
+#include <linux/version.h>
+#include <linux/timer.h>
+#include <linux/jiffies.h>
 
 #include "vfs_genl.h"
 #include "vfs_kgenl.h"
+#include "vfs_dev_seq.h"
+#include "vfs_stats.h"
 #include "event.h"
 
+extern unsigned int compact_path_encoding;
+extern unsigned int merge_timeout_ms;
+extern unsigned int genl_overflow_size;
+
 /* multicast group */
 enum vfsmonitor_multicast_groups {
     VFSMONITOR_MCG_DENTRY,
-    VFSMONITOR_MCG_PROCESS_INFO,
+    VFSMONITOR_MCG_TRACE,
 };
 static const struct genl_multicast_group vfsmonitor_mcgs[] = {
     [VFSMONITOR_MCG_DENTRY] = { .name = VFSMONITOR_MCG_DENTRY_NAME, },
-    [VFSMONITOR_MCG_PROCESS_INFO] = { .name = VFSMONITOR_MCG_PROCESS_INFO_NAME, },
+    [VFSMONITOR_MCG_TRACE] = { .name = VFSMONITOR_MCG_TRACE_NAME, },
 };
 
+#define has_listeners(group) genl_has_listeners(&vfsmonitor_gnl_family, &init_net, group)
+
 /* family definition */
 static struct genl_family vfsmonitor_gnl_family = {
     .name = VFSMONITOR_FAMILY_NAME,
-    .version = 1,
+    .version = VFSMONITOR_FAMILY_VERSION,
     .module = THIS_MODULE,
     .maxattr = VFSMONITOR_A_MAX,
     .netnsok = false,
@@ -35,115 +47,614 @@ static struct genl_family vfsmonitor_gnl_family = {
     .n_mcgrps = ARRAY_SIZE(vfsmonitor_mcgs),
 };
 
+/* the devices whose dentry msgs could not be delivered */
+static struct vfs_lost_devs dentry_lost;
+static DEFINE_SPINLOCK(dentry_lost_lock);
+
+/*
+ * overflow queue
+ *
+ * the dentry events that the listeners can not take are kept in the queue,
+ * they are sent again ahead of the new events, or by the retry timer once a
+ * merge window if no new events come, a short stall of a listener does not
+ * lose them.
+ * while the queue is not empty, the new dentry events are queued behind it,
+ * so the events of a device still reach the listeners in the order of seq.
+ * when the queue would hold more than genl_overflow_size events, the whole
+ * queue is dropped and reported by the lost msgs of its devices instead.
+ */
+static LIST_HEAD(dentry_overflow);
+static int dentry_overflow_number;
+/* the queue is being sent, the new events go behind it */
+static int dentry_overflow_busy;
+static DEFINE_SPINLOCK(dentry_overflow_lock);
+static struct timer_list dentry_retry_timer;
+
+/*
+ * no listener is not an error, the msg is lost only when a listener can not take it.
+ * the listeners set NETLINK_BROADCAST_ERROR, so a full listener fails the multicast
+ * with -ENOBUFS even if the others took the msg, they drop the seqs they have seen
+ * when it is sent again. a listener without it makes the multicast return -ESRCH
+ * when no one took the msg.
+ */
+static inline int multicast(struct sk_buff *msg, unsigned int group)
+{
+    int rc = genlmsg_multicast(&vfsmonitor_gnl_family, msg, 0, group, GFP_ATOMIC);
+    if (rc == -ESRCH && !has_listeners(group))
+        return 0;
+    if (rc)
+        vfs_stat_inc(genl_multicast_failures);
+    return rc;
+}
+
+static inline int put_u64(struct sk_buff *msg, int attrtype, u64 value)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 7, 0)
+    return nla_put_u64(msg, attrtype, value);
+#else
+    return nla_put_u64_64bit(msg, attrtype, value, VFSMONITOR_A_PAD);
+#endif
+}
+
+#define put_seq(msg, seq) put_u64(msg, VFSMONITOR_A_SEQ, seq)
+
+static void dentry_event_lost(struct vfs_event *event)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&dentry_lost_lock, flags);
+    vfs_lost_devs_add(&dentry_lost, event->dev, event->seq);
+    spin_unlock_irqrestore(&dentry_lost_lock, flags);
+    vfs_stat_action_inc(VFS_STAT_DROPPED, event->action);
+}
+
+/* mark the events lost and free them */
+static void dentry_events_lost(struct list_head *events)
+{
+    struct vfs_event *event, *next;
+
+    list_for_each_entry_safe(event, next, events, list) {
+        dentry_event_lost(event);
+        vfs_event_free(event);
+    }
+    INIT_LIST_HEAD(events);
+}
+
 // static const char* action_names[] = {"file-created", "link-created", "symlink-created", "dir-created", "file-deleted", "dir-deleted",
 //     "file-renamed", "dir-renamed", "file-renamed-from", "file-renamed-to", "dir-renamed-from", "dir-renamed-to"};
 
-int vfs_notify_dentry_event(struct vfs_event *event)
+static inline int is_traced_event(struct vfs_event *event)
+{
+    return event->proc_info && event->proc_info->tgid != 0;
+}
+
+/* the process info is optional, only the traced events have it */
+static int put_proc_info_attrs(struct sk_buff *msg, struct vfs_event *event)
 {
     int rc;
-    struct sk_buff *msg;
-    void *msg_head;
+    struct proc_info *info = event->proc_info;
 
-    /* alloc msg */
-    msg = genlmsg_new(NLMSG_GOODSIZE, GFP_ATOMIC);
-    if (!msg)
-        return -ENOMEM;
+    if (!is_traced_event(event))
+        return 0;
+
+    rc = nla_put_u32(msg, VFSMONITOR_A_UID, info->uid);
+    if (rc != 0)
+        return rc;
+    rc = nla_put_s32(msg, VFSMONITOR_A_TGID, info->tgid);
+    if (rc != 0)
+        return rc;
+    return nla_put_string(msg, VFSMONITOR_A_EXE, info->path);
+}
+
+/* the inode attributes are optional, see vfs_event_set_attrs() */
+static int put_inode_attrs(struct sk_buff *msg, struct vfs_event *event)
+{
+    int rc;
+
+    if (!event->mode)
+        return 0;
+
+    rc = put_u64(msg, VFSMONITOR_A_INO, event->ino);
+    if (rc != 0)
+        return rc;
+    rc = nla_put_u32(msg, VFSMONITOR_A_MODE, event->mode);
+    if (rc != 0)
+        return rc;
+    rc = put_u64(msg, VFSMONITOR_A_SIZE, event->size);
+    if (rc != 0)
+        return rc;
+    return put_u64(msg, VFSMONITOR_A_MTIME, event->mtime);
+}
+
+/* the path is the name in the dir of dir_id, or the whole path if dir_id < 0 */
+static int put_dentry_event_attrs(struct sk_buff *msg, struct vfs_event *event, int dir_id, const char *name)
+{
+    int rc;
 
-    /* construct msg */
-    /* create the message headers */
-    msg_head = genlmsg_put(msg, 0, 0, &vfsmonitor_gnl_family, GFP_ATOMIC, VFSMONITOR_C_NOTIFY);
-    if (!msg_head) {
-        rc = -ENOMEM;
-        goto failure;
-    }
-    /* add attributes */
     rc = nla_put_u8(msg, VFSMONITOR_A_ACT, event->action);
     if (rc != 0)
-        goto failure;
+        return rc;
     rc = nla_put_u32(msg, VFSMONITOR_A_COOKIE, event->cookie);
     if (rc != 0)
-        goto failure;
+        return rc;
     rc = nla_put_u16(msg, VFSMONITOR_A_MAJOR, MAJOR(event->dev));
     if (rc != 0)
-        goto failure;
-    rc = nla_put_u8(msg, VFSMONITOR_A_MINOR, MINOR(event->dev));
+        return rc;
+    rc = nla_put_u32(msg, VFSMONITOR_A_MINOR, MINOR(event->dev));
     if (rc != 0)
-        goto failure;
-    rc = nla_put_string(msg, VFSMONITOR_A_PATH, event->path);
+        return rc;
+    rc = put_seq(msg, event->seq);
     if (rc != 0)
-        goto failure;
-    /* finalize the message */
-    genlmsg_end(msg, msg_head);
+        return rc;
+    rc = put_u64(msg, VFSMONITOR_A_TIME, event->time);
+    if (rc != 0)
+        return rc;
+    if (dir_id < 0) {
+        rc = nla_put_string(msg, VFSMONITOR_A_PATH, event->path);
+    } else {
+        rc = nla_put_u16(msg, VFSMONITOR_A_DIR_ID, dir_id);
+        if (rc == 0)
+            rc = nla_put_string(msg, VFSMONITOR_A_NAME, name);
+    }
+    if (rc != 0)
+        return rc;
+    rc = put_inode_attrs(msg, event);
+    if (rc != 0)
+        return rc;
+    return put_proc_info_attrs(msg, event);
+}
+
+/*
+ * batch of dentry events
+ *
+ * the events are packed into one msg as nested VFSMONITOR_A_EVENT attributes,
+ * the msg is sent to the group when it is full or when the batch ends.
+ */
+struct dentry_event_batch {
+    unsigned int group;
+    struct sk_buff *msg;
+    void *msg_head;
+    struct vfs_event *first;
+    int events_number;
+    /* the dentry events that are not sent are moved to deferred, see the overflow queue */
+    struct list_head *deferred;
+    int deferred_number;
+    /* a msg was not taken, or the queue is not empty, the events are deferred */
+    int stalled;
+    /* the dirs defined in msg, see the compact path encoding in vfs_genl.h */
+    int compact;
+    int dirs_number;
+    const char *dirs[VFSMONITOR_BATCH_DIRS];
+    int dir_lens[VFSMONITOR_BATCH_DIRS];
+};
+
+static int batch_begin(struct dentry_event_batch *batch)
+{
+    batch->msg = genlmsg_new(NLMSG_GOODSIZE, GFP_ATOMIC);
+    if (!batch->msg) {
+        vfs_stat_inc(genl_new_failures);
+        return -ENOMEM;
+    }
 
-    /* send msg */
-    genlmsg_multicast(&vfsmonitor_gnl_family, msg, 0, VFSMONITOR_MCG_DENTRY, GFP_ATOMIC);
+    batch->msg_head = genlmsg_put(batch->msg, 0, 0, &vfsmonitor_gnl_family, GFP_ATOMIC, VFSMONITOR_C_NOTIFY_BATCH);
+    if (!batch->msg_head) {
+        kfree_skb(batch->msg);
+        batch->msg = 0;
+        return -ENOMEM;
+    }
+    batch->events_number = 0;
+    batch->dirs_number = 0;
 
     return 0;
+}
+
+/* move n events from event to deferred, they are contiguous in the list */
+static void batch_defer(struct dentry_event_batch *batch, struct vfs_event *event, int n)
+{
+    struct vfs_event *next;
+
+    batch->stalled = 1;
+    while (n--) {
+        next = list_next_entry(event, list);
+        list_move_tail(&event->list, batch->deferred);
+        ++batch->deferred_number;
+        event = next;
+    }
+}
+
+static int batch_flush(struct dentry_event_batch *batch)
+{
+    int rc = 0;
+
+    if (!batch->msg)
+        return 0;
+
+    if (batch->events_number) {
+        genlmsg_end(batch->msg, batch->msg_head);
+        rc = multicast(batch->msg, batch->group);
+        /* the events of the trace group are not contiguous in the list, and they are not recovered */
+        if (rc && batch->deferred)
+            batch_defer(batch, batch->first, batch->events_number);
+    } else {
+        kfree_skb(batch->msg);
+    }
+    batch->msg = 0;
 
-failure:
-    kfree_skb(msg);
     return rc;
 }
 
-int vfs_notify_proc_info(struct proc_info *info)
+/*
+ * return the id of the dir in msg, define it if it is not there yet
+ *
+ * dir is not terminated at len, it is the head of the path of an event in the batch,
+ * which lives until the batch is flushed.
+ * the dirs are replaced in turn when all ids are taken.
+ */
+static int batch_put_dir(struct dentry_event_batch *batch, const char *dir, int len)
+{
+    struct nlattr *nest, *path;
+    int i, id;
+
+    for (i = 0; i < min(batch->dirs_number, VFSMONITOR_BATCH_DIRS); ++i) {
+        if (batch->dir_lens[i] == len && !memcmp(batch->dirs[i], dir, len))
+            return i;
+    }
+
+    id = batch->dirs_number % VFSMONITOR_BATCH_DIRS;
+    nest = nla_nest_start(batch->msg, VFSMONITOR_A_DIR);
+    if (!nest)
+        return -EMSGSIZE;
+    if (nla_put_u16(batch->msg, VFSMONITOR_A_DIR_ID, id))
+        return -EMSGSIZE;
+    path = nla_reserve(batch->msg, VFSMONITOR_A_PATH, len + 1);
+    if (!path)
+        return -EMSGSIZE;
+    memcpy(nla_data(path), dir, len);
+    ((char *)nla_data(path))[len] = 0;
+    nla_nest_end(batch->msg, nest);
+
+    batch->dirs[id] = dir;
+    batch->dir_lens[id] = len;
+    ++batch->dirs_number;
+
+    return id;
+}
+
+static int batch_put_event(struct dentry_event_batch *batch, struct vfs_event *event)
+{
+    int rc, dir_id = -1, dirs_number;
+    struct nlattr *nest;
+    const char *slash = NULL;
+    unsigned char *mark;
+
+    if (!batch->msg) {
+        rc = batch_begin(batch);
+        if (rc != 0)
+            return rc;
+    }
+
+    /* the dir and the event go into msg together, or none of them */
+    mark = skb_tail_pointer(batch->msg);
+    dirs_number = batch->dirs_number;
+    if (batch->compact)
+        slash = strrchr(event->path, '/');
+    if (slash) {
+        dir_id = batch_put_dir(batch, event->path, slash - event->path);
+        if (dir_id < 0) {
+            rc = dir_id;
+            goto fail;
+        }
+    }
+
+    nest = nla_nest_start(batch->msg, VFSMONITOR_A_EVENT);
+    if (!nest) {
+        rc = -EMSGSIZE;
+        goto fail;
+    }
+    rc = put_dentry_event_attrs(batch->msg, event, dir_id, slash ? slash + 1 : NULL);
+    if (rc != 0)
+        goto fail;
+    nla_nest_end(batch->msg, nest);
+    if (!batch->events_number++)
+        batch->first = event;
+
+    return 0;
+
+fail:
+    nlmsg_trim(batch->msg, mark);
+    /* a dir defined for the event is trimmed with it, its slot matches nothing now */
+    if (batch->dirs_number != dirs_number) {
+        batch->dirs_number = dirs_number;
+        batch->dir_lens[dirs_number % VFSMONITOR_BATCH_DIRS] = -1;
+    }
+    return rc;
+}
+
+static int batch_add_event(struct dentry_event_batch *batch, struct vfs_event *event)
+{
+    int rc;
+
+    rc = batch_put_event(batch, event);
+    /* msg is full, send it and retry with a new msg, unless the listeners did not take it */
+    if (rc == -EMSGSIZE && batch->events_number) {
+        rc = batch_flush(batch);
+        if (rc == 0)
+            rc = batch_put_event(batch, event);
+    }
+
+    return rc;
+}
+
+/* a dentry event is not sent ahead of the deferred ones, it is deferred too */
+static int batch_add_dentry_event(struct dentry_event_batch *batch, struct vfs_event *event)
+{
+    int rc = 0;
+
+    if (!batch->stalled)
+        rc = batch_add_event(batch, event);
+    /* it does not fit in an empty msg, it would never be sent */
+    if (rc == -EMSGSIZE)
+        dentry_event_lost(event);
+    else if (batch->stalled || rc)
+        batch_defer(batch, event, 1);
+
+    return rc;
+}
+
+/* major 0, minor 0 and seq 0 mean the events of all devices are lost */
+static int vfs_notify_lost(dev_t dev, u64 seq)
 {
     int rc;
     struct sk_buff *msg;
     void *msg_head;
 
-    /* alloc msg */
     msg = genlmsg_new(NLMSG_GOODSIZE, GFP_ATOMIC);
-    if (!msg)
+    if (!msg) {
+        vfs_stat_inc(genl_new_failures);
         return -ENOMEM;
+    }
 
-    /* construct msg */
-    /* create the message headers */
-    msg_head = genlmsg_put(msg, 0, 0, &vfsmonitor_gnl_family, GFP_ATOMIC, VFSMONITOR_C_NOTIFY_PROCESS_INFO);
+    msg_head = genlmsg_put(msg, 0, 0, &vfsmonitor_gnl_family, GFP_ATOMIC, VFSMONITOR_C_NOTIFY_LOST);
     if (!msg_head) {
         rc = -ENOMEM;
         goto failure;
     }
-    /* add attributes */
-    rc = nla_put_u32(msg, VFSMONITOR_A_UID, info->uid);
+    rc = nla_put_u16(msg, VFSMONITOR_A_MAJOR, MAJOR(dev));
     if (rc != 0)
         goto failure;
-    rc = nla_put_s32(msg, VFSMONITOR_A_TGID, info->tgid);
+    rc = nla_put_u32(msg, VFSMONITOR_A_MINOR, MINOR(dev));
     if (rc != 0)
         goto failure;
-    rc = nla_put_string(msg, VFSMONITOR_A_PATH, info->path);
+    rc = put_seq(msg, seq);
     if (rc != 0)
         goto failure;
-
-    /* finalize the message */
     genlmsg_end(msg, msg_head);
 
-    /* send msg */
-    genlmsg_multicast(&vfsmonitor_gnl_family, msg, 0, VFSMONITOR_MCG_PROCESS_INFO, GFP_ATOMIC);
-
-    return 0;
+    return multicast(msg, VFSMONITOR_MCG_DENTRY);
 
 failure:
     kfree_skb(msg);
     return rc;
 }
 
-int vfs_notify_vfs_event(struct vfs_event *event)
+/* tell the dentry listeners which devices lost events, before the new events */
+static void notify_lost_events(void)
 {
-    int rc;
+    struct vfs_lost_devs lost;
+    unsigned long flags;
+    int i;
 
-    rc = vfs_notify_dentry_event(event);
-    if (rc)
-        return rc;
+    if (!READ_ONCE(dentry_lost.count) && !READ_ONCE(dentry_lost.overflow))
+        return;
 
-    if (event->proc_info && event->proc_info->tgid != 0)
-        return vfs_notify_proc_info(event->proc_info);
+    spin_lock_irqsave(&dentry_lost_lock, flags);
+    lost = dentry_lost;
+    memset(&dentry_lost, 0, sizeof(dentry_lost));
+    spin_unlock_irqrestore(&dentry_lost_lock, flags);
 
-    return 0;
+    if (lost.overflow) {
+        if (vfs_notify_lost(0, 0)) {
+            spin_lock_irqsave(&dentry_lost_lock, flags);
+            dentry_lost.overflow = 1;
+            spin_unlock_irqrestore(&dentry_lost_lock, flags);
+        }
+        return;
+    }
+
+    for (i = 0; i < lost.count; ++i) {
+        if (vfs_notify_lost(lost.devs[i], lost.seqs[i]))
+            break;
+    }
+    /* still no room, try again with the next events */
+    if (i < lost.count) {
+        spin_lock_irqsave(&dentry_lost_lock, flags);
+        for (; i < lost.count; ++i)
+            vfs_lost_devs_add(&dentry_lost, lost.devs[i], lost.seqs[i]);
+        spin_unlock_irqrestore(&dentry_lost_lock, flags);
+    }
+}
+
+static void arm_retry_timer(void)
+{
+    if (!timer_pending(&dentry_retry_timer))
+        mod_timer(&dentry_retry_timer, jiffies + max(msecs_to_jiffies(READ_ONCE(merge_timeout_ms)), 1UL));
+}
+
+/* queue the deferred events behind the queue, the queue is dropped if it overflows */
+static void queue_overflow_events(struct list_head *deferred, int number)
+{
+    LIST_HEAD(dropped);
+    unsigned long flags;
+
+    if (list_empty(deferred))
+        return;
+
+    vfs_stat_add(genl_deferred, number);
+    spin_lock_irqsave(&dentry_overflow_lock, flags);
+    list_splice_tail_init(deferred, &dentry_overflow);
+    dentry_overflow_number += number;
+    if (dentry_overflow_number > READ_ONCE(genl_overflow_size)) {
+        list_splice_init(&dentry_overflow, &dropped);
+        dentry_overflow_number = 0;
+    }
+    spin_unlock_irqrestore(&dentry_overflow_lock, flags);
+
+    if (list_empty(&dropped)) {
+        arm_retry_timer();
+    } else {
+        vfs_stat_inc(genl_overflows);
+        dentry_events_lost(&dropped);
+    }
+}
+
+static void drop_overflow_events(void)
+{
+    LIST_HEAD(dropped);
+    unsigned long flags;
+
+    spin_lock_irqsave(&dentry_overflow_lock, flags);
+    list_splice_init(&dentry_overflow, &dropped);
+    dentry_overflow_number = 0;
+    spin_unlock_irqrestore(&dentry_overflow_lock, flags);
+
+    dentry_events_lost(&dropped);
+}
+
+/* send the queue again, return 1 if it is empty, the new events can be sent then */
+static int retry_overflow_events(int compact)
+{
+    struct dentry_event_batch batch = { .group = VFSMONITOR_MCG_DENTRY, .compact = compact };
+    struct vfs_event *event, *next;
+    unsigned long flags;
+    LIST_HEAD(events);
+    LIST_HEAD(deferred);
+    int empty;
+
+    spin_lock_irqsave(&dentry_overflow_lock, flags);
+    if (dentry_overflow_busy || list_empty(&dentry_overflow)) {
+        empty = !dentry_overflow_busy;
+        spin_unlock_irqrestore(&dentry_overflow_lock, flags);
+        return empty;
+    }
+    list_splice_init(&dentry_overflow, &events);
+    dentry_overflow_number = 0;
+    dentry_overflow_busy = 1;
+    spin_unlock_irqrestore(&dentry_overflow_lock, flags);
+
+    batch.deferred = &deferred;
+    list_for_each_entry_safe(event, next, &events, list)
+        batch_add_dentry_event(&batch, event);
+    batch_flush(&batch);
+
+    /* the events that are not sent again go back ahead of the ones queued meanwhile */
+    spin_lock_irqsave(&dentry_overflow_lock, flags);
+    list_splice(&deferred, &dentry_overflow);
+    dentry_overflow_number += batch.deferred_number;
+    dentry_overflow_busy = 0;
+    empty = list_empty(&dentry_overflow);
+    spin_unlock_irqrestore(&dentry_overflow_lock, flags);
+
+    /* the sent events are left in events */
+    list_for_each_entry_safe(event, next, &events, list)
+        vfs_event_free(event);
+
+    return empty;
+}
+
+static void dentry_retry_callback(
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 15, 0)
+unsigned long data
+#else
+struct timer_list *t
+#endif
+)
+{
+    /* nobody takes them, the listeners are told when they come back */
+    if (!has_listeners(VFSMONITOR_MCG_DENTRY)) {
+        drop_overflow_events();
+        return;
+    }
+
+    notify_lost_events();
+    if (!retry_overflow_events(READ_ONCE(compact_path_encoding)))
+        arm_retry_timer();
+}
+
+int vfs_genl_overflow_number(void)
+{
+    return READ_ONCE(dentry_overflow_number);
+}
+
+int vfs_genl_want_proc_info(void)
+{
+    return has_listeners(VFSMONITOR_MCG_TRACE);
+}
+
+/*
+ * notify a list of events
+ *
+ * groups
+ *      dentry, all events, batched
+ *      trace, only the traced events, batched
+ *
+ * a traced event carries its process info in the same attributes, see
+ * put_proc_info_attrs(), the process info is looked up only if the trace group
+ * has listeners.
+ * a msg is built only if its group has listeners.
+ * a dentry msg that a listener can not take is kept in the overflow queue and
+ * sent again later, its events are taken off events, the caller does not free
+ * them. the queue that overflows is reported by a lost msg of its devices,
+ * ahead of the new events.
+ */
+int vfs_notify_vfs_events(struct list_head *events)
+{
+    int rc, ret = 0;
+    int dentry, trace;
+    struct vfs_event *event, *next;
+    int compact = READ_ONCE(compact_path_encoding);
+    LIST_HEAD(deferred);
+    struct dentry_event_batch dentry_batch = { .group = VFSMONITOR_MCG_DENTRY, .compact = compact,
+                                               .deferred = &deferred };
+    struct dentry_event_batch trace_batch = { .group = VFSMONITOR_MCG_TRACE, .compact = compact };
+
+    dentry = has_listeners(VFSMONITOR_MCG_DENTRY);
+    trace = has_listeners(VFSMONITOR_MCG_TRACE);
+    /* the consumers may read the events from the rings, do not build msgs for nobody */
+    if (!dentry && !trace)
+        return 0;
+
+    if (dentry) {
+        notify_lost_events();
+        dentry_batch.stalled = !retry_overflow_events(compact);
+    }
+
+    /* the dentry batch moves the events it defers, they are still valid until the end */
+    list_for_each_entry_safe(event, next, events, list) {
+        rc = 0;
+        if (dentry)
+            rc = batch_add_dentry_event(&dentry_batch, event);
+        if (trace && is_traced_event(event))
+            rc = batch_add_event(&trace_batch, event) ? : rc;
+        if (rc)
+            ret = rc;
+    }
+    batch_flush(&dentry_batch);
+    batch_flush(&trace_batch);
+    queue_overflow_events(&deferred, dentry_batch.deferred_number);
+
+    return ret;
 }
 
 int init_vfs_genl(void)
 {
-    int ret = genl_register_family(&vfsmonitor_gnl_family);
+    int ret;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 15, 0)
+    setup_timer(&dentry_retry_timer, dentry_retry_callback, 0);
+#else
+    timer_setup(&dentry_retry_timer, dentry_retry_callback, 0);
+#endif
+    ret = genl_register_family(&vfsmonitor_gnl_family);
     if (ret)
         mpr_err("init_vfs_genl fail: %d\n", ret);
     return ret;
@@ -151,5 +662,11 @@ int init_vfs_genl(void)
 
 void cleanup_vfs_genl(void)
 {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
+    timer_delete_sync(&dentry_retry_timer);
+#else
+    del_timer_sync(&dentry_retry_timer);
+#endif
+    drop_overflow_events();
     genl_unregister_family(&vfsmonitor_gnl_family);
 }
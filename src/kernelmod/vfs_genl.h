@@ -8,6 +8,15 @@
 
 /* protocol family */
 #define VFSMONITOR_FAMILY_NAME "vfsmonitor"
+/*
+ * protocol version
+ * 1, the process info of a traced event follows it in a VFSMONITOR_C_NOTIFY_PROCESS_INFO msg
+ * 2, the process info is carried by the attributes of the traced event itself,
+ *    VFSMONITOR_A_MINOR is a u32, the minors of the unnamed devices take 20 bits
+ *
+ * src/daemon/include/common/vfs_genl.h is a copy of this file, keep them the same
+ */
+#define VFSMONITOR_FAMILY_VERSION 2
 
 /* attributes */
 enum {
@@ -15,38 +24,74 @@ enum {
     VFSMONITOR_A_ACT,
     VFSMONITOR_A_COOKIE,
     VFSMONITOR_A_MAJOR,
-    VFSMONITOR_A_MINOR,
+    VFSMONITOR_A_MINOR,     /* u32 */
     VFSMONITOR_A_PATH,
     VFSMONITOR_A_UID,
     VFSMONITOR_A_TGID,
+    VFSMONITOR_A_EVENT,     /* nested, the attributes of one dentry event */
+    VFSMONITOR_A_SEQ,       /* u64, the seq of the event in its device, see vfs_dev_seq.h */
+    VFSMONITOR_A_PAD,
+    VFSMONITOR_A_EXE,       /* the exe path of the process, with VFSMONITOR_A_UID and VFSMONITOR_A_TGID */
+    VFSMONITOR_A_INO,       /* u64, the attributes of the inode at event time, optional, all or none */
+    VFSMONITOR_A_MODE,      /* u32, st_mode */
+    VFSMONITOR_A_SIZE,      /* u64 */
+    VFSMONITOR_A_MTIME,     /* u64, the s64 seconds */
+    VFSMONITOR_A_DIR,       /* nested, a dir of the msg, VFSMONITOR_A_DIR_ID and VFSMONITOR_A_PATH */
+    VFSMONITOR_A_DIR_ID,    /* u16, below VFSMONITOR_BATCH_DIRS */
+    VFSMONITOR_A_NAME,      /* the leaf name of the event in the dir of VFSMONITOR_A_DIR_ID */
+    VFSMONITOR_A_TIME,      /* u64, the CLOCK_MONOTONIC ns when the event was captured */
     __VFSMONITOR_A_MAX,
 };
 #define VFSMONITOR_A_MAX (__VFSMONITOR_A_MAX - 1)
 
-/* attribute policy */
-#ifndef __KERNEL__
+/* attribute policy, for the listeners in c */
+#if !defined(__KERNEL__) && !defined(__cplusplus)
 static struct nla_policy vfsmonitor_genl_policy[VFSMONITOR_A_MAX + 1] = {
     [VFSMONITOR_A_ACT] = { .type = NLA_U8 },
     [VFSMONITOR_A_COOKIE] = { .type = NLA_U32 },
     [VFSMONITOR_A_MAJOR] = { .type = NLA_U16 },
-    [VFSMONITOR_A_MINOR] = { .type = NLA_U8 },
+    [VFSMONITOR_A_MINOR] = { .type = NLA_U32 },
     [VFSMONITOR_A_PATH] = { .type = NLA_NUL_STRING, .maxlen = 4096 },
     [VFSMONITOR_A_UID] = { .type = NLA_U32 },
     [VFSMONITOR_A_TGID] = { .type = NLA_S32 },
+    [VFSMONITOR_A_EVENT] = { .type = NLA_NESTED },
+    [VFSMONITOR_A_SEQ] = { .type = NLA_U64 },
+    [VFSMONITOR_A_EXE] = { .type = NLA_NUL_STRING, .maxlen = 4096 },
+    [VFSMONITOR_A_INO] = { .type = NLA_U64 },
+    [VFSMONITOR_A_MODE] = { .type = NLA_U32 },
+    [VFSMONITOR_A_SIZE] = { .type = NLA_U64 },
+    [VFSMONITOR_A_MTIME] = { .type = NLA_U64 },
+    [VFSMONITOR_A_DIR] = { .type = NLA_NESTED },
+    [VFSMONITOR_A_DIR_ID] = { .type = NLA_U16 },
+    [VFSMONITOR_A_NAME] = { .type = NLA_NUL_STRING, .maxlen = 256 },
+    [VFSMONITOR_A_TIME] = { .type = NLA_U64 },
 };
 #endif
 
+/*
+ * compact path encoding, on when /sys/kernel/vfs_monitor/compact_path_encoding is 1
+ *
+ * a VFSMONITOR_C_NOTIFY_BATCH msg defines the dirs of its events by VFSMONITOR_A_DIR
+ * attributes ahead of the events, an event of a defined dir carries VFSMONITOR_A_DIR_ID
+ * and VFSMONITOR_A_NAME instead of VFSMONITOR_A_PATH, its path is the dir + "/" + name.
+ * the ids are valid to the end of the msg, a later VFSMONITOR_A_DIR may reuse an id.
+ */
+#define VFSMONITOR_BATCH_DIRS 16
+
 /* commands */
 enum {
     VFSMONITOR_C_UNSPEC,
     VFSMONITOR_C_NOTIFY,
-    VFSMONITOR_C_NOTIFY_PROCESS_INFO,
+    VFSMONITOR_C_NOTIFY_PROCESS_INFO,   /* not sent since version 2 */
+    VFSMONITOR_C_NOTIFY_BATCH,      /* a list of VFSMONITOR_A_EVENT, in the order of the events */
+    VFSMONITOR_C_NOTIFY_LOST,       /* events of the device are lost up to the seq, 0:0 means all devices */
     __VFSMONITOR_C_MAX,
 };
 #define VFSMONITOR_C_MAX (__VFSMONITOR_C_MAX - 1)
 
 /* multicast group */
 #define VFSMONITOR_MCG_DENTRY_NAME VFSMONITOR_FAMILY_NAME "_de"
-#define VFSMONITOR_MCG_PROCESS_INFO_NAME VFSMONITOR_FAMILY_NAME "_pi"
+/* only the events of the actions in trace_event_mask, each with its process info */
+#define VFSMONITOR_MCG_TRACE_NAME VFSMONITOR_FAMILY_NAME "_tr"
 
 #endif
@@ -10,6 +10,10 @@
 
 int init_vfs_genl(void);
 void cleanup_vfs_genl(void);
-int vfs_notify_vfs_event(struct vfs_event *event);
+/* the events that are kept for a retry are taken off events */
+int vfs_notify_vfs_events(struct list_head *events);
+int vfs_genl_want_proc_info(void);
+/* the events in the overflow queue */
+int vfs_genl_overflow_number(void);
 
 #endif
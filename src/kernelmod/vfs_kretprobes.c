@@ -19,18 +19,13 @@
 #include "arg_extractor.h"
 #include "vfs_change_consts.h"
 #include "event.h"
-#include "vfs_sysfs.h"
-
-
-extern char vfs_unnamed_devices[MAX_MINOR+1];
-static int (*vfs_changed_entry)(struct vfs_event *event);
-static atomic_t event_sync_cookie = ATOMIC_INIT(0);
+#include "vfs_probe.h"
 
+/* maxactive is set when registering, see vfs_probe_maxactive() */
 #define _DECL_CMN_KRP(fn, symbol) static struct kretprobe fn##_krp = {\
         .entry_handler  = on_##fn##_ent,\
         .handler        = on_##fn##_ret,\
         .data_size      = sizeof(struct fn##_args),\
-        .maxactive      = 64,\
         .kp.symbol_name = ""#symbol"",\
     };
 
@@ -87,68 +82,9 @@ static int on_do_mount_ent(struct kretprobe_instance *ri, struct pt_regs *regs)
     return 0;
 }
 
-struct do_mount_work_stuct {
-    struct work_struct work;
-    struct do_mount_args args;
-};
-
-void do_mount_work_handle(struct work_struct *work)
-{
-#ifdef QUERY_DEV_ON_MOUNT
-    struct path path;
-#endif
-    dev_t dev = 0;
-    struct do_mount_work_stuct *do_mount_work = (struct do_mount_work_stuct *)work;
-    struct vfs_event *event;
-
-#ifdef QUERY_DEV_ON_MOUNT
-    if (unlikely(kern_path(do_mount_work->args.dir_name, LOOKUP_FOLLOW, &path))) {
-        mpr_info("do_mount_work_handle, kern_path fail for %s\n", do_mount_work->args.dir_name);
-        goto quit;
-    }
-    dev = path.dentry->d_sb->s_dev;
-    path_put(&path);
-#endif
-
-    if (unlikely(strlen(do_mount_work->args.dir_name) >= sizeof(event->buf))){
-        mpr_info("do_mount_work_handle, mountpoint is too long, %s\n", do_mount_work->args.dir_name);
-        goto quit;
-    }
-
-    event = vfs_event_alloc_atomic();
-    if (unlikely(!event)) {
-        mpr_info("do_mount_work_handle, vfs_event_alloc_atomic fail\n");
-        goto quit;
-    }
-
-    strcpy(event->buf, do_mount_work->args.dir_name);
-    event->path = event->buf;
-    event->action = ACT_MOUNT;
-    event->cookie = 0;
-    event->dev = dev;
-
-    vfs_changed_entry(event);
-
-quit:
-    kfree(do_mount_work);
-}
-
 static int on_do_mount_ret(struct kretprobe_instance *ri, struct pt_regs *regs)
 {
-    struct do_mount_work_stuct *do_mount_work;
-    struct do_mount_args *args = (struct do_mount_args *)ri->data;
-    if (regs_return_value(regs))
-        return 0;
-
-    do_mount_work = kmalloc(sizeof(struct do_mount_work_stuct), GFP_ATOMIC);
-    if (unlikely(0 == do_mount_work)) {
-        mpr_info("do_mount_work kmalloc failed\n");
-        return 0;
-    }
-    strcpy(do_mount_work->args.dir_name, args->dir_name);
-    INIT_WORK(&(do_mount_work->work), do_mount_work_handle);
-    schedule_work(&do_mount_work->work);
-
+    vfs_probe_mount_ret(((struct do_mount_args *)ri->data)->dir_name, regs_return_value(regs));
     return 0;
 }
 
@@ -200,55 +136,9 @@ static int on_sys_umount_ent(struct kretprobe_instance *ri, struct pt_regs *regs
     return 0;
 }
 
-struct sys_umount_work_stuct {
-    struct work_struct work;
-    struct sys_umount_args args;
-};
-
-void sys_umount_work_handle(struct work_struct *work)
-{
-    struct sys_umount_work_stuct *sys_umount_work = (struct sys_umount_work_stuct *)work;
-    struct vfs_event *event;
-
-    if (unlikely(strlen(sys_umount_work->args.dir_name) >= sizeof(event->buf))){
-        mpr_info("on_mount, mountpoint is too long, %s\n", sys_umount_work->args.dir_name);
-        goto quit;
-    }
-
-    event = vfs_event_alloc_atomic();
-    if (unlikely(!event)) {
-        mpr_info("on_mount, vfs_event_alloc_atomic fail\n");
-        goto quit;
-    }
-
-    strcpy(event->buf, sys_umount_work->args.dir_name);
-    event->path = event->buf;
-    event->action = ACT_UNMOUNT;
-    event->cookie = 0;
-    event->dev = 0;
-
-    vfs_changed_entry(event);
-
-quit:
-    kfree(sys_umount_work);
-}
-
 static int on_sys_umount_ret(struct kretprobe_instance *ri, struct pt_regs *regs)
 {
-    struct sys_umount_work_stuct *sys_umount_work;
-    struct sys_umount_args *args = (struct sys_umount_args *)ri->data;
-    if (regs_return_value(regs))
-        return 0;
-
-    sys_umount_work = kmalloc(sizeof(struct sys_umount_work_stuct), GFP_ATOMIC);
-    if (unlikely(0 == sys_umount_work)) {
-        mpr_info("on_sys_umount_ret kmalloc failed\n");
-        return 0;
-    }
-    strcpy(sys_umount_work->args.dir_name, args->dir_name);
-    INIT_WORK(&(sys_umount_work->work), sys_umount_work_handle);
-    schedule_work(&sys_umount_work->work);
-
+    vfs_probe_umount_ret(((struct sys_umount_args *)ri->data)->dir_name, regs_return_value(regs));
     return 0;
 }
 
@@ -268,71 +158,26 @@ _DECL_CMN_KRP(sys_umount, path_umount);
 
 
 
-#define DECL_VFS_KRP(fn, act, de_i) static int on_##fn##_ent(struct kretprobe_instance *ri, struct pt_regs *regs)\
+#define _DECL_VFS_KRP(fn, act, de_i, ret_fn) static int on_##fn##_ent(struct kretprobe_instance *ri, struct pt_regs *regs)\
     {\
-        return common_vfs_ent((struct vfs_event **)&(ri->data), (struct dentry *)get_arg(regs, de_i));\
+        return vfs_probe_dentry_ent((struct vfs_probe_dentry_data *)ri->data, (struct dentry *)get_arg(regs, de_i), act);\
     }\
     \
     static int on_##fn##_ret(struct kretprobe_instance *ri, struct pt_regs *regs)\
     {\
-        return common_vfs_ret((struct vfs_event **)&(ri->data), regs, act);\
+        ret_fn;\
+        return 0;\
     }\
     \
     static struct kretprobe fn##_krp = {\
         .entry_handler  = on_##fn##_ent,\
         .handler        = on_##fn##_ret,\
-        .data_size      = sizeof(struct vfs_event *),\
-        .maxactive      = 64,\
+        .data_size      = sizeof(struct vfs_probe_dentry_data),\
         .kp.symbol_name = ""#fn"",\
     };
 
-/*
- * if kretprobe entry-handler returns a non-zero error,
- * then the handler will not be called.
- *
- * https://www.kernel.org/doc/Documentation/kprobes.txt
- */
-static int common_vfs_ent(struct vfs_event **event, struct dentry *de)
-{
-    if (de == 0 || de->d_sb == 0)
-        return 1;
-    if (IS_INVALID_DEVICE(de->d_sb->s_dev))
-        return 1;
-
-    *event = vfs_event_alloc_atomic();
-    if (unlikely(!*event)) {
-        mpr_info("vfs_event_alloc_atomic fail\n");
-        return 1;
-    }
-
-    (*event)->dev = de->d_sb->s_dev;
-    (*event)->path = dentry_path_raw(de, (*event)->buf, sizeof((*event)->buf));
-    if (IS_ERR((*event)->path))
-        goto fail;
-    (*event)->cookie = 0;
-
-    return 0;
-
-fail:
-    if (*event)
-        vfs_event_free(*event);
-    return 1;
-}
-
-static int common_vfs_ret(struct vfs_event **event, struct pt_regs *regs, int action)
-{
-    if (regs_return_value(regs))
-        goto fail;
-
-    (*event)->action = action;
-    vfs_changed_entry(*event);
-    return 0;
-
-fail:
-    if (*event)
-        vfs_event_free(*event);
-    return 0;
-}
+#define DECL_VFS_KRP(fn, act, de_i) \
+    _DECL_VFS_KRP(fn, act, de_i, vfs_probe_dentry_ret((struct vfs_probe_dentry_data *)ri->data, regs_return_value(regs), act))
 
 // select dentry from vfs api by different kernel
 // If the vfs api in the subsequent kernel changes, please define a new macro branch.
@@ -358,13 +203,14 @@ DECL_VFS_KRP(vfs_link, ACT_NEW_LINK, 3);
 // int vfs_create(struct user_namespace *, struct inode *, struct dentry *, umode_t, bool);
 // int vfs_unlink(struct user_namespace *, struct inode *, struct dentry *, struct inode **);
 // int vfs_mkdir(struct user_namespace *, struct inode *, struct dentry *, umode_t);
+//     struct dentry * since 6.15, see vfs_probe_mkdir_ret()
 // int vfs_rmdir(struct user_namespace *, struct inode *, struct dentry *);
 // int vfs_symlink(struct user_namespace *, struct inode *, struct dentry *, const char *);
 // int security_inode_create(struct inode *dir, struct dentry *dentry, umode_t mode);
 // int vfs_link(struct dentry *, struct user_namespace *, struct inode *, struct dentry *, struct inode **);
 DECL_VFS_KRP(vfs_create, ACT_NEW_FILE, 3);
 DECL_VFS_KRP(vfs_unlink, ACT_DEL_FILE, 3);
-DECL_VFS_KRP(vfs_mkdir, ACT_NEW_FOLDER, 3);
+_DECL_VFS_KRP(vfs_mkdir, ACT_NEW_FOLDER, 3, vfs_probe_mkdir_ret((struct vfs_probe_dentry_data *)ri->data, regs_return_value(regs)));
 DECL_VFS_KRP(vfs_rmdir, ACT_DEL_FOLDER, 3);
 DECL_VFS_KRP(vfs_symlink, ACT_NEW_SYMLINK, 3);
 DECL_VFS_KRP(security_inode_create, ACT_NEW_FILE, 2);
@@ -377,10 +223,15 @@ struct vfs_rename_args {
     struct vfs_event *te;
 };
 
+/*
+ * if kretprobe entry-handler returns a non-zero error,
+ * then the handler will not be called.
+ *
+ * https://www.kernel.org/doc/Documentation/kprobes.txt
+ */
 static int on_vfs_rename_ent(struct kretprobe_instance *ri, struct pt_regs *regs)
 {
-    unsigned char is_dir;
-    struct vfs_event **fe, **te;
+    struct vfs_rename_args *args = (struct vfs_rename_args *)ri->data;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 12, 0)
     // vfs-rename: struct inode*, struct dentry*, struct inode*, struct dentry*, struct inode**, unsigned int
     struct dentry *de_old = (struct dentry *)get_arg(regs, 2);
@@ -402,71 +253,14 @@ static int on_vfs_rename_ent(struct kretprobe_instance *ri, struct pt_regs *regs
     struct dentry *de_new = renamedata->new_dentry;
 #endif
 
-    if (de_old == 0 || de_old->d_sb == 0 || de_new == 0)
-        return 1;
-    if (IS_INVALID_DEVICE(de_old->d_sb->s_dev))
-        return 1;
-
-    fe = &((struct vfs_rename_args *)ri->data)->fe;
-    te = &((struct vfs_rename_args *)ri->data)->te;
-    *fe = 0;
-    *te = 0;
-
-    *fe = vfs_event_alloc_atomic();
-    if (unlikely(!*fe)) {
-        mpr_info("vfs_event_alloc_atomic fail\n");
-        return 1;
-    }
-    *te = vfs_event_alloc_atomic();
-    if (unlikely(!*te)) {
-        mpr_info("vfs_event_alloc_atomic fail\n");
-        goto fail;
-    }
-
-    (*fe)->path = dentry_path_raw(de_old, (*fe)->buf, sizeof((*fe)->buf));
-    if (IS_ERR((*fe)->path))
-        goto fail;
-    (*fe)->dev = de_old->d_sb->s_dev;
-    is_dir = d_is_dir(de_old);
-    (*fe)->action = is_dir ? ACT_RENAME_FROM_FOLDER : ACT_RENAME_FROM_FILE;
-
-    (*te)->path = dentry_path_raw(de_new, (*te)->buf, sizeof((*te)->buf));
-    if (IS_ERR((*te)->path))
-        goto fail;
-    (*te)->dev = (*fe)->dev;
-    (*te)->action = is_dir ? ACT_RENAME_TO_FOLDER : ACT_RENAME_TO_FILE;
-
-    return 0;
-
-fail:
-    if (*fe)
-        vfs_event_free(*fe);
-    if (*te)
-        vfs_event_free(*te);
-    return 1;
+    return vfs_probe_rename_ent(&args->fe, &args->te, de_old, de_new);
 }
 
 static int on_vfs_rename_ret(struct kretprobe_instance *ri, struct pt_regs *regs)
 {
-    struct vfs_event **fe = &((struct vfs_rename_args *)ri->data)->fe;
-    struct vfs_event **te = &((struct vfs_rename_args *)ri->data)->te;
-
-    if (regs_return_value(regs))
-        goto fail;
-
-    (*fe)->cookie = atomic_inc_return(&event_sync_cookie);
-    (*te)->cookie = (*fe)->cookie;
-
-    vfs_changed_entry(*fe);
-    vfs_changed_entry(*te);
-
-    return 0;
+    struct vfs_rename_args *args = (struct vfs_rename_args *)ri->data;
 
-fail:
-    if (*fe)
-        vfs_event_free(*fe);
-    if (*te)
-        vfs_event_free(*te);
+    vfs_probe_rename_ret(&args->fe, &args->te, regs_return_value(regs));
     return 0;
 }
 
@@ -479,20 +273,35 @@ static struct kretprobe *vfs_krps[] = {&do_mount_krp, &sys_umount_krp, &vfs_crea
 
 int init_vfs_kretprobes(void *vfs_changed_func)
 {
-    int ret;
+    int ret, i;
 
-    vfs_changed_entry = vfs_changed_func;
+    vfs_probe_init(vfs_changed_func);
+    /* 64 instances drop events under heavy parallel io on many cores */
+    for (i = 0; i < sizeof(vfs_krps) / sizeof(void *); ++i)
+        vfs_krps[i]->maxactive = vfs_probe_maxactive();
 
     ret = register_kretprobes(vfs_krps, sizeof(vfs_krps) / sizeof(void *));
     if (ret < 0) {
         mpr_info("register_kretprobes failed, returned %d\n", ret);
         return ret;
     }
-    mpr_info("register_kretprobes %ld ok\n", sizeof(vfs_krps) / sizeof(void *));
+    mpr_info("register_kretprobes %ld ok, maxactive %d\n", sizeof(vfs_krps) / sizeof(void *), vfs_probe_maxactive());
 
     return 0;
 }
 
+unsigned long vfs_kretprobes_nmissed(void)
+{
+    unsigned long nmissed = 0;
+    int i;
+
+    /* missed because no instance was free, or because the probe hit in a probe */
+    for (i = 0; i < sizeof(vfs_krps) / sizeof(void *); ++i)
+        nmissed += vfs_krps[i]->nmissed + vfs_krps[i]->kp.nmissed;
+
+    return nmissed;
+}
+
 void cleanup_vfs_kretprobes(void)
 {
     unregister_kretprobes(vfs_krps, sizeof(vfs_krps) / sizeof(void *));
@@ -8,5 +8,6 @@
 
 int init_vfs_kretprobes(void *vfs_changed_func);
 void cleanup_vfs_kretprobes(void);
+unsigned long vfs_kretprobes_nmissed(void);
 
 #endif
\ No newline at end of file
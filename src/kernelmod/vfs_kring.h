@@ -0,0 +1,14 @@
+// SPDX-FileCopyrightText: 2026 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef VFS_KRING_H
+#define VFS_KRING_H
+
+#include "event.h"
+
+int init_vfs_ring(void);
+void cleanup_vfs_ring(void);
+int vfs_ring_notify_vfs_events(struct list_head *events);
+
+#endif
@@ -0,0 +1,295 @@
+// SPDX-FileCopyrightText: 2026 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/dcache.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/namei.h>
+#include <linux/workqueue.h>
+#include <linux/cpumask.h>
+#include <linux/atomic.h>
+#include <linux/version.h>
+
+#include "vfs_probe.h"
+#include "vfs_change_consts.h"
+#include "event.h"
+#include "vfs_sysfs.h"
+#include "vfs_stats.h"
+
+
+extern unsigned long vfs_unnamed_devices[BITS_TO_LONGS(MAX_MINOR+1)];
+static int (*vfs_changed_entry)(struct vfs_event *event);
+static atomic_t event_sync_cookie = ATOMIC_INIT(0);
+
+void vfs_probe_init(void *vfs_changed_func)
+{
+    vfs_changed_entry = vfs_changed_func;
+}
+
+int vfs_probe_maxactive(void)
+{
+    return max_t(int, 64, 4 * num_possible_cpus());
+}
+
+/* the mount events are notified from a work, where the device can be queried */
+struct do_mount_work_stuct {
+    struct work_struct work;
+    char dir_name[NAME_MAX];
+};
+
+static void do_mount_work_handle(struct work_struct *work)
+{
+#ifdef QUERY_DEV_ON_MOUNT
+    struct path path;
+#endif
+    dev_t dev = 0;
+    struct do_mount_work_stuct *do_mount_work = (struct do_mount_work_stuct *)work;
+    struct vfs_event *event;
+
+#ifdef QUERY_DEV_ON_MOUNT
+    if (unlikely(kern_path(do_mount_work->dir_name, LOOKUP_FOLLOW, &path))) {
+        mpr_info("do_mount_work_handle, kern_path fail for %s\n", do_mount_work->dir_name);
+        goto quit;
+    }
+    dev = path.dentry->d_sb->s_dev;
+    path_put(&path);
+#endif
+
+    if (unlikely(strlen(do_mount_work->dir_name) >= VFS_EVENT_PATH_LEN)){
+        mpr_info("do_mount_work_handle, mountpoint is too long, %s\n", do_mount_work->dir_name);
+        goto quit;
+    }
+
+    event = vfs_event_alloc_atomic(do_mount_work->dir_name);
+    if (unlikely(!event)) {
+        mpr_info("do_mount_work_handle, vfs_event_alloc_atomic fail\n");
+        vfs_stat_action_inc(VFS_STAT_DROPPED, ACT_MOUNT);
+        goto quit;
+    }
+
+    event->action = ACT_MOUNT;
+    event->cookie = 0;
+    event->dev = dev;
+
+    vfs_changed_entry(event);
+
+quit:
+    kfree(do_mount_work);
+}
+
+void vfs_probe_mount_ret(const char *dir_name, long ret)
+{
+    struct do_mount_work_stuct *do_mount_work;
+
+    if (ret)
+        return;
+
+    do_mount_work = kmalloc(sizeof(struct do_mount_work_stuct), GFP_ATOMIC);
+    if (unlikely(0 == do_mount_work)) {
+        mpr_info("do_mount_work kmalloc failed\n");
+        return;
+    }
+    strcpy(do_mount_work->dir_name, dir_name);
+    INIT_WORK(&(do_mount_work->work), do_mount_work_handle);
+    schedule_work(&do_mount_work->work);
+}
+
+struct sys_umount_work_stuct {
+    struct work_struct work;
+    char dir_name[NAME_MAX];
+};
+
+static void sys_umount_work_handle(struct work_struct *work)
+{
+    struct sys_umount_work_stuct *sys_umount_work = (struct sys_umount_work_stuct *)work;
+    struct vfs_event *event;
+
+    if (unlikely(strlen(sys_umount_work->dir_name) >= VFS_EVENT_PATH_LEN)){
+        mpr_info("on_mount, mountpoint is too long, %s\n", sys_umount_work->dir_name);
+        goto quit;
+    }
+
+    event = vfs_event_alloc_atomic(sys_umount_work->dir_name);
+    if (unlikely(!event)) {
+        mpr_info("on_mount, vfs_event_alloc_atomic fail\n");
+        vfs_stat_action_inc(VFS_STAT_DROPPED, ACT_UNMOUNT);
+        goto quit;
+    }
+
+    event->action = ACT_UNMOUNT;
+    event->cookie = 0;
+    event->dev = 0;
+
+    vfs_changed_entry(event);
+
+quit:
+    kfree(sys_umount_work);
+}
+
+void vfs_probe_umount_ret(const char *dir_name, long ret)
+{
+    struct sys_umount_work_stuct *sys_umount_work;
+
+    if (ret)
+        return;
+
+    sys_umount_work = kmalloc(sizeof(struct sys_umount_work_stuct), GFP_ATOMIC);
+    if (unlikely(0 == sys_umount_work)) {
+        mpr_info("on_sys_umount_ret kmalloc failed\n");
+        return;
+    }
+    strcpy(sys_umount_work->dir_name, dir_name);
+    INIT_WORK(&(sys_umount_work->work), sys_umount_work_handle);
+    schedule_work(&sys_umount_work->work);
+}
+
+int vfs_probe_dentry_ent(struct vfs_probe_dentry_data *data, struct dentry *de, int action)
+{
+    char *buf, *path;
+
+    if (de == 0 || de->d_sb == 0)
+        return 1;
+    if (IS_INVALID_DEVICE(de->d_sb->s_dev))
+        return 1;
+
+    buf = vfs_path_scratch_get();
+    path = dentry_path_raw(de, buf, VFS_EVENT_PATH_LEN);
+    if (IS_ERR(path)) {
+        vfs_path_scratch_put();
+        mpr_info("dentry_path_raw fail, %ld\n", PTR_ERR(path));
+        return 1;
+    }
+    if (IS_FILTERED_EVENT(action, de->d_sb->s_dev, path)) {
+        vfs_path_scratch_put();
+        return 1;
+    }
+    data->event = vfs_event_alloc_atomic(path);
+    vfs_path_scratch_put();
+    if (unlikely(!data->event)) {
+        mpr_info("vfs_event_alloc_atomic fail\n");
+        vfs_stat_action_inc(VFS_STAT_DROPPED, action);
+        return 1;
+    }
+
+    data->event->dev = de->d_sb->s_dev;
+    data->event->cookie = 0;
+    data->de = de;
+
+    return 0;
+}
+
+void vfs_probe_dentry_ret(struct vfs_probe_dentry_data *data, long ret, int action)
+{
+    if (ret)
+        goto fail;
+
+    data->event->action = action;
+    /* the inode of a deleted dentry is of no use */
+    if (ACT_DEL_FILE != action && ACT_DEL_FOLDER != action)
+        vfs_event_set_attrs(data->event, d_inode(data->de));
+    vfs_changed_entry(data->event);
+    return;
+
+fail:
+    if (data->event)
+        vfs_event_free(data->event);
+}
+
+void vfs_probe_mkdir_ret(struct vfs_probe_dentry_data *data, long ret)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
+    /* an error pointer, or the dentry of the folder, the one passed in is put if they differ */
+    struct dentry *de = (struct dentry *)ret;
+
+    if (!IS_ERR_OR_NULL(de))
+        data->de = de;
+    ret = IS_ERR(de) ? PTR_ERR(de) : 0;
+#endif
+    vfs_probe_dentry_ret(data, ret, ACT_NEW_FOLDER);
+}
+
+int vfs_probe_rename_ent(struct vfs_event **fe, struct vfs_event **te, struct dentry *de_old, struct dentry *de_new)
+{
+    unsigned char is_dir;
+    int filtered;
+    char *buf, *path;
+
+    *fe = 0;
+    *te = 0;
+
+    if (de_old == 0 || de_old->d_sb == 0 || de_new == 0)
+        return 1;
+    if (IS_INVALID_DEVICE(de_old->d_sb->s_dev))
+        return 1;
+
+    is_dir = d_is_dir(de_old);
+    buf = vfs_path_scratch_get();
+    path = dentry_path_raw(de_old, buf, VFS_EVENT_PATH_LEN);
+    if (IS_ERR(path)) {
+        vfs_path_scratch_put();
+        mpr_info("dentry_path_raw of the rename source fail, %ld\n", PTR_ERR(path));
+        return 1;
+    }
+    /* a rename is filtered only when both paths are filtered */
+    filtered = IS_FILTERED_EVENT(is_dir ? ACT_RENAME_FROM_FOLDER : ACT_RENAME_FROM_FILE,
+        de_old->d_sb->s_dev, path);
+    *fe = vfs_event_alloc_atomic(path);
+    path = dentry_path_raw(de_new, buf, VFS_EVENT_PATH_LEN);
+    if (IS_ERR(path)) {
+        vfs_path_scratch_put();
+        mpr_info("dentry_path_raw of the rename target fail, %ld\n", PTR_ERR(path));
+        goto fail;
+    }
+    filtered = filtered && IS_FILTERED_EVENT(is_dir ? ACT_RENAME_TO_FOLDER : ACT_RENAME_TO_FILE,
+        de_old->d_sb->s_dev, path);
+    *te = filtered ? 0 : vfs_event_alloc_atomic(path);
+    vfs_path_scratch_put();
+    if (filtered)
+        goto fail;
+    if (unlikely(!*fe || !*te)) {
+        mpr_info("vfs_event_alloc_atomic fail\n");
+        vfs_stat_action_inc(VFS_STAT_DROPPED, is_dir ? ACT_RENAME_FROM_FOLDER : ACT_RENAME_FROM_FILE);
+        vfs_stat_action_inc(VFS_STAT_DROPPED, is_dir ? ACT_RENAME_TO_FOLDER : ACT_RENAME_TO_FILE);
+        goto fail;
+    }
+
+    (*fe)->dev = de_old->d_sb->s_dev;
+    (*fe)->action = is_dir ? ACT_RENAME_FROM_FOLDER : ACT_RENAME_FROM_FILE;
+
+    (*te)->dev = (*fe)->dev;
+    (*te)->action = is_dir ? ACT_RENAME_TO_FOLDER : ACT_RENAME_TO_FILE;
+    /* the inode moves with the dentry, its attributes are the same after the rename */
+    vfs_event_set_attrs(*te, d_inode(de_old));
+
+    return 0;
+
+fail:
+    if (*fe)
+        vfs_event_free(*fe);
+    if (*te)
+        vfs_event_free(*te);
+    return 1;
+}
+
+void vfs_probe_rename_ret(struct vfs_event **fe, struct vfs_event **te, long ret)
+{
+    if (ret)
+        goto fail;
+
+    (*fe)->cookie = atomic_inc_return(&event_sync_cookie);
+    (*te)->cookie = (*fe)->cookie;
+
+    vfs_changed_entry(*fe);
+    vfs_changed_entry(*te);
+
+    return;
+
+fail:
+    if (*fe)
+        vfs_event_free(*fe);
+    if (*te)
+        vfs_event_free(*te);
+}
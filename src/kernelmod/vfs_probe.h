@@ -0,0 +1,42 @@
+// SPDX-FileCopyrightText: 2026 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef VFS_PROBE_H
+#define VFS_PROBE_H
+
+#include <linux/types.h>
+#include <linux/dcache.h>
+
+#include "event.h"
+
+/*
+ * the handlers shared by the probe based event sources, kretprobes and fprobe
+ *
+ * a backend takes the arguments and the return value out of the registers
+ * in its own way, and calls the handlers with them.
+ * an entry handler returns non-zero if the return handler should not be called.
+ */
+void vfs_probe_init(void *vfs_changed_func);
+/* the instances of a probe, enough for every cpu to be in a few probed calls at once */
+int vfs_probe_maxactive(void);
+
+void vfs_probe_mount_ret(const char *dir_name, long ret);
+void vfs_probe_umount_ret(const char *dir_name, long ret);
+
+/* the data kept from the entry to the return of a dentry probe */
+struct vfs_probe_dentry_data {
+    struct vfs_event *event;
+    /* the inode of a new dentry is known only on return */
+    struct dentry *de;
+};
+
+int vfs_probe_dentry_ent(struct vfs_probe_dentry_data *data, struct dentry *de, int action);
+void vfs_probe_dentry_ret(struct vfs_probe_dentry_data *data, long ret, int action);
+/* vfs_mkdir returns the new dentry since 6.15, ret is taken as such then */
+void vfs_probe_mkdir_ret(struct vfs_probe_dentry_data *data, long ret);
+
+int vfs_probe_rename_ent(struct vfs_event **fe, struct vfs_event **te, struct dentry *de_old, struct dentry *de_new);
+void vfs_probe_rename_ret(struct vfs_event **fe, struct vfs_event **te, long ret);
+
+#endif
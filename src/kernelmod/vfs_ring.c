@@ -0,0 +1,391 @@
+// SPDX-FileCopyrightText: 2026 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/miscdevice.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
+#include <linux/rculist.h>
+#include <linux/atomic.h>
+#include <linux/kdev_t.h>
+#include <linux/string.h>
+#include <linux/version.h>
+
+#include "vfs_ring.h"
+#include "vfs_kring.h"
+#include "vfs_dev_seq.h"
+#include "vfs_stats.h"
+#include "event.h"
+
+/*
+ * every consumer has private rings, so a consumer can only lose its own events,
+ * the number of consumers is limited, the rings of each one take
+ * VFS_RING_DATA_PAGES pages per cpu.
+ */
+#define VFS_RING_MAX_CONSUMERS  4
+#define VFS_RING_DATA_PAGES     64
+
+/* the geometry is kept out of the mapped area, the consumer can write there */
+struct ring_consumer {
+    struct list_head list;
+    void *area;
+    u32 ring_count;
+    u32 ring_stride;
+    u32 data_size;
+    spinlock_t *locks;
+    struct vfs_lost_devs *lost;     /* per ring, under the lock of the ring */
+    wait_queue_head_t wait;
+};
+
+static LIST_HEAD(ring_consumers);
+static DEFINE_MUTEX(ring_consumers_mutex);
+static int ring_consumers_number;
+static atomic64_t ring_seq = ATOMIC64_INIT(0);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 16, 0)
+#define ring_poll_t unsigned int
+#else
+#define ring_poll_t __poll_t
+#endif
+
+static inline struct vfs_ring_header *ring_header(struct ring_consumer *consumer, int i)
+{
+    return consumer->area + PAGE_SIZE + (size_t)i * consumer->ring_stride;
+}
+
+static inline char *ring_data(struct ring_consumer *consumer, int i)
+{
+    return (char *)ring_header(consumer, i) + PAGE_SIZE;
+}
+
+static inline void ring_put_pad(char *data, u32 len)
+{
+    struct vfs_ring_record *record = (struct vfs_ring_record *)data;
+
+    if (len < sizeof(struct vfs_ring_record))
+        return;
+    record->len = len;
+    record->action = VFS_RING_ACT_PAD;
+}
+
+struct ring_writer {
+    struct vfs_ring_header *header;
+    char *data;
+    u32 size;
+    u64 head;
+    u64 tail;
+};
+
+/* reserve len bytes at head, padding the end of data if needed, NULL if they do not fit */
+static struct vfs_ring_record *ring_reserve(struct ring_writer *writer, u32 len)
+{
+    u32 size = writer->size;
+    u32 offset = writer->head & (size - 1);
+    u32 contiguous = size - offset;
+    u32 need = contiguous < len ? contiguous + len : len;
+    u64 used = writer->head - writer->tail;
+
+    /* the consumer may have moved, check again before dropping */
+    if (used > size || need > size - used) {
+        writer->tail = smp_load_acquire(&writer->header->tail);
+        used = writer->head - writer->tail;
+    }
+    if (used > size || need > size - used)
+        return NULL;
+
+    if (contiguous < len) {
+        ring_put_pad(writer->data + offset, contiguous);
+        writer->head += contiguous;
+        offset = 0;
+    }
+    writer->head += len;
+
+    return (struct vfs_ring_record *)(writer->data + offset);
+}
+
+static int ring_put_lost(struct ring_writer *writer, dev_t dev, u64 dev_seq)
+{
+    struct vfs_ring_record *record;
+    u32 len = ALIGN(sizeof(struct vfs_ring_record) + 1, VFS_RING_ALIGN);
+
+    record = ring_reserve(writer, len);
+    if (!record)
+        return -ENOSPC;
+
+    record->len = len;
+    record->action = VFS_RING_ACT_LOST;
+    record->reserved = 0;
+    record->major = MAJOR(dev);
+    record->minor = MINOR(dev);
+    record->cookie = 0;
+    record->seq = atomic64_inc_return(&ring_seq);
+    record->dev_seq = dev_seq;
+    record->ino = 0;
+    record->size = 0;
+    record->mtime = 0;
+    record->time = 0;
+    record->mode = 0;
+    record->reserved2 = 0;
+    record->path[0] = '\0';
+
+    return 0;
+}
+
+/* the lost records go before the new events, as many as fit */
+static int ring_put_lost_devs(struct ring_writer *writer, struct vfs_lost_devs *lost)
+{
+    int i;
+
+    if (lost->overflow) {
+        if (ring_put_lost(writer, 0, 0))
+            return 0;
+        lost->overflow = 0;
+        lost->count = 0;
+        return 1;
+    }
+
+    for (i = 0; i < lost->count; ++i) {
+        if (ring_put_lost(writer, lost->devs[i], lost->seqs[i]))
+            break;
+    }
+    vfs_lost_devs_drop(lost, i);
+
+    return i;
+}
+
+/* write the events to the ring of current cpu, drop the events that do not fit */
+static void ring_write_events(struct ring_consumer *consumer, struct list_head *events)
+{
+    struct vfs_event *event;
+    struct vfs_ring_record *record;
+    struct vfs_lost_devs *lost;
+    struct ring_writer writer;
+    unsigned long flags;
+    u32 len, path_len;
+    int cpu, written = 0;
+
+    cpu = get_cpu();
+    writer.header = ring_header(consumer, cpu);
+    writer.data = ring_data(consumer, cpu);
+    writer.size = consumer->data_size;
+    lost = &consumer->lost[cpu];
+
+    spin_lock_irqsave(&consumer->locks[cpu], flags);
+    writer.head = writer.header->head;
+    writer.tail = smp_load_acquire(&writer.header->tail);
+    if (lost->count || lost->overflow)
+        written += ring_put_lost_devs(&writer, lost);
+    list_for_each_entry(event, events, list) {
+        path_len = strlen(event->path) + 1;
+        len = ALIGN(sizeof(struct vfs_ring_record) + path_len, VFS_RING_ALIGN);
+        record = ring_reserve(&writer, len);
+        if (!record) {
+            WRITE_ONCE(writer.header->lost, writer.header->lost + 1);
+            vfs_lost_devs_add(lost, event->dev, event->seq);
+            vfs_stat_action_inc(VFS_STAT_DROPPED, event->action);
+            continue;
+        }
+
+        record->len = len;
+        record->action = event->action;
+        record->reserved = 0;
+        record->major = MAJOR(event->dev);
+        record->minor = MINOR(event->dev);
+        record->cookie = event->cookie;
+        record->seq = atomic64_inc_return(&ring_seq);
+        record->dev_seq = event->seq;
+        record->ino = event->ino;
+        record->size = event->size;
+        record->mtime = event->mtime;
+        record->time = event->time;
+        record->mode = event->mode;
+        record->reserved2 = 0;
+        memcpy(record->path, event->path, path_len);
+        ++written;
+    }
+    /* publish the records */
+    smp_store_release(&writer.header->head, writer.head);
+    spin_unlock_irqrestore(&consumer->locks[cpu], flags);
+    put_cpu();
+
+    if (written)
+        wake_up_interruptible(&consumer->wait);
+}
+
+int vfs_ring_notify_vfs_events(struct list_head *events)
+{
+    struct ring_consumer *consumer;
+
+    rcu_read_lock();
+    list_for_each_entry_rcu(consumer, &ring_consumers, list)
+        ring_write_events(consumer, events);
+    rcu_read_unlock();
+
+    return 0;
+}
+
+static struct ring_consumer *ring_consumer_new(void)
+{
+    struct ring_consumer *consumer;
+    struct vfs_ring_info *info;
+    u32 ring_stride, data_size = VFS_RING_DATA_PAGES * PAGE_SIZE;
+    size_t area_size;
+    int i;
+
+    ring_stride = PAGE_SIZE + data_size;
+    area_size = PAGE_SIZE + (size_t)nr_cpu_ids * ring_stride;
+
+    consumer = kzalloc(sizeof(*consumer), GFP_KERNEL);
+    if (!consumer)
+        return NULL;
+
+    consumer->locks = kcalloc(nr_cpu_ids, sizeof(spinlock_t), GFP_KERNEL);
+    if (!consumer->locks)
+        goto fail;
+    for (i = 0; i < nr_cpu_ids; ++i)
+        spin_lock_init(&consumer->locks[i]);
+
+    consumer->lost = kcalloc(nr_cpu_ids, sizeof(struct vfs_lost_devs), GFP_KERNEL);
+    if (!consumer->lost)
+        goto fail;
+
+    /* zeroed, all rings start empty */
+    consumer->area = vmalloc_user(area_size);
+    if (!consumer->area)
+        goto fail;
+
+    info = consumer->area;
+    info->version = VFS_RING_VERSION;
+    info->ring_count = nr_cpu_ids;
+    info->ring_offset = PAGE_SIZE;
+    info->ring_stride = ring_stride;
+    info->data_offset = PAGE_SIZE;
+    info->data_size = data_size;
+    info->area_size = area_size;
+    consumer->ring_count = nr_cpu_ids;
+    consumer->ring_stride = ring_stride;
+    consumer->data_size = data_size;
+
+    init_waitqueue_head(&consumer->wait);
+
+    return consumer;
+
+fail:
+    kfree(consumer->lost);
+    kfree(consumer->locks);
+    kfree(consumer);
+    return NULL;
+}
+
+static void ring_consumer_free(struct ring_consumer *consumer)
+{
+    vfree(consumer->area);
+    kfree(consumer->lost);
+    kfree(consumer->locks);
+    kfree(consumer);
+}
+
+static int vfs_ring_open(struct inode *inode, struct file *file)
+{
+    struct ring_consumer *consumer;
+
+    mutex_lock(&ring_consumers_mutex);
+    if (ring_consumers_number >= VFS_RING_MAX_CONSUMERS) {
+        mutex_unlock(&ring_consumers_mutex);
+        return -EBUSY;
+    }
+
+    consumer = ring_consumer_new();
+    if (!consumer) {
+        mutex_unlock(&ring_consumers_mutex);
+        return -ENOMEM;
+    }
+
+    list_add_tail_rcu(&consumer->list, &ring_consumers);
+    ++ring_consumers_number;
+    mutex_unlock(&ring_consumers_mutex);
+
+    file->private_data = consumer;
+
+    return nonseekable_open(inode, file);
+}
+
+static int vfs_ring_release(struct inode *inode, struct file *file)
+{
+    struct ring_consumer *consumer = file->private_data;
+
+    mutex_lock(&ring_consumers_mutex);
+    list_del_rcu(&consumer->list);
+    --ring_consumers_number;
+    mutex_unlock(&ring_consumers_mutex);
+
+    /* wait for the writers which still see the consumer */
+    synchronize_rcu();
+    ring_consumer_free(consumer);
+
+    return 0;
+}
+
+static int vfs_ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct ring_consumer *consumer = file->private_data;
+
+    return remap_vmalloc_range(vma, consumer->area, vma->vm_pgoff);
+}
+
+static ring_poll_t vfs_ring_poll(struct file *file, poll_table *wait)
+{
+    struct ring_consumer *consumer = file->private_data;
+    struct vfs_ring_header *header;
+    int i;
+
+    poll_wait(file, &consumer->wait, wait);
+
+    for (i = 0; i < consumer->ring_count; ++i) {
+        header = ring_header(consumer, i);
+        if (smp_load_acquire(&header->head) != READ_ONCE(header->tail))
+            return POLLIN | POLLRDNORM;
+    }
+
+    return 0;
+}
+
+static const struct file_operations vfs_ring_fops = {
+    .owner = THIS_MODULE,
+    .open = vfs_ring_open,
+    .release = vfs_ring_release,
+    .mmap = vfs_ring_mmap,
+    .poll = vfs_ring_poll,
+};
+
+/*
+ * only root opens the rings, an open pins a ring of vmalloc memory per cpu and
+ * the opens are limited to VFS_RING_MAX_CONSUMERS, the other users take the
+ * same events from the genl groups
+ */
+static struct miscdevice vfs_ring_device = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = VFS_RING_DEVICE_NAME,
+    .fops = &vfs_ring_fops,
+    .mode = 0600,
+};
+
+int init_vfs_ring(void)
+{
+    int ret = misc_register(&vfs_ring_device);
+    if (ret)
+        mpr_err("init_vfs_ring fail: %d\n", ret);
+    return ret;
+}
+
+void cleanup_vfs_ring(void)
+{
+    misc_deregister(&vfs_ring_device);
+}
@@ -0,0 +1,78 @@
+// SPDX-FileCopyrightText: 2026 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef VFS_RING_H
+#define VFS_RING_H
+
+#include <linux/types.h>
+
+/*
+ * shared memory transport
+ *
+ * every open of /dev/vfs_monitor gets its own set of per-cpu rings, the whole
+ * set is mapped with one mmap of VFS_RING_INFO.area_size bytes from offset 0:
+ *
+ *   page 0                         struct vfs_ring_info
+ *   ring_offset + i * ring_stride  struct vfs_ring_header of ring i
+ *   ... + data_offset              data_size bytes of records of ring i
+ *
+ * the kernel writes records at head, the consumer reads them at tail, both
+ * only grow, the position in data is (head|tail) & (data_size - 1).
+ * a record that does not fit before the end of data is preceded by a pad
+ * record that fills the rest, when the rest is shorter than a record header
+ * the consumer skips it without pad.
+ *
+ * records of all rings carry one global seq, sort by it to restore the order.
+ * besides, every record carries the seq of its event in its device.
+ *
+ * the events that do not fit are dropped and counted in lost, the ring then
+ * writes a lost record for each of their devices as soon as it has room, with
+ * dev_seq of the last lost event, a lost record of device 0:0 means the events
+ * of all devices are lost.
+ */
+
+/* the device is /dev/VFS_RING_DEVICE_NAME */
+#define VFS_RING_DEVICE_NAME "vfs_monitor"
+#define VFS_RING_VERSION 4
+
+#define VFS_RING_ALIGN 8
+#define VFS_RING_ACT_PAD 0xff
+#define VFS_RING_ACT_LOST 0xfe
+
+struct vfs_ring_info {
+    __u32 version;
+    __u32 ring_count;
+    __u32 ring_offset;
+    __u32 ring_stride;
+    __u32 data_offset;
+    __u32 data_size;
+    __u64 area_size;
+};
+
+struct vfs_ring_header {
+    __u64 head;     /* written by kernel */
+    __u64 tail;     /* written by consumer */
+    __u64 lost;     /* events dropped because the ring was full */
+};
+
+struct vfs_ring_record {
+    __u32 len;      /* the whole record, aligned to VFS_RING_ALIGN */
+    __u8 action;
+    __u8 reserved;
+    __u16 major;
+    __u32 minor;
+    __u32 cookie;
+    __u64 seq;
+    __u64 dev_seq;
+    /* the attributes of the inode at event time, mode is 0 if there are none */
+    __u64 ino;
+    __u64 size;
+    __s64 mtime;
+    __u64 time;     /* the CLOCK_MONOTONIC ns when the event was captured */
+    __u32 mode;
+    __u32 reserved2;
+    char path[];
+};
+
+#endif
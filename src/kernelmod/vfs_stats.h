@@ -0,0 +1,63 @@
+// SPDX-FileCopyrightText: 2026 UnionTech Software Technology Co., Ltd.
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef VFS_STATS_H
+#define VFS_STATS_H
+
+#include <linux/percpu.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/time.h>
+#include "vfs_change_consts.h"
+
+/*
+ * statistics
+ *
+ * per-cpu counters, summed up when /sys/kernel/vfs_monitor/stats is read,
+ * so counting costs no shared cache line on the event path.
+ */
+enum vfs_action_stat {
+    VFS_STAT_SEEN,      /* entered the merge buffer */
+    VFS_STAT_MERGED,    /* removed by a merge rule, by the action it entered with */
+    VFS_STAT_DROPPED,   /* not allocated, or not taken by a transport */
+    VFS_ACTION_STATS,
+};
+
+#define VFS_STAT_ACTIONS        (ACT_MODIFY_FILE + 1)
+/* bucket i counts the residence times in [2^i, 2^(i+1)) us, bucket 0 also counts < 1 us */
+#define VFS_RESIDENCE_BUCKETS   24
+
+struct vfs_stats {
+    unsigned long actions[VFS_ACTION_STATS][VFS_STAT_ACTIONS];
+    unsigned long alloc_failures;
+    unsigned long genl_new_failures;
+    unsigned long genl_multicast_failures;
+    unsigned long genl_deferred;        /* dentry events kept in the overflow queue */
+    unsigned long genl_overflows;       /* the overflow queue is dropped */
+    unsigned long residence[VFS_RESIDENCE_BUCKETS];
+};
+
+DECLARE_PER_CPU(struct vfs_stats, vfs_stats);
+
+#define vfs_stat_inc(field) this_cpu_inc(vfs_stats.field)
+#define vfs_stat_add(field, n) this_cpu_add(vfs_stats.field, n)
+
+static inline void vfs_stat_action_inc(enum vfs_action_stat stat, unsigned char action)
+{
+    if (likely(action < VFS_STAT_ACTIONS))
+        this_cpu_inc(vfs_stats.actions[stat][action]);
+}
+
+/* the time between entering and leaving the merge buffer */
+static inline void vfs_stat_residence(u64 ns)
+{
+    u64 us = div_u64(ns, NSEC_PER_USEC);
+    int bucket = us ? ilog2(us) : 0;
+
+    if (bucket >= VFS_RESIDENCE_BUCKETS)
+        bucket = VFS_RESIDENCE_BUCKETS - 1;
+    this_cpu_inc(vfs_stats.residence[bucket]);
+}
+
+#endif /* VFS_STATS_H */
@@ -8,88 +8,351 @@
 #include <linux/module.h>
 #include <linux/string.h>
 #include <linux/sysfs.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/kdev_t.h>
 #include "vfs_sysfs.h"
 #include "vfs_log.h"
+#include "vfs_stats.h"
+#include "vfs_kretprobes.h"
+#include "vfs_fprobe.h"
+#include "event_merge.h"
+#include "vfs_kgenl.h"
 
 
 static struct kobject *vfs_monitor;
 
 /* unnamed devices monitor enable bit map */
-/* vfs_unnamed_devices[N] = 1 means the device with number 0:N is monitor enabled */
-char vfs_unnamed_devices[MAX_MINOR+1];
+/* test_bit(N, vfs_unnamed_devices) means the device with number 0:N is monitor enabled */
+DECLARE_BITMAP(vfs_unnamed_devices, MAX_MINOR+1);
 /* trace event process info mask */
 /* trace_event_mask & (1 << ACT_DEL_FILE) means the file delete event is trace enabled */
 unsigned int trace_event_mask;
 int disable_event_merge;
-
-#define MAX_INPUT_MINOR (MAX_MINOR+1)
+/* merge tunables, see event_merge.c */
+unsigned int merge_buffer_size = 256;
+unsigned int merge_timeout_ms = 100;
+unsigned int merge_dump_size = 10;
+int adaptive_event_merge;
+/* the creates in one folder within the window to collapse them, 0 disables it */
+unsigned int burst_collapse_threshold = 64;
+/* send the dirs of a batch once, see the compact path encoding in vfs_genl.h */
+unsigned int compact_path_encoding;
+/* report the writes of files, coalesced per inode in a window, see vfs_fsnotify.c */
+unsigned int modify_events;
+unsigned int modify_coalesce_ms = 1000;
+/* the dentry events kept for the genl listeners that stall, see vfs_genl.c, 0 disables it */
+unsigned int genl_overflow_size = 1024;
 
 static ssize_t vfs_unnamed_devices_show(struct kobject *kobj,
                             struct kobj_attribute *attr, char *buf)
 {
-    /* the size of buf is PAGE_SIZE, typically 4096 bytes, That's enough for us */
-    char *pbuf = buf;
-    int first = 1;
+    /*
+     * the size of buf is PAGE_SIZE, the read fails if the devices do not fit,
+     * a part of the list would be taken for the whole of it
+     */
+    ssize_t len = 0;
+    int i;
+
+    for_each_set_bit(i, vfs_unnamed_devices, MAX_MINOR+1) {
+        len += snprintf(buf + len, PAGE_SIZE - len, len ? ",%d" : "%d", i);
+        /* the newline has to fit too */
+        if (len >= PAGE_SIZE - 1)
+            return -EFBIG;
+    }
+    buf[len++] = '\n';
+
+    return len;
+}
+
+/* the updates are made to a copy, then the copy replaces the map in one go */
+static DECLARE_BITMAP(vfs_unnamed_devices_update, MAX_MINOR+1);
+static DEFINE_MUTEX(vfs_unnamed_devices_lock);
+
+/* apply one command to map, return -EINVAL if it is invalid */
+static int vfs_unnamed_devices_apply(unsigned long *map, const char *cmd)
+{
+    unsigned int minor;
+
+    switch (cmd[0]) {
+    case 'e':
+        /* eN is accepted for compatibility, N is ignored */
+        if (cmd[1] && kstrtouint(cmd + 1, 10, &minor))
+            return -EINVAL;
+        bitmap_zero(map, MAX_MINOR+1);
+        return 0;
+    case 'a':
+    case 'r':
+        if (kstrtouint(cmd + 1, 10, &minor) || minor > MAX_MINOR)
+            return -EINVAL;
+        if (cmd[0] == 'a')
+            __set_bit(minor, map);
+        else
+            __clear_bit(minor, map);
+        return 0;
+    default:
+        return -EINVAL;
+    }
+}
+
+/*
+ * aN: set bit N
+ * rN: clear bit N
+ * e: clear all bits
+ * N in [0, MAX_MINOR]
+ *
+ * a write holds a list of commands separated by ',' or spaces, applied in order,
+ * either all of them take effect at once or none of them if one is invalid.
+ * the bits that are the same before and after the write are not touched on the
+ * way, "e,a1,a2" does not stop the events of 0:1 even for a moment.
+ */
+static ssize_t vfs_unnamed_devices_store(struct kobject *kobj,
+                                struct kobj_attribute *attr, char *buf,
+                                size_t count)
+{
+    char *cmds, *pos, *cmd;
+    int ret = 0;
 
-    pbuf[0] = '\0';
-    for (int i = 0; i <= MAX_MINOR; ++i) {
-        if (!vfs_unnamed_devices[i])
+    cmds = kstrndup(buf, count, GFP_KERNEL);
+    if (!cmds)
+        return -ENOMEM;
+
+    mutex_lock(&vfs_unnamed_devices_lock);
+    bitmap_copy(vfs_unnamed_devices_update, vfs_unnamed_devices, MAX_MINOR+1);
+    pos = cmds;
+    while ((cmd = strsep(&pos, ", \t\n")) != NULL) {
+        if (!*cmd)
             continue;
+        ret = vfs_unnamed_devices_apply(vfs_unnamed_devices_update, cmd);
+        if (ret)
+            break;
+    }
+    /* word by word, a bit that does not change is never seen changed by the probes */
+    if (!ret)
+        bitmap_copy(vfs_unnamed_devices, vfs_unnamed_devices_update, MAX_MINOR+1);
+    mutex_unlock(&vfs_unnamed_devices_lock);
+
+    kfree(cmds);
+    return ret ? ret : count;
+}
+
+static struct kobj_attribute vfs_unnamed_devices_attribute =
+    __ATTR(vfs_unnamed_devices, 0660, vfs_unnamed_devices_show, (void *)vfs_unnamed_devices_store);
+
+/*
+ * path filters
+ *
+ * per device include/exclude path prefixes, the path is the path in the device,
+ * as it is in the events.
+ * an event of a device with include prefixes passes only when its path is under
+ * one of them, an event under an exclude prefix never passes.
+ * a device without any prefix is not filtered.
+ *
+ * the filters are replaced as a whole on every change, readers use rcu.
+ */
+#define MAX_PATH_FILTERS 64
+
+struct path_filter {
+    dev_t dev;
+    int exclude;
+    size_t len;
+    char *prefix;
+};
+
+struct path_filters {
+    struct rcu_head rcu;
+    int count;
+    struct path_filter filters[];
+};
+
+static struct path_filters __rcu *vfs_path_filters;
+static DEFINE_MUTEX(vfs_path_filters_mutex);
 
-        if (first) {
-            first = 0;
-            sprintf(pbuf, "%d", i);
+static void free_path_filters(struct path_filters *filters)
+{
+    int i;
+
+    if (!filters)
+        return;
+    for (i = 0; i < filters->count; ++i)
+        kfree(filters->filters[i].prefix);
+    kfree(filters);
+}
+
+static void free_path_filters_rcu(struct rcu_head *rcu)
+{
+    free_path_filters(container_of(rcu, struct path_filters, rcu));
+}
+
+/* prefix ends with '/', or the path continues with '/' after it */
+static inline int is_path_under(const char *path, const struct path_filter *filter)
+{
+    if (strncmp(path, filter->prefix, filter->len))
+        return 0;
+    return filter->prefix[filter->len - 1] == '/' || path[filter->len] == '\0' || path[filter->len] == '/';
+}
+
+int vfs_path_filtered(dev_t dev, const char *path)
+{
+    struct path_filters *filters;
+    struct path_filter *filter;
+    int i, has_include = 0, included = 0, excluded = 0;
+
+    rcu_read_lock();
+    filters = rcu_dereference(vfs_path_filters);
+    for (i = 0; filters && i < filters->count && !excluded; ++i) {
+        filter = &filters->filters[i];
+        if (filter->dev != dev)
+            continue;
+        if (filter->exclude) {
+            excluded = is_path_under(path, filter);
+        } else {
+            has_include = 1;
+            included = included || is_path_under(path, filter);
         }
-        else {
-            sprintf(pbuf, ",%d", i);
+    }
+    rcu_read_unlock();
+
+    return excluded || (has_include && !included);
+}
+
+static ssize_t vfs_path_filters_show(struct kobject *kobj,
+                            struct kobj_attribute *attr, char *buf)
+{
+    struct path_filters *filters;
+    struct path_filter *filter;
+    ssize_t len = 0;
+    int i;
+
+    rcu_read_lock();
+    filters = rcu_dereference(vfs_path_filters);
+    for (i = 0; filters && i < filters->count; ++i) {
+        filter = &filters->filters[i];
+        len += scnprintf(buf + len, PAGE_SIZE - len, "%c%u:%u %s\n", filter->exclude ? 'x' : 'i',
+                         MAJOR(filter->dev), MINOR(filter->dev), filter->prefix);
+    }
+    rcu_read_unlock();
+
+    return len;
+}
+
+/* apply one command to filters, which has room for MAX_PATH_FILTERS, return -errno if it fails */
+static int vfs_path_filters_apply(struct path_filters *filters, char *cmd)
+{
+    struct path_filter *filter;
+    unsigned int major = 0, minor = 0;
+    char act, *prefix = NULL;
+    dev_t dev = 0;
+    int i, n, ret;
+
+    act = cmd[0];
+    if (act == 'i' || act == 'x' || act == 'c') {
+        ret = sscanf(cmd + 1, "%u:%u%n", &major, &minor, &n);
+        if (ret != 2)
+            return -EINVAL;
+        dev = MKDEV(major, minor);
+        prefix = strim(cmd + 1 + n);
+        if (act != 'c' && prefix[0] != '/')
+            return -EINVAL;
+    } else if (act != 'e') {
+        return -EINVAL;
+    }
+
+    if (act == 'e' || act == 'c') {
+        /* keep the prefixes which are not removed */
+        for (i = 0, n = 0; i < filters->count; ++i) {
+            filter = &filters->filters[i];
+            if (act == 'e' || filter->dev == dev)
+                kfree(filter->prefix);
+            else
+                filters->filters[n++] = *filter;
         }
-        
-        /* move to pbuf tail */
-        while (*(++pbuf)) ;
+        filters->count = n;
+        return 0;
     }
-    pbuf[0] = '\n';
-    pbuf[1] = '\0';
 
-    return strlen(buf);
+    if (filters->count >= MAX_PATH_FILTERS)
+        return -ENOSPC;
+    filter = &filters->filters[filters->count];
+    filter->dev = dev;
+    filter->exclude = act == 'x';
+    filter->len = strlen(prefix);
+    filter->prefix = kstrdup(prefix, GFP_KERNEL);
+    if (!filter->prefix)
+        return -ENOMEM;
+    ++filters->count;
+    return 0;
 }
 
 /*
- * aN: set vfs_unnamed_devices[N] to 1
- * rN: set vfs_unnamed_devices[N] to 0
- * eN: set vfs_unnamed_devices[*] to 0
- * N in [0, 255]
+ * iMAJ:MIN PREFIX: add include PREFIX for device MAJ:MIN
+ * xMAJ:MIN PREFIX: add exclude PREFIX for device MAJ:MIN
+ * cMAJ:MIN: clear the prefixes of device MAJ:MIN
+ * e: clear all prefixes
+ *
+ * a write holds a list of commands, one per line, applied in order to a copy
+ * of the filters, the copy replaces them at once, or nothing changes if one of
+ * the commands fails. "e" and the prefixes that follow it never let the events
+ * of the filtered paths through on the way.
  */
-static ssize_t vfs_unnamed_devices_store(struct kobject *kobj,
+static ssize_t vfs_path_filters_store(struct kobject *kobj,
                                 struct kobj_attribute *attr, char *buf,
                                 size_t count)
 {
-    char act;
-    unsigned char minor;
-    int ret;
+    struct path_filters *old, *new;
+    struct path_filter *filter;
+    char *cmds, *pos, *cmd;
+    int i, ret = 0;
 
-    ret = sscanf(buf, "%c%hhu", &act, &minor);
-    if (ret != 2)
-        return -EINVAL;
+    cmds = kstrndup(buf, count, GFP_KERNEL);
+    if (!cmds)
+        return -ENOMEM;
 
-    switch (act) {
-    case 'e':
-        memset (vfs_unnamed_devices, 0, sizeof(vfs_unnamed_devices));
-        break;
-    case 'a':
-        vfs_unnamed_devices[minor] = 1;
-        break;
-    case 'r':
-        vfs_unnamed_devices[minor] = 0;
-        break;
-    default:
-        return -EINVAL;
+    mutex_lock(&vfs_path_filters_mutex);
+    old = rcu_dereference_protected(vfs_path_filters, lockdep_is_held(&vfs_path_filters_mutex));
+
+    new = kzalloc(sizeof(*new) + MAX_PATH_FILTERS * sizeof(struct path_filter), GFP_KERNEL);
+    if (!new) {
+        ret = -ENOMEM;
+        goto quit;
     }
 
-    return count;
+    for (i = 0; old && i < old->count; ++i) {
+        filter = &old->filters[i];
+        new->filters[new->count] = *filter;
+        new->filters[new->count].prefix = kstrdup(filter->prefix, GFP_KERNEL);
+        if (!new->filters[new->count].prefix) {
+            ret = -ENOMEM;
+            goto quit;
+        }
+        ++new->count;
+    }
+
+    pos = cmds;
+    while ((cmd = strsep(&pos, "\n")) != NULL) {
+        cmd = skip_spaces(cmd);
+        if (!*cmd)
+            continue;
+        ret = vfs_path_filters_apply(new, cmd);
+        if (ret)
+            goto quit;
+    }
+
+    rcu_assign_pointer(vfs_path_filters, new);
+    if (old)
+        call_rcu(&old->rcu, free_path_filters_rcu);
+    new = NULL;
+
+quit:
+    mutex_unlock(&vfs_path_filters_mutex);
+    free_path_filters(new);
+    kfree(cmds);
+    return ret ? ret : count;
 }
 
-static struct kobj_attribute vfs_unnamed_devices_attribute =
-    __ATTR(vfs_unnamed_devices, 0660, vfs_unnamed_devices_show, (void *)vfs_unnamed_devices_store);
+static struct kobj_attribute vfs_path_filters_attribute =
+    __ATTR(vfs_path_filters, 0660, vfs_path_filters_show, (void *)vfs_path_filters_store);
 
 static ssize_t trace_event_mask_show(struct kobject *kobj,
                             struct kobj_attribute *attr, char *buf)
@@ -140,6 +403,157 @@ static ssize_t disable_event_merge_store(struct kobject *kobj,
 static struct kobj_attribute disable_event_merge_attribute =
     __ATTR(disable_event_merge, 0660, disable_event_merge_show, (void *)disable_event_merge_store);
 
+/* the tunables are stored under it, so the checks against each other hold */
+static DEFINE_MUTEX(merge_tunables_lock);
+
+/* an unsigned int attribute that accepts values in [min, max] for which valid is true */
+#define DECL_CHECKED_TUNABLE_ATTR(name, min, max, valid) \
+static ssize_t name##_show(struct kobject *kobj, \
+                            struct kobj_attribute *attr, char *buf) \
+{ \
+    return sprintf(buf, "%u\n", name); \
+} \
+static ssize_t name##_store(struct kobject *kobj, \
+                                struct kobj_attribute *attr, char *buf, \
+                                size_t count) \
+{ \
+    unsigned int value; \
+    if (sscanf(buf, "%u", &value) != 1 || value < (min) || value > (max)) \
+        return -EINVAL; \
+    mutex_lock(&merge_tunables_lock); \
+    if (!(valid)) { \
+        mutex_unlock(&merge_tunables_lock); \
+        return -EINVAL; \
+    } \
+    WRITE_ONCE(name, value); \
+    mutex_unlock(&merge_tunables_lock); \
+    return count; \
+} \
+static struct kobj_attribute name##_attribute = \
+    __ATTR(name, 0660, name##_show, (void *)name##_store);
+
+/* an unsigned int attribute that accepts values in [min, max] */
+#define DECL_TUNABLE_ATTR(name, min, max) DECL_CHECKED_TUNABLE_ATTR(name, min, max, 1)
+
+/*
+ * the buffer is notified once it holds merge_buffer_size events, the creates
+ * of a folder never reach a threshold that is not below it, lower the
+ * threshold before the buffer size
+ */
+DECL_CHECKED_TUNABLE_ATTR(merge_buffer_size, 1, 4096, value > burst_collapse_threshold)
+DECL_TUNABLE_ATTR(merge_timeout_ms, 1, 10000)
+DECL_TUNABLE_ATTR(merge_dump_size, 1, 4096)
+DECL_CHECKED_TUNABLE_ATTR(burst_collapse_threshold, 0, 4096, value < merge_buffer_size)
+DECL_TUNABLE_ATTR(compact_path_encoding, 0, 1)
+DECL_TUNABLE_ATTR(modify_events, 0, 1)
+DECL_TUNABLE_ATTR(modify_coalesce_ms, 100, 60000)
+DECL_TUNABLE_ATTR(genl_overflow_size, 0, 65536)
+
+static ssize_t adaptive_event_merge_show(struct kobject *kobj,
+                            struct kobj_attribute *attr, char *buf)
+{
+    return sprintf(buf, "%d\n", adaptive_event_merge);
+}
+
+static ssize_t adaptive_event_merge_store(struct kobject *kobj,
+                                struct kobj_attribute *attr, char *buf,
+                                size_t count)
+{
+    int ret, adaptive;
+
+    ret = sscanf(buf, "%d", &adaptive);
+    if (ret != 1)
+        return -EINVAL;
+
+    WRITE_ONCE(adaptive_event_merge, adaptive ? 1 : 0);
+
+    return count;
+}
+
+static struct kobj_attribute adaptive_event_merge_attribute =
+    __ATTR(adaptive_event_merge, 0660, adaptive_event_merge_show, (void *)adaptive_event_merge_store);
+
+static struct attribute *merge_tunable_attrs[] = {
+    &merge_buffer_size_attribute.attr,
+    &merge_timeout_ms_attribute.attr,
+    &merge_dump_size_attribute.attr,
+    &adaptive_event_merge_attribute.attr,
+    &burst_collapse_threshold_attribute.attr,
+    &compact_path_encoding_attribute.attr,
+    &modify_events_attribute.attr,
+    &modify_coalesce_ms_attribute.attr,
+    &genl_overflow_size_attribute.attr,
+    NULL,
+};
+
+static const struct attribute_group merge_tunable_group = {
+    .attrs = merge_tunable_attrs,
+};
+
+DEFINE_PER_CPU(struct vfs_stats, vfs_stats);
+
+static const char *stat_action_names[VFS_STAT_ACTIONS] = {"file-created", "link-created", "symlink-created",
+    "dir-created", "file-deleted", "dir-deleted", "file-renamed", "dir-renamed", "file-renamed-from",
+    "file-renamed-to", "dir-renamed-from", "dir-renamed-to", "mount", "unmount", "subtree-changed",
+    "file-modified"};
+
+#define sum_stat(field) ({ \
+    unsigned long __sum = 0; \
+    int __cpu; \
+    for_each_possible_cpu(__cpu) \
+        __sum += per_cpu(vfs_stats.field, __cpu); \
+    __sum; \
+})
+
+/*
+ * one line per action: name seen merged dropped
+ * then one line per counter: name value
+ */
+static ssize_t stats_show(struct kobject *kobj,
+                            struct kobj_attribute *attr, char *buf)
+{
+    ssize_t len = 0;
+    int i;
+
+    for (i = 0; i < VFS_STAT_ACTIONS; ++i) {
+        len += scnprintf(buf + len, PAGE_SIZE - len, "%s %lu %lu %lu\n", stat_action_names[i],
+                         sum_stat(actions[VFS_STAT_SEEN][i]), sum_stat(actions[VFS_STAT_MERGED][i]),
+                         sum_stat(actions[VFS_STAT_DROPPED][i]));
+    }
+    len += scnprintf(buf + len, PAGE_SIZE - len, "alloc_failures %lu\n", sum_stat(alloc_failures));
+    len += scnprintf(buf + len, PAGE_SIZE - len, "genl_new_failures %lu\n", sum_stat(genl_new_failures));
+    len += scnprintf(buf + len, PAGE_SIZE - len, "genl_multicast_failures %lu\n", sum_stat(genl_multicast_failures));
+    len += scnprintf(buf + len, PAGE_SIZE - len, "genl_deferred %lu\n", sum_stat(genl_deferred));
+    len += scnprintf(buf + len, PAGE_SIZE - len, "genl_overflows %lu\n", sum_stat(genl_overflows));
+    len += scnprintf(buf + len, PAGE_SIZE - len, "genl_overflow_number %d\n", vfs_genl_overflow_number());
+    len += scnprintf(buf + len, PAGE_SIZE - len, "kretprobes_nmissed %lu\n", vfs_kretprobes_nmissed());
+    len += scnprintf(buf + len, PAGE_SIZE - len, "fprobe_nmissed %lu\n", vfs_fprobe_nmissed());
+    len += scnprintf(buf + len, PAGE_SIZE - len, "events_number %d\n", event_merge_pending_number());
+
+    return len;
+}
+
+static struct kobj_attribute stats_attribute =
+    __ATTR(stats, 0444, stats_show, NULL);
+
+/* one line per bucket: the lower bound in us and the count */
+static ssize_t merge_residence_us_show(struct kobject *kobj,
+                            struct kobj_attribute *attr, char *buf)
+{
+    ssize_t len = 0;
+    int i;
+
+    for (i = 0; i < VFS_RESIDENCE_BUCKETS; ++i) {
+        len += scnprintf(buf + len, PAGE_SIZE - len, "%lu %lu\n", i ? 1UL << i : 0UL,
+                         sum_stat(residence[i]));
+    }
+
+    return len;
+}
+
+static struct kobj_attribute merge_residence_us_attribute =
+    __ATTR(merge_residence_us, 0444, merge_residence_us_show, NULL);
+
 int vfs_init_sysfs(void)
 {
     int error = 0;
@@ -172,8 +586,47 @@ int vfs_init_sysfs(void)
         goto err_disable_event_merge;
     }
 
+    error = sysfs_create_file(vfs_monitor,
+        &vfs_path_filters_attribute.attr);
+    if (error) {
+        mpr_info("failed to create the vfs_path_filters file "
+                "in /sys/kernel/vfs_monitor\n");
+        goto err_path_filters;
+    }
+
+    error = sysfs_create_file(vfs_monitor,
+        &stats_attribute.attr);
+    if (error) {
+        mpr_info("failed to create the stats file "
+                "in /sys/kernel/vfs_monitor\n");
+        goto err_stats;
+    }
+
+    error = sysfs_create_file(vfs_monitor,
+        &merge_residence_us_attribute.attr);
+    if (error) {
+        mpr_info("failed to create the merge_residence_us file "
+                "in /sys/kernel/vfs_monitor\n");
+        goto err_merge_residence_us;
+    }
+
+    error = sysfs_create_group(vfs_monitor, &merge_tunable_group);
+    if (error) {
+        mpr_info("failed to create the merge tunable files "
+                "in /sys/kernel/vfs_monitor\n");
+        goto err_merge_tunables;
+    }
+
     return 0;
 
+err_merge_tunables:
+    sysfs_remove_file(vfs_monitor, &merge_residence_us_attribute.attr);
+err_merge_residence_us:
+    sysfs_remove_file(vfs_monitor, &stats_attribute.attr);
+err_stats:
+    sysfs_remove_file(vfs_monitor, &vfs_path_filters_attribute.attr);
+err_path_filters:
+    sysfs_remove_file(vfs_monitor, &disable_event_merge_attribute.attr);
 err_disable_event_merge:
     sysfs_remove_file(vfs_monitor, &trace_event_mask_attribute.attr);
 err_trace_event_mask:
@@ -185,10 +638,18 @@ err_unnamed_devices:
 
 void vfs_exit_sysfs(void)
 {
+    sysfs_remove_group(vfs_monitor, &merge_tunable_group);
+    sysfs_remove_file(vfs_monitor, &merge_residence_us_attribute.attr);
+    sysfs_remove_file(vfs_monitor, &stats_attribute.attr);
+    sysfs_remove_file(vfs_monitor, &vfs_path_filters_attribute.attr);
     sysfs_remove_file(vfs_monitor, &disable_event_merge_attribute.attr);
     sysfs_remove_file(vfs_monitor, &trace_event_mask_attribute.attr);
     sysfs_remove_file(vfs_monitor, &vfs_unnamed_devices_attribute.attr);
     kobject_put(vfs_monitor);
+
+    /* no reader is left, the event sources are gone */
+    free_path_filters(rcu_dereference_protected(vfs_path_filters, 1));
+    rcu_barrier();
 }
 
 
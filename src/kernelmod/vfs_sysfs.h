@@ -9,8 +9,16 @@ int vfs_init_sysfs(void);
 
 void vfs_exit_sysfs(void);
 
-#define MAX_MINOR 255
+/* the unnamed devices, 0:N, are monitored by the bits of vfs_unnamed_devices, N is 20 bits */
+#define MAX_MINOR ((1U << MINORBITS) - 1)
 
-#define IS_INVALID_DEVICE(dev) (!MAJOR(dev) && !vfs_unnamed_devices[MINOR(dev)])
+/* return 1 if the path of the device is rejected by the path filters */
+int vfs_path_filtered(dev_t dev, const char *path);
+
+/* the traced actions, mount and unmount are never filtered */
+#define IS_FILTERED_EVENT(action, dev, path) (((action) < ACT_MOUNT || (action) == ACT_MODIFY_FILE) && !(trace_event_mask & (1 << (action))) && \
+    vfs_path_filtered(dev, path))
+
+#define IS_INVALID_DEVICE(dev) (!MAJOR(dev) && !test_bit(MINOR(dev), vfs_unnamed_devices))
 
 #endif /* SYSFS_H */
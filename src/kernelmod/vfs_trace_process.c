@@ -6,9 +6,14 @@
 #include <linux/file.h>
 #include <linux/sched/mm.h>
 #include <linux/cred.h>
+#include <linux/hash.h>
+#include <linux/slab.h>
+#include <linux/rcupdate.h>
+#include <linux/string.h>
 #include "vfs_trace_process.h"
 #include "event.h"
 #include "vfs_change_consts.h"
+#include "vfs_kgenl.h"
 
 #include <linux/version.h>
 // For kernel >= 5.8, mmap_lock APIs are in <linux/mmap_lock.h>
@@ -20,6 +25,101 @@ extern unsigned int trace_event_mask;
 
 static int (*vfs_changed_entry)(struct vfs_event *event);
 
+/*
+ * exe path cache
+ *
+ * a process usually makes many changes in a row (rm -rf, tar x, ...), the exe
+ * path of it is resolved once and kept in a small direct mapped cache, keyed
+ * by tgid and the identity of the exe file.
+ * the exe file of current is read under rcu without the mmap lock, it is only
+ * compared with the key, a new exe (exec, PR_SET_MM_EXE_FILE) misses the cache.
+ * the uid is not cached, it is per thread and may change with setuid.
+ */
+#define EXE_CACHE_BITS 6
+
+struct exe_cache_entry {
+    struct rcu_head rcu;
+    pid_t tgid;
+    const struct file *exe_file;    /* compared only, never dereferenced */
+    unsigned long ino;
+    dev_t dev;
+    char path[];
+};
+
+static struct exe_cache_entry __rcu *exe_cache[1 << EXE_CACHE_BITS];
+
+static inline struct exe_cache_entry __rcu **exe_cache_slot(pid_t tgid)
+{
+    return &exe_cache[hash_32(tgid, EXE_CACHE_BITS)];
+}
+
+static inline int exe_cache_match(struct exe_cache_entry *entry, pid_t tgid, struct file *exe_file)
+{
+    struct inode *inode = file_inode(exe_file);
+
+    /* the file may be freed and the address reused, check the inode too */
+    return entry->tgid == tgid && entry->exe_file == exe_file &&
+        entry->ino == inode->i_ino && entry->dev == inode->i_sb->s_dev;
+}
+
+/* fill the proc info from the cache, return 0 on hit */
+static int exe_cache_fill(struct vfs_event *event)
+{
+    struct mm_struct *mm = current->mm;
+    struct exe_cache_entry *entry;
+    struct file *exe_file;
+    int ret = -ENOENT;
+
+    /* kernel threads */
+    if (!mm)
+        return ret;
+
+    rcu_read_lock();
+    exe_file = rcu_dereference(mm->exe_file);
+    entry = rcu_dereference(*exe_cache_slot(current->tgid));
+    if (exe_file && entry && exe_cache_match(entry, current->tgid, exe_file))
+        ret = vfs_event_alloc_proc_info_atomic(event, entry->path);
+    rcu_read_unlock();
+
+    return ret;
+}
+
+static void exe_cache_update(pid_t tgid, struct file *exe_file, const char *path)
+{
+    struct exe_cache_entry *entry, *old;
+    struct inode *inode = file_inode(exe_file);
+    size_t len = strlen(path);
+
+    entry = kmalloc(sizeof(*entry) + len + 1, GFP_ATOMIC);
+    if (!entry)
+        return;
+    entry->tgid = tgid;
+    entry->exe_file = exe_file;
+    entry->ino = inode->i_ino;
+    entry->dev = inode->i_sb->s_dev;
+    memcpy(entry->path, path, len + 1);
+
+    /* xchg is fully ordered, the entry is initialized before it is published */
+    old = xchg((struct exe_cache_entry __force **)exe_cache_slot(tgid), entry);
+    if (old)
+        kfree_rcu(old, rcu);
+}
+
+void cleanup_vfs_trace_process(void)
+{
+    struct exe_cache_entry *entry;
+    int i;
+
+    /* the event sources are gone, wait for the readers and the pending kfree_rcu */
+    synchronize_rcu();
+    rcu_barrier();
+    for (i = 0; i < ARRAY_SIZE(exe_cache); ++i) {
+        entry = rcu_dereference_protected(exe_cache[i], 1);
+        RCU_INIT_POINTER(exe_cache[i], NULL);
+        kfree(entry);
+    }
+}
+
 /**
  * @brief get_task_exe_file_for_module - Safely get a task's executable file from a module.
  *
@@ -79,27 +179,29 @@ static struct file *get_task_exe_file_for_module(struct task_struct *task)
 static int do_trace_process(struct vfs_event *event)
 {
     struct file *exe_file;
+    char *buf, *path;
 
-    if (trace_event_mask & (1 << event->action))
+    /* nobody listens to the process info, do not look it up */
+    if ((trace_event_mask & (1 << event->action)) && vfs_genl_want_proc_info())
     {
         /* event->proc_info will be freed together with event  */
-        if (vfs_event_alloc_proc_info_atomic(event))
-            goto quit;
-
-        /* set tgid to 0 to indicate that the proc_info is invalid */
-        event->proc_info->tgid = 0;
-
-        exe_file = get_task_exe_file_for_module(current);
-        if (NULL == exe_file)
-            goto quit;
-
-        event->proc_info->path = file_path(exe_file, event->proc_info->buf, sizeof(event->proc_info->buf));
-        if (!IS_ERR(event->proc_info->path)) {
+        if (exe_cache_fill(event)) {
+            exe_file = get_task_exe_file_for_module(current);
+            if (NULL == exe_file)
+                goto quit;
+
+            buf = vfs_path_scratch_get();
+            path = file_path(exe_file, buf, VFS_EVENT_PATH_LEN);
+            if (!IS_ERR(path) && !vfs_event_alloc_proc_info_atomic(event, path))
+                exe_cache_update(current->tgid, exe_file, path);
+            vfs_path_scratch_put();
+
+            fput(exe_file);
+        }
+        if (event->proc_info) {
             event->proc_info->uid = from_kuid(&init_user_ns, task_uid(current));
             event->proc_info->tgid = current->tgid;
         }
-
-        fput(exe_file);
     }
 
 quit:
@@ -6,5 +6,6 @@
 #define TRACE_PROCESS_H
 
 void *vfs_get_trace_process_entry(void *vfs_changed_func);
+void cleanup_vfs_trace_process(void);
 
 #endif /* TRACE_PROCESS_H */
@@ -38,7 +38,7 @@ typedef struct _FileEvent {
     guint8      action;
     guint32     cookie;
     guint16     major;
-    guint8      minor;
+    guint32     minor;
     gchar       event_path[MAX_PATH_LEN];
     guint32     uid;
     gint32      pid;
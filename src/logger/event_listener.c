@@ -9,20 +9,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <netlink/genl/genl.h>
 #include <netlink/genl/ctrl.h>
 #include "../kernelmod/vfs_genl.h"
 
-/**
- * ACT_INVALID:
- * 
- * Sentinel value to indicate an invalid or uninitialized action.
- * Value 100 is chosen to be outside the normal range of VFS actions
- * which typically use lower values (0-20).
- */
-#define ACT_INVALID 100
-
 /**
  * EventListener:
  * 
@@ -35,7 +27,6 @@ struct EventListener {
     guint event_mask;               /**< Bitmask of monitored events */
     FileEventHandler handler;       /**< User callback function */
     gpointer user_data;             /**< User data for callback */
-    FileEvent *event;               /**< Current event being processed */
 };
 
 /**
@@ -47,11 +38,7 @@ struct EventListener {
  */
 static FileEvent *file_event_new(void)
 {
-    FileEvent *event = g_slice_new0(FileEvent);
-    if (event) {
-        event->action = ACT_INVALID;
-    }
-    return event;
+    return g_slice_new0(FileEvent);
 }
 
 /**
@@ -111,7 +98,7 @@ static void safe_string_copy(char *dest, const char *src, size_t dest_size)
 //     if (attr[VFSMONITOR_A_MAJOR])
 //         major = nla_get_u16(attr[VFSMONITOR_A_MAJOR]);
 //     if (attr[VFSMONITOR_A_MINOR])
-//         minor = nla_get_u8(attr[VFSMONITOR_A_MINOR]);
+//         minor = nla_get_u32(attr[VFSMONITOR_A_MINOR]);
 //     if (attr[VFSMONITOR_A_PATH])
 //         path = nla_get_string(attr[VFSMONITOR_A_PATH]);
     
@@ -139,6 +126,80 @@ static void safe_string_copy(char *dest, const char *src, size_t dest_size)
 //     return 0;
 // }
 
+/**
+ * handle_dentry_attrs:
+ * @listener: EventListener instance
+ * @attrs: Parsed attributes of one dentry event
+ * @dirs: The dirs defined in the batch message, or NULL
+ * 
+ * Builds a FileEvent from the attributes of one traced event, which carry
+ * the process info along with the dentry info, and dispatches it to the handler.
+ * The path is either a whole path, or a name in one of @dirs.
+ * 
+ * Returns: NL_OK on success, NL_SKIP on recoverable errors
+ */
+static int handle_dentry_attrs(EventListener *listener, struct nlattr *attrs[], const char **dirs)
+{
+    FileEvent *event;
+    guint8 act;
+    const char *dir = NULL;
+
+    // Extract and validate action
+    g_return_val_if_fail(attrs[VFSMONITOR_A_ACT] != NULL, NL_SKIP);
+    act = nla_get_u8(attrs[VFSMONITOR_A_ACT]);
+    
+    // Check if this event type is in our mask
+    if (!((1 << act) & listener->event_mask)) {
+        return NL_OK; // Not an error, just filtered out
+    }
+    
+    // Extract all required attributes
+    g_return_val_if_fail(attrs[VFSMONITOR_A_COOKIE] != NULL, NL_SKIP);
+    g_return_val_if_fail(attrs[VFSMONITOR_A_MAJOR] != NULL, NL_SKIP);
+    g_return_val_if_fail(attrs[VFSMONITOR_A_MINOR] != NULL, NL_SKIP);
+    if (!attrs[VFSMONITOR_A_PATH]) {
+        g_return_val_if_fail(dirs != NULL, NL_SKIP);
+        g_return_val_if_fail(attrs[VFSMONITOR_A_DIR_ID] != NULL, NL_SKIP);
+        g_return_val_if_fail(attrs[VFSMONITOR_A_NAME] != NULL, NL_SKIP);
+        g_return_val_if_fail(nla_get_u16(attrs[VFSMONITOR_A_DIR_ID]) < VFSMONITOR_BATCH_DIRS, NL_SKIP);
+        dir = dirs[nla_get_u16(attrs[VFSMONITOR_A_DIR_ID])];
+        g_return_val_if_fail(dir != NULL, NL_SKIP);
+    }
+    g_return_val_if_fail(attrs[VFSMONITOR_A_UID] != NULL, NL_SKIP);
+    g_return_val_if_fail(attrs[VFSMONITOR_A_TGID] != NULL, NL_SKIP);
+    g_return_val_if_fail(attrs[VFSMONITOR_A_EXE] != NULL, NL_SKIP);
+
+    event = file_event_new();
+    if (!event) {
+        g_warning("Failed to allocate memory for FileEvent");
+        return NL_SKIP;
+    }
+    event->action = act;
+    event->cookie = nla_get_u32(attrs[VFSMONITOR_A_COOKIE]);
+    event->major = nla_get_u16(attrs[VFSMONITOR_A_MAJOR]);
+    event->minor = nla_get_u32(attrs[VFSMONITOR_A_MINOR]);
+    if (dir) {
+        if (g_snprintf(event->event_path, sizeof(event->event_path), "%s/%s",
+                       dir, nla_get_string(attrs[VFSMONITOR_A_NAME])) >= (gint)sizeof(event->event_path))
+            g_warning("Path truncated: %s/%s", dir, nla_get_string(attrs[VFSMONITOR_A_NAME]));
+    } else {
+        safe_string_copy(event->event_path, nla_get_string(attrs[VFSMONITOR_A_PATH]), sizeof(event->event_path));
+    }
+    event->uid = nla_get_u32(attrs[VFSMONITOR_A_UID]);
+    event->pid = nla_get_s32(attrs[VFSMONITOR_A_TGID]);
+    safe_string_copy(event->process_path, nla_get_string(attrs[VFSMONITOR_A_EXE]), sizeof(event->process_path));
+
+    // Event is complete - dispatch to handler
+    if (listener->handler) {
+        listener->handler(listener->user_data, event);
+    } else {
+        g_warning("No event handler registered, freeing event");
+        file_event_free(event);
+    }
+
+    return NL_OK;
+}
+
 /**
  * event_handler:
  * @msg: Netlink message
@@ -153,8 +214,9 @@ static int event_handler(struct nl_msg *msg, void *arg)
     struct nlattr *attrs[VFSMONITOR_A_MAX+1];
     struct nlmsghdr *nlhdr;
     struct genlmsghdr *genlhdr;
-    char *path;
-    guint8 act;
+    struct nlattr *pos;
+    int rem;
+    const char *dirs[VFSMONITOR_BATCH_DIRS];
     
     g_return_val_if_fail(msg != NULL, NL_SKIP);
     g_return_val_if_fail(arg != NULL, NL_SKIP);
@@ -169,80 +231,38 @@ static int event_handler(struct nl_msg *msg, void *arg)
     }
 
     EventListener *listener = (EventListener *)arg;
-    
-    // Ensure we have a current event structure
-    if (!listener->event) {
-        listener->event = file_event_new();
-        if (!listener->event) {
-            g_warning("Failed to allocate memory for FileEvent");
-            return NL_SKIP;
-        }
-    }
 
     switch (genlhdr->cmd) {
         case VFSMONITOR_C_NOTIFY:
             // print_dentry_msg(attrs);
-            // Extract and validate action
-            g_return_val_if_fail(attrs[VFSMONITOR_A_ACT] != NULL, NL_SKIP);
-            act = nla_get_u8(attrs[VFSMONITOR_A_ACT]);
-            
-            // Check if this event type is in our mask
-            if (!((1 << act) & listener->event_mask)) {
-                return NL_OK; // Not an error, just filtered out
-            }
-            
-            // Warn if we're getting events out of order
-            if (listener->event->action != ACT_INVALID) {
-                // Maybe the kernel module not support process info event
-                // Maybe some events are lost for socket receive buffer overflow
-                g_debug("Expected a process info event, but received a new notify event");
-                // Reset the event to handle the new one
-                listener->event->action = ACT_INVALID;
+            return handle_dentry_attrs(listener, attrs, NULL);
+
+        case VFSMONITOR_C_NOTIFY_BATCH:
+            // The dirs of the compact path encoding are defined ahead of the events
+            memset(dirs, 0, sizeof(dirs));
+            nla_for_each_attr(pos, genlmsg_attrdata(genlhdr, 0), genlmsg_attrlen(genlhdr, 0), rem) {
+                if (nla_type(pos) != VFSMONITOR_A_EVENT && nla_type(pos) != VFSMONITOR_A_DIR)
+                    continue;
+                ret = nla_parse_nested(attrs, VFSMONITOR_A_MAX, pos, vfsmonitor_genl_policy);
+                if (ret < 0) {
+                    g_warning("Failed to parse batched event: %s", strerror(-ret));
+                    continue;
+                }
+                if (nla_type(pos) == VFSMONITOR_A_DIR) {
+                    if (attrs[VFSMONITOR_A_DIR_ID] && attrs[VFSMONITOR_A_PATH] &&
+                        nla_get_u16(attrs[VFSMONITOR_A_DIR_ID]) < VFSMONITOR_BATCH_DIRS)
+                        dirs[nla_get_u16(attrs[VFSMONITOR_A_DIR_ID])] = nla_get_string(attrs[VFSMONITOR_A_PATH]);
+                    continue;
+                }
+                handle_dentry_attrs(listener, attrs, dirs);
             }
-            
-            // Extract all required attributes
-            listener->event->action = act;            
-            g_return_val_if_fail(attrs[VFSMONITOR_A_COOKIE] != NULL, NL_SKIP);
-            g_return_val_if_fail(attrs[VFSMONITOR_A_MAJOR] != NULL, NL_SKIP);
-            g_return_val_if_fail(attrs[VFSMONITOR_A_MINOR] != NULL, NL_SKIP);
-            g_return_val_if_fail(attrs[VFSMONITOR_A_PATH] != NULL, NL_SKIP);
-            listener->event->cookie = nla_get_u32(attrs[VFSMONITOR_A_COOKIE]);
-            listener->event->major = nla_get_u16(attrs[VFSMONITOR_A_MAJOR]);
-            listener->event->minor = nla_get_u8(attrs[VFSMONITOR_A_MINOR]);
-            path = nla_get_string(attrs[VFSMONITOR_A_PATH]);
-            safe_string_copy(listener->event->event_path, path, sizeof(listener->event->event_path));
             break;
-            
-        case VFSMONITOR_C_NOTIFY_PROCESS_INFO:
-            // print_proc_info_msg(attrs);
-            // Ensure we have a pending event
-            if (listener->event->action == ACT_INVALID) {
-                // After the events are merged, some unattended notify events carry the process info event
-                g_debug("Expected a new notify event, but received a process info event");
-                return NL_OK;
-            }
-            
-            // Extract process information
-            g_return_val_if_fail(attrs[VFSMONITOR_A_UID] != NULL, NL_SKIP);
-            g_return_val_if_fail(attrs[VFSMONITOR_A_TGID] != NULL, NL_SKIP);
-            g_return_val_if_fail(attrs[VFSMONITOR_A_PATH] != NULL, NL_SKIP);
-            listener->event->uid = nla_get_u32(attrs[VFSMONITOR_A_UID]);
-            listener->event->pid = nla_get_s32(attrs[VFSMONITOR_A_TGID]);
-            path = nla_get_string(attrs[VFSMONITOR_A_PATH]);
-            safe_string_copy(listener->event->process_path, path, sizeof(listener->event->process_path));
-            
-            // Event is now complete - dispatch to handler
-            if (listener->handler) {
-                listener->handler(listener->user_data, listener->event);
-            } else {
-                g_warning("No event handler registered, freeing event");
-                file_event_free(listener->event);
-            }
-            
-            // Clear the current event
-            listener->event = NULL;
+
+        case VFSMONITOR_C_NOTIFY_LOST:
+            // The log only records the events that arrive, there is nothing to recover
+            g_debug("Some events are lost in the kernel module");
             break;
-            
+
         default:
             g_warning("Unknown netlink command: %d", genlhdr->cmd);
             return NL_SKIP;
@@ -301,6 +321,25 @@ static gboolean set_max_socket_receive_buffer_size(struct nl_sock *sk)
     return TRUE;
 }
 
+/**
+ * set_broadcast_error:
+ * @sk: Netlink socket
+ *
+ * Makes the kernel module see the messages the socket can not take.
+ *
+ * Returns: TRUE on success, FALSE on failure
+ */
+static gboolean set_broadcast_error(struct nl_sock *sk)
+{
+    int on = 1;
+
+    if (setsockopt(nl_socket_get_fd(sk), SOL_NETLINK, NETLINK_BROADCAST_ERROR, &on, sizeof(on)) < 0) {
+        g_warning("Failed to set NETLINK_BROADCAST_ERROR: %s", strerror(errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
 /**
  * event_listener_join_multicast_group:
  * @listener: EventListener instance
@@ -333,6 +372,46 @@ static gboolean event_listener_join_multicast_group(EventListener *listener, con
     return TRUE;
 }
 
+/**
+ * event_listener_check_family_version:
+ * @listener: EventListener instance
+ * 
+ * Checks that the kernel module speaks a protocol version this listener understands.
+ * 
+ * Returns: TRUE if the version is supported, FALSE otherwise
+ */
+static gboolean event_listener_check_family_version(EventListener *listener)
+{
+    struct nl_cache *cache = NULL;
+    struct genl_family *family;
+    int version;
+
+    g_return_val_if_fail(listener != NULL, FALSE);
+
+    int ret = genl_ctrl_alloc_cache(listener->sock, &cache);
+    if (ret < 0) {
+        g_warning("Failed to get generic netlink families: %s", nl_geterror(ret));
+        return FALSE;
+    }
+
+    family = genl_ctrl_search_by_name(cache, VFSMONITOR_FAMILY_NAME);
+    nl_cache_free(cache);
+    if (!family) {
+        g_warning("Generic netlink family '%s' not found, is the kernel module loaded?", VFSMONITOR_FAMILY_NAME);
+        return FALSE;
+    }
+
+    version = genl_family_get_version(family);
+    genl_family_put(family);
+    if (version < VFSMONITOR_FAMILY_VERSION) {
+        g_warning("The kernel module is too old, protocol version %d, required %d",
+                  version, VFSMONITOR_FAMILY_VERSION);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 EventListener *event_listener_new(FileEventHandler handler, gpointer user_data)
 {
     g_return_val_if_fail(handler != NULL, NULL);
@@ -359,17 +438,20 @@ EventListener *event_listener_new(FileEventHandler handler, gpointer user_data)
     }
 
     set_max_socket_receive_buffer_size(listener->sock);
+    set_broadcast_error(listener->sock);
 
     nl_socket_disable_seq_check(listener->sock);
     nl_socket_disable_auto_ack(listener->sock);
 
-    // Join required multicast groups
-    if (!event_listener_join_multicast_group(listener, VFSMONITOR_MCG_DENTRY_NAME)) {
+    // The process info is carried by the traced events since protocol version 2
+    if (!event_listener_check_family_version(listener)) {
         event_listener_free(listener);
         return NULL;
     }
-    
-    if (!event_listener_join_multicast_group(listener, VFSMONITOR_MCG_PROCESS_INFO_NAME)) {
+
+    // Join required multicast groups
+    // The trace group carries only the traced events with their process info
+    if (!event_listener_join_multicast_group(listener, VFSMONITOR_MCG_TRACE_NAME)) {
         event_listener_free(listener);
         return NULL;
     }
@@ -508,16 +590,6 @@ void event_listener_free(EventListener *listener)
     // Stop monitoring first
     event_listener_stop(listener);
 
-    // Clean up any pending event
-    if (listener->event) {
-        if (listener->event->action != ACT_INVALID) {
-            g_warning("Freeing EventListener with pending event (act=%d)", 
-                     listener->event->action);
-        }
-        file_event_free(listener->event);
-        listener->event = NULL;
-    }
-
     // Close netlink socket
     if (listener->sock) {
         nl_socket_free(listener->sock);
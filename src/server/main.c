@@ -10,7 +10,11 @@
 #include <sys/sysmacros.h>
 #include <locale.h>
 
-#define MAX_MINOR 255
+/* the minor of a device has 20 bits */
+#define MAX_MINOR ((1U << 20) - 1)
+
+/* a write to the sysfs file is at most a page */
+#define MAX_WRITE_SIZE 4096
 
 #define VFS_UNNAMED_DEVICE_FILE "/sys/kernel/vfs_monitor/vfs_unnamed_devices"
 
@@ -83,6 +87,10 @@ static GList *read_vfs_unnamed_device(GError **error)
 
     char **list = g_strsplit(content, ",", 0);
     for (char **p = list; *p; p++) {
+        if (**p == '\0') {
+            g_free(*p);
+            continue;
+        }
         devices = g_list_append(devices, *p);
     }
     /* free list only, devices own the data */
@@ -130,18 +138,32 @@ static void diff_sorted_lists (GList *list1, GList *list2, GCompareFunc compare,
     }
 }
 
+/* append the command of each device to cmds, the cmds are written when they fill a write */
+static void append_vfs_unnamed_device_cmds(GString *cmds, char act, GList *devices)
+{
+    for (GList *iter = devices; iter; iter = iter->next) {
+        /* the separator, the act and the minor */
+        if (cmds->len + strlen(iter->data) + 2 >= MAX_WRITE_SIZE) {
+            write_vfs_unnamed_device(cmds->str);
+            g_string_truncate(cmds, 0);
+        }
+        g_string_append_printf(cmds, "%s%c%s", cmds->len ? "," : "", act, (char *) iter->data);
+    }
+}
+
 static void update_vfs_unnamed_device(GList *news)
 {
-    char buf[32];
+    GString *cmds;
     GList *olds, *removed, *added;
     GError *error = NULL;
-    GList *iter;
 
+    cmds = g_string_new(NULL);
     olds = read_vfs_unnamed_device(&error);
     if (error) {
-        g_warning("Failed to read vfs_unnamed_devices: %s", error->message);
+        /* the old devices are not known, too many to read, they are all cleared and set again */
+        g_warning("Failed to read vfs_unnamed_devices: %s, setting them all", error->message);
         g_error_free(error);
-        return;
+        g_string_append_c(cmds, 'e');
     }
 
     olds = g_list_sort(olds, (GCompareFunc) g_strcmp0);
@@ -149,15 +171,12 @@ static void update_vfs_unnamed_device(GList *news)
 
     diff_sorted_lists(olds, news, (GCompareFunc) g_strcmp0, &added, &removed);
 
-    for (iter = removed; iter; iter = iter->next) {
-        snprintf(buf, sizeof(buf), "r%s", (char *) iter->data);
-        write_vfs_unnamed_device(buf);
-    }
-
-    for (iter = added; iter; iter = iter->next) {
-        snprintf(buf, sizeof(buf), "a%s", (char *) iter->data);
-        write_vfs_unnamed_device(buf);
-    }
+    /* all the changes are made by one write, the kernel applies them at once */
+    append_vfs_unnamed_device_cmds(cmds, 'r', removed);
+    append_vfs_unnamed_device_cmds(cmds, 'a', added);
+    if (cmds->len)
+        write_vfs_unnamed_device(cmds->str);
+    g_string_free(cmds, TRUE);
 
     /* free list only for added and removed, because news and olds own the data */
     g_list_free(added);